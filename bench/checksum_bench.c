@@ -0,0 +1,98 @@
+#define _GNU_SOURCE
+#include "crc32.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_TOTAL_MB 1024
+
+typedef uint32_t (*checksum_fn)(const void *data, size_t length);
+
+static uint32_t legacy_crc32(const void *data, size_t length) {
+    return appendfs_crc32(data, length);
+}
+
+static uint32_t crc32c_dispatch(const void *data, size_t length) {
+    return appendfs_crc32c(data, length);
+}
+
+static uint32_t crc32c_software(const void *data, size_t length) {
+    return appendfs_crc32c_update_sw(0, data, length);
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Checksum total bytes in chunks of chunk bytes and return GB/s. */
+static double measure(checksum_fn fn, const unsigned char *buf, size_t buf_size, size_t chunk, size_t total, uint32_t *sink) {
+    size_t done = 0;
+    size_t pos = 0;
+    double start = now_seconds();
+    while (done < total) {
+        if (pos + chunk > buf_size) {
+            pos = 0;
+        }
+        *sink += fn(buf + pos, chunk);
+        pos += chunk;
+        done += chunk;
+    }
+    double elapsed = now_seconds() - start;
+    return elapsed > 0 ? (double)done / elapsed / 1e9 : 0.0;
+}
+
+int main(int argc, char **argv) {
+    size_t total_mb = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_TOTAL_MB;
+    if (total_mb == 0) {
+        total_mb = DEFAULT_TOTAL_MB;
+    }
+    const size_t buf_size = 16u * 1024 * 1024;
+    unsigned char *buf = malloc(buf_size);
+    if (!buf) {
+        perror("malloc");
+        return 1;
+    }
+    for (size_t i = 0; i < buf_size; ++i) {
+        buf[i] = (unsigned char)(i * 2654435761u >> 13);
+    }
+    if (appendfs_crc32c(buf, buf_size) != appendfs_crc32c_update_sw(0, buf, buf_size)) {
+        fprintf(stderr, "crc32c backends disagree\n");
+        free(buf);
+        return 1;
+    }
+
+    static const struct {
+        const char *name;
+        checksum_fn fn;
+    } impls[] = {
+        {"crc32 (legacy)", legacy_crc32},
+        {"crc32c slice8", crc32c_software},
+        {"crc32c dispatch", crc32c_dispatch},
+    };
+    static const size_t chunks[] = {64, 512, 4096, 65536, 1024 * 1024};
+
+    printf("crc32c backend: %s, %zu MiB per run\n", appendfs_crc32c_backend(), total_mb);
+    printf("%-18s", "impl \\ chunk");
+    for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); ++c) {
+        printf("%10zu", chunks[c]);
+    }
+    printf("   (GB/s)\n");
+
+    uint32_t sink = 0;
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); ++i) {
+        printf("%-18s", impls[i].name);
+        for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); ++c) {
+            double gbps = measure(impls[i].fn, buf, buf_size, chunks[c], total_mb * 1024 * 1024, &sink);
+            printf("%10.2f", gbps);
+        }
+        putchar('\n');
+    }
+    printf("checksum sink: %08x\n", sink);
+    free(buf);
+    return 0;
+}
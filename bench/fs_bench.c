@@ -0,0 +1,652 @@
+#define _GNU_SOURCE
+#include "appendfs.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_FILE_MB 256
+#define DEFAULT_IO_SIZE (64 * 1024)
+#define DEFAULT_FILES 20000
+#define DEFAULT_ROUNDS 20
+#define SMALL_FILE_SIZE 1024
+#define TINY_FILE_SIZE 200
+#define CORPUS_SIZE (1024 * 1024)
+#define TREE_FANOUT 32
+
+struct bench_config {
+    const char *dir;
+    size_t file_mb;
+    size_t io_size;
+    size_t files;
+    size_t rounds;
+};
+
+/* Per-operation latencies of one workload, in nanoseconds. */
+struct latencies {
+    uint64_t *ns;
+    size_t count;
+    size_t capacity;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int record_latency(struct latencies *lat, uint64_t ns) {
+    if (lat->count == lat->capacity) {
+        size_t new_capacity = lat->capacity ? lat->capacity * 2 : 1024;
+        uint64_t *values = realloc(lat->ns, new_capacity * sizeof(*values));
+        if (!values) {
+            return -1;
+        }
+        lat->ns = values;
+        lat->capacity = new_capacity;
+    }
+    lat->ns[lat->count++] = ns;
+    return 0;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_us(struct latencies *lat, double pct) {
+    if (lat->count == 0) {
+        return 0.0;
+    }
+    size_t idx = (size_t)(pct / 100.0 * (double)(lat->count - 1) + 0.5);
+    return (double)lat->ns[idx] / 1e3;
+}
+
+/*
+ * Print one machine-readable line per workload: ops and bytes completed,
+ * wall time, throughput, and per-operation latency percentiles.
+ */
+static void report(const char *workload, struct latencies *lat, uint64_t bytes, uint64_t elapsed_ns) {
+    qsort(lat->ns, lat->count, sizeof(*lat->ns), compare_u64);
+    double seconds = (double)elapsed_ns / 1e9;
+    printf("workload=%s ops=%zu bytes=%llu seconds=%.4f ops_s=%.0f mb_s=%.1f p50_us=%.1f p99_us=%.1f max_us=%.1f\n", workload, lat->count,
+           (unsigned long long)bytes, seconds, seconds > 0 ? (double)lat->count / seconds : 0.0,
+           seconds > 0 ? (double)bytes / seconds / 1e6 : 0.0, percentile_us(lat, 50.0), percentile_us(lat, 99.0),
+           lat->count ? (double)lat->ns[lat->count - 1] / 1e3 : 0.0);
+    fflush(stdout);
+    lat->count = 0;
+}
+
+static int fail(const char *what) {
+    fprintf(stderr, "%s: %s\n", what, strerror(errno));
+    return -1;
+}
+
+static void fill(unsigned char *buf, size_t size, uint32_t seed) {
+    for (size_t i = 0; i < size; ++i) {
+        buf[i] = (unsigned char)((i + seed) * 2654435761u >> 13);
+    }
+}
+
+static int write_workload(struct appendfs_context *ctx, const struct bench_config *cfg, struct latencies *lat, int random) {
+    const char *path = random ? "/rand_write" : "/seq_write";
+    size_t total = cfg->file_mb * 1024 * 1024;
+    size_t ops = total / cfg->io_size;
+    unsigned char *buf = malloc(cfg->io_size);
+    if (!buf) {
+        return fail("malloc");
+    }
+    fill(buf, cfg->io_size, random);
+    struct appendfs_file *file = appendfs_open_file(ctx, path, O_CREAT | O_RDWR, 0644);
+    if (!file) {
+        free(buf);
+        return fail(path);
+    }
+    uint32_t state = 12345;
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < ops; ++i) {
+        off_t offset = (off_t)(i * cfg->io_size);
+        if (random) {
+            state = state * 1103515245u + 12345u;
+            offset = (off_t)((state >> 8) % ops) * (off_t)cfg->io_size;
+        }
+        uint64_t t0 = now_ns();
+        if (appendfs_write(file, buf, cfg->io_size, offset) != (ssize_t)cfg->io_size) {
+            appendfs_close_file(file);
+            free(buf);
+            return fail("appendfs_write");
+        }
+        record_latency(lat, now_ns() - t0);
+    }
+    int rc = appendfs_fsync(file, 0);
+    uint64_t elapsed = now_ns() - start;
+    appendfs_close_file(file);
+    free(buf);
+    if (rc == -1) {
+        return fail("appendfs_fsync");
+    }
+    report(random ? "rand_write" : "seq_write", lat, (uint64_t)ops * cfg->io_size, elapsed);
+    return 0;
+}
+
+/* Drop $dir/data from the page cache so reads come from the device. */
+static void drop_data_cache(const struct bench_config *cfg) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/data", cfg->dir);
+    int fd = open(path, O_RDONLY);
+    if (fd != -1) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+/*
+ * Stream /seq_write back through one handle from a cold page cache, with
+ * readahead and then without it.
+ */
+static int seq_read_workload(struct appendfs_context *ctx, const struct bench_config *cfg, struct latencies *lat) {
+    unsigned char *buf = malloc(cfg->io_size);
+    if (!buf) {
+        return fail("malloc");
+    }
+    struct appendfs_options opts;
+    appendfs_get_options(ctx, &opts);
+    unsigned int flags = opts.flags;
+    int rc = 0;
+    for (int pass = 0; pass < 2 && rc == 0; ++pass) {
+        opts.flags = pass == 0 ? flags | APPENDFS_OPT_READAHEAD : flags & ~APPENDFS_OPT_READAHEAD;
+        appendfs_set_options(ctx, &opts);
+        drop_data_cache(cfg);
+        struct appendfs_cache_stats before, after;
+        appendfs_get_cache_stats(ctx, &before);
+        struct appendfs_file *file = appendfs_open_file(ctx, "/seq_write", O_RDONLY, 0);
+        if (!file) {
+            rc = fail("/seq_write");
+            break;
+        }
+        uint64_t bytes = 0;
+        uint64_t start = now_ns();
+        for (;;) {
+            uint64_t t0 = now_ns();
+            ssize_t n = appendfs_read_file(file, buf, cfg->io_size, (off_t)bytes);
+            if (n < 0) {
+                rc = fail("appendfs_read_file");
+                break;
+            }
+            if (n == 0) {
+                break;
+            }
+            record_latency(lat, now_ns() - t0);
+            bytes += (uint64_t)n;
+        }
+        uint64_t elapsed = now_ns() - start;
+        appendfs_close_file(file);
+        if (rc == 0) {
+            report(pass == 0 ? "seq_read" : "seq_read_no_ra", lat, bytes, elapsed);
+            appendfs_get_cache_stats(ctx, &after);
+            printf("readahead calls=%llu bytes=%llu\n", (unsigned long long)(after.readahead_calls - before.readahead_calls),
+                   (unsigned long long)(after.readahead_bytes - before.readahead_bytes));
+        }
+    }
+    opts.flags = flags;
+    appendfs_set_options(ctx, &opts);
+    free(buf);
+    return rc;
+}
+
+static void small_file_path(char *out, size_t size, size_t i) {
+    snprintf(out, size, "/small/d%zu/f%zu", i % TREE_FANOUT, i);
+}
+
+static int create_workload(struct appendfs_context *ctx, const struct bench_config *cfg, struct latencies *lat) {
+    unsigned char buf[SMALL_FILE_SIZE];
+    fill(buf, sizeof(buf), 7);
+    if (appendfs_mkdir(ctx, "/small", 0755) == -1) {
+        return fail("/small");
+    }
+    for (size_t d = 0; d < TREE_FANOUT; ++d) {
+        char path[64];
+        snprintf(path, sizeof(path), "/small/d%zu", d);
+        if (appendfs_mkdir(ctx, path, 0755) == -1) {
+            return fail(path);
+        }
+    }
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < cfg->files; ++i) {
+        char path[64];
+        small_file_path(path, sizeof(path), i);
+        uint64_t t0 = now_ns();
+        struct appendfs_file *file = appendfs_open_file(ctx, path, O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (!file) {
+            return fail(path);
+        }
+        ssize_t written = appendfs_write(file, buf, sizeof(buf), 0);
+        if (appendfs_close_file(file) == -1 || written != (ssize_t)sizeof(buf)) {
+            return fail(path);
+        }
+        record_latency(lat, now_ns() - t0);
+    }
+    report("create", lat, (uint64_t)cfg->files * SMALL_FILE_SIZE, now_ns() - start);
+    return 0;
+}
+
+static int stat_workload(struct appendfs_context *ctx, const struct bench_config *cfg, struct latencies *lat) {
+    uint32_t state = 99;
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < cfg->files; ++i) {
+        state = state * 1103515245u + 12345u;
+        char path[64];
+        small_file_path(path, sizeof(path), (state >> 8) % cfg->files);
+        struct stat st;
+        uint64_t t0 = now_ns();
+        if (appendfs_stat(ctx, path, &st) == -1) {
+            return fail(path);
+        }
+        record_latency(lat, now_ns() - t0);
+    }
+    report("stat", lat, 0, now_ns() - start);
+    return 0;
+}
+
+/* Random whole-file reads of the small files, served by the block cache. */
+static int small_read_workload(struct appendfs_context *ctx, const struct bench_config *cfg, struct latencies *lat) {
+    unsigned char buf[SMALL_FILE_SIZE];
+    struct appendfs_cache_stats before, after;
+    appendfs_get_cache_stats(ctx, &before);
+    uint32_t state = 17;
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < cfg->files; ++i) {
+        state = state * 1103515245u + 12345u;
+        char path[64];
+        small_file_path(path, sizeof(path), (state >> 8) % cfg->files);
+        uint64_t t0 = now_ns();
+        if (appendfs_read(ctx, path, buf, sizeof(buf), 0) != (ssize_t)sizeof(buf)) {
+            return fail(path);
+        }
+        record_latency(lat, now_ns() - t0);
+    }
+    report("small_read", lat, (uint64_t)cfg->files * SMALL_FILE_SIZE, now_ns() - start);
+    appendfs_get_cache_stats(ctx, &after);
+    uint64_t hits = after.hits - before.hits;
+    uint64_t misses = after.misses - before.misses;
+    printf("cache hits=%llu misses=%llu hit_rate=%.3f bytes_cached=%zu\n", (unsigned long long)hits, (unsigned long long)misses,
+           hits + misses ? (double)hits / (double)(hits + misses) : 0.0, after.bytes_cached);
+    return 0;
+}
+
+/*
+ * Create, write and close tiny files, then read each back, with inline data
+ * and then without it.  Each pass reports the $dir/data and $dir/meta bytes
+ * it added and the preads its reads issued.
+ */
+static int tiny_workload(struct appendfs_context *ctx, const struct bench_config *cfg, struct latencies *lat) {
+    unsigned char buf[TINY_FILE_SIZE];
+    unsigned char got[TINY_FILE_SIZE];
+    fill(buf, sizeof(buf), 11);
+    struct appendfs_options opts;
+    appendfs_get_options(ctx, &opts);
+    unsigned int flags = opts.flags;
+    int rc = 0;
+    for (int pass = 0; pass < 2 && rc == 0; ++pass) {
+        const char *dir = pass == 0 ? "/tiny" : "/tiny_no_inline";
+        opts.flags = pass == 0 ? flags & ~APPENDFS_OPT_NO_INLINE : flags | APPENDFS_OPT_NO_INLINE;
+        appendfs_set_options(ctx, &opts);
+        if (appendfs_mkdir(ctx, dir, 0755) == -1) {
+            rc = fail(dir);
+            break;
+        }
+        struct appendfs_space_stats space_before, space_after;
+        appendfs_get_space_stats(ctx, &space_before);
+        uint64_t start = now_ns();
+        for (size_t i = 0; i < cfg->files && rc == 0; ++i) {
+            char path[64];
+            snprintf(path, sizeof(path), "%s/f%zu", dir, i);
+            uint64_t t0 = now_ns();
+            struct appendfs_file *file = appendfs_open_file(ctx, path, O_CREAT | O_EXCL | O_RDWR, 0644);
+            if (!file) {
+                rc = fail(path);
+                break;
+            }
+            ssize_t written = appendfs_write(file, buf, sizeof(buf), 0);
+            if (appendfs_close_file(file) == -1 || written != (ssize_t)sizeof(buf)) {
+                rc = fail(path);
+                break;
+            }
+            record_latency(lat, now_ns() - t0);
+        }
+        if (rc != 0) {
+            break;
+        }
+        report(pass == 0 ? "tiny_create" : "tiny_create_no_inline", lat, (uint64_t)cfg->files * TINY_FILE_SIZE, now_ns() - start);
+        appendfs_get_space_stats(ctx, &space_after);
+        struct appendfs_op_stats ops_before[APPENDFS_OP_COUNT], ops_after[APPENDFS_OP_COUNT];
+        appendfs_get_op_stats(ctx, ops_before);
+        start = now_ns();
+        for (size_t i = 0; i < cfg->files; ++i) {
+            char path[64];
+            snprintf(path, sizeof(path), "%s/f%zu", dir, i);
+            uint64_t t0 = now_ns();
+            if (appendfs_read(ctx, path, got, sizeof(got), 0) != (ssize_t)sizeof(got)) {
+                rc = fail(path);
+                break;
+            }
+            record_latency(lat, now_ns() - t0);
+        }
+        if (rc != 0) {
+            break;
+        }
+        report(pass == 0 ? "tiny_read" : "tiny_read_no_inline", lat, (uint64_t)cfg->files * TINY_FILE_SIZE, now_ns() - start);
+        appendfs_get_op_stats(ctx, ops_after);
+        printf("tiny data_bytes=%llu meta_bytes=%llu preads=%llu\n", (unsigned long long)(space_after.data_bytes - space_before.data_bytes),
+               (unsigned long long)(space_after.meta_bytes - space_before.meta_bytes),
+               (unsigned long long)(ops_after[APPENDFS_OP_PREAD].count - ops_before[APPENDFS_OP_PREAD].count));
+    }
+    opts.flags = flags;
+    appendfs_set_options(ctx, &opts);
+    return rc;
+}
+
+/* Source-like text from a small vocabulary, or xorshift noise. */
+static void fill_corpus(unsigned char *buf, size_t size, int text) {
+    static const char *const words[] = {"static ", "int ", "return ", "const ", "char *", "size_t ", "if (", ") {\n", "}\n", "    ",
+                                        "buffer", "length", "offset", "ctx->", " = ", ";\n", "NULL", "0", "errno", "/* note */\n"};
+    uint32_t state = 2463534242u;
+    size_t i = 0;
+    while (i < size) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        if (!text) {
+            buf[i++] = (unsigned char)state;
+            continue;
+        }
+        const char *word = words[state % (sizeof(words) / sizeof(words[0]))];
+        while (*word && i < size) {
+            buf[i++] = (unsigned char)*word++;
+        }
+    }
+}
+
+/*
+ * Write and read back a file of text and one of noise, each with and
+ * without APPENDFS_OPT_COMPRESS, and report the $dir/data bytes each used.
+ */
+static int compress_workload(struct appendfs_context *ctx, const struct bench_config *cfg, struct latencies *lat) {
+    static const char *const names[] = {"compress_text", "compress_text_lz4", "compress_noise", "compress_noise_lz4"};
+    size_t total = cfg->file_mb * 1024 * 1024;
+    size_t ops = total / cfg->io_size;
+    unsigned char *corpus = malloc(CORPUS_SIZE + cfg->io_size);
+    unsigned char *buf = malloc(cfg->io_size);
+    if (!corpus || !buf) {
+        free(corpus);
+        free(buf);
+        return fail("malloc");
+    }
+    struct appendfs_options opts;
+    appendfs_get_options(ctx, &opts);
+    unsigned int flags = opts.flags;
+    int rc = 0;
+    for (int pass = 0; pass < 4 && rc == 0; ++pass) {
+        char path[64];
+        char label[64];
+        snprintf(path, sizeof(path), "/%s", names[pass]);
+        opts.flags = pass % 2 ? flags | APPENDFS_OPT_COMPRESS : flags & ~APPENDFS_OPT_COMPRESS;
+        appendfs_set_options(ctx, &opts);
+        fill_corpus(corpus, CORPUS_SIZE + cfg->io_size, pass < 2);
+        struct appendfs_space_stats before, after;
+        appendfs_get_space_stats(ctx, &before);
+        struct appendfs_file *file = appendfs_open_file(ctx, path, O_CREAT | O_RDWR, 0644);
+        if (!file) {
+            rc = fail(path);
+            break;
+        }
+        uint64_t start = now_ns();
+        for (size_t i = 0; i < ops && rc == 0; ++i) {
+            uint64_t t0 = now_ns();
+            if (appendfs_write(file, corpus + (i * cfg->io_size) % CORPUS_SIZE, cfg->io_size, (off_t)(i * cfg->io_size)) != (ssize_t)cfg->io_size) {
+                rc = fail("appendfs_write");
+            }
+            record_latency(lat, now_ns() - t0);
+        }
+        if (rc == 0 && appendfs_fsync(file, 0) == -1) {
+            rc = fail("appendfs_fsync");
+        }
+        uint64_t elapsed = now_ns() - start;
+        appendfs_close_file(file);
+        if (rc != 0) {
+            break;
+        }
+        snprintf(label, sizeof(label), "%s_write", names[pass]);
+        report(label, lat, (uint64_t)ops * cfg->io_size, elapsed);
+        appendfs_get_space_stats(ctx, &after);
+        uint64_t stored = after.data_bytes - before.data_bytes;
+        printf("compress file=%s logical_bytes=%llu stored_bytes=%llu ratio=%.2f\n", names[pass], (unsigned long long)ops * cfg->io_size,
+               (unsigned long long)stored, stored ? (double)(ops * cfg->io_size) / (double)stored : 0.0);
+        drop_data_cache(cfg);
+        file = appendfs_open_file(ctx, path, O_RDONLY, 0);
+        if (!file) {
+            rc = fail(path);
+            break;
+        }
+        start = now_ns();
+        for (size_t i = 0; i < ops; ++i) {
+            uint64_t t0 = now_ns();
+            if (appendfs_read_file(file, buf, cfg->io_size, (off_t)(i * cfg->io_size)) != (ssize_t)cfg->io_size) {
+                rc = fail("appendfs_read_file");
+                break;
+            }
+            record_latency(lat, now_ns() - t0);
+        }
+        elapsed = now_ns() - start;
+        appendfs_close_file(file);
+        if (rc == 0) {
+            snprintf(label, sizeof(label), "%s_read", names[pass]);
+            report(label, lat, (uint64_t)ops * cfg->io_size, elapsed);
+        }
+    }
+    opts.flags = flags;
+    appendfs_set_options(ctx, &opts);
+    free(corpus);
+    free(buf);
+    return rc;
+}
+
+static int count_entry(const char *name, const struct appendfs_inode_info *info, void *user_data) {
+    (void)name;
+    (void)info;
+    (*(size_t *)user_data)++;
+    return 0;
+}
+
+static int readdir_workload(struct appendfs_context *ctx, const struct bench_config *cfg, struct latencies *lat) {
+    if (appendfs_mkdir(ctx, "/wide", 0755) == -1) {
+        return fail("/wide");
+    }
+    for (size_t i = 0; i < cfg->files; ++i) {
+        char path[64];
+        snprintf(path, sizeof(path), "/wide/entry%zu", i);
+        if (appendfs_create_file(ctx, path, 0644) == -1) {
+            return fail(path);
+        }
+    }
+    uint64_t start = now_ns();
+    for (size_t r = 0; r < cfg->rounds; ++r) {
+        size_t seen = 0;
+        uint64_t t0 = now_ns();
+        if (appendfs_iterate_children(ctx, "/wide", count_entry, &seen) == -1) {
+            return fail("/wide");
+        }
+        record_latency(lat, now_ns() - t0);
+        if (seen != cfg->files) {
+            fprintf(stderr, "readdir saw %zu of %zu entries\n", seen, cfg->files);
+            return -1;
+        }
+    }
+    report("readdir", lat, 0, now_ns() - start);
+    return 0;
+}
+
+/* Rename the small-file tree back and forth; each op moves cfg->files entries. */
+static int rename_workload(struct appendfs_context *ctx, const struct bench_config *cfg, struct latencies *lat) {
+    uint64_t start = now_ns();
+    for (size_t r = 0; r < cfg->rounds; ++r) {
+        const char *from = r % 2 ? "/small_moved" : "/small";
+        const char *to = r % 2 ? "/small" : "/small_moved";
+        uint64_t t0 = now_ns();
+        if (appendfs_rename(ctx, from, to) == -1) {
+            return fail(from);
+        }
+        record_latency(lat, now_ns() - t0);
+    }
+    if (cfg->rounds % 2 && appendfs_rename(ctx, "/small_moved", "/small") == -1) {
+        return fail("/small_moved");
+    }
+    report("rename_tree", lat, 0, now_ns() - start);
+    return 0;
+}
+
+static int replay_workload(struct appendfs_context **ctx, const struct bench_config *cfg, struct latencies *lat) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/meta", cfg->dir);
+    struct stat st;
+    uint64_t start = now_ns();
+    for (size_t r = 0; r < cfg->rounds; ++r) {
+        appendfs_close(*ctx);
+        *ctx = NULL;
+        uint64_t t0 = now_ns();
+        if (appendfs_open(cfg->dir, ctx) == -1) {
+            return fail("appendfs_open");
+        }
+        record_latency(lat, now_ns() - t0);
+    }
+    uint64_t elapsed = now_ns() - start;
+    report("replay", lat, stat(path, &st) == 0 ? (uint64_t)st.st_size * cfg->rounds : 0, elapsed);
+    return 0;
+}
+
+static const char *const workloads[] = {"seq_write", "seq_read", "rand_write", "create", "stat", "small_read", "tiny", "compress", "readdir", "rename_tree", "replay"};
+
+static int selected(char **names, int count, const char *name) {
+    if (count == 0) {
+        return 1;
+    }
+    for (int i = 0; i < count; ++i) {
+        if (strcmp(names[i], name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-m file-mb] [-b io-bytes] [-n files] [-r rounds] DIR [workload...]\n", prog);
+    fprintf(stderr, "workloads:");
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); ++i) {
+        fprintf(stderr, " %s", workloads[i]);
+    }
+    fprintf(stderr, " (default: all; seq_read needs seq_write; stat, small_read and rename_tree need create)\n");
+}
+
+/*
+ * Drive the library directly, without FUSE, over a fresh store in DIR.  Each
+ * workload prints one key=value line so runs can be diffed or parsed.
+ */
+int main(int argc, char **argv) {
+    struct bench_config cfg = {NULL, DEFAULT_FILE_MB, DEFAULT_IO_SIZE, DEFAULT_FILES, DEFAULT_ROUNDS};
+    int opt;
+    while ((opt = getopt(argc, argv, "m:b:n:r:h")) != -1) {
+        switch (opt) {
+        case 'm':
+            cfg.file_mb = strtoul(optarg, NULL, 10);
+            break;
+        case 'b':
+            cfg.io_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            cfg.files = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            cfg.rounds = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind >= argc || cfg.file_mb == 0 || cfg.io_size == 0 || cfg.files == 0 || cfg.rounds == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    cfg.dir = argv[optind++];
+    char **names = argv + optind;
+    int name_count = argc - optind;
+    for (int i = 0; i < name_count; ++i) {
+        int known = 0;
+        for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); ++w) {
+            known |= strcmp(names[i], workloads[w]) == 0;
+        }
+        if (!known) {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    struct appendfs_context *ctx = NULL;
+    if (appendfs_open(cfg.dir, &ctx) == -1) {
+        fail(cfg.dir);
+        return 1;
+    }
+    struct latencies lat = {NULL, 0, 0};
+    int created = 0;
+    int rc = 0;
+    printf("config dir=%s file_mb=%zu io_size=%zu files=%zu rounds=%zu\n", cfg.dir, cfg.file_mb, cfg.io_size, cfg.files, cfg.rounds);
+    int written = 0;
+    if (rc == 0 && (selected(names, name_count, "seq_write") || selected(names, name_count, "seq_read"))) {
+        rc = write_workload(ctx, &cfg, &lat, 0);
+        written = rc == 0;
+    }
+    if (rc == 0 && written && selected(names, name_count, "seq_read")) {
+        rc = seq_read_workload(ctx, &cfg, &lat);
+    }
+    if (rc == 0 && selected(names, name_count, "rand_write")) {
+        rc = write_workload(ctx, &cfg, &lat, 1);
+    }
+    if (rc == 0 && (selected(names, name_count, "create") || selected(names, name_count, "stat") || selected(names, name_count, "small_read") ||
+                    selected(names, name_count, "rename_tree"))) {
+        rc = create_workload(ctx, &cfg, &lat);
+        created = rc == 0;
+    }
+    if (rc == 0 && created && selected(names, name_count, "stat")) {
+        rc = stat_workload(ctx, &cfg, &lat);
+    }
+    if (rc == 0 && created && selected(names, name_count, "small_read")) {
+        rc = small_read_workload(ctx, &cfg, &lat);
+    }
+    if (rc == 0 && selected(names, name_count, "tiny")) {
+        rc = tiny_workload(ctx, &cfg, &lat);
+    }
+    if (rc == 0 && selected(names, name_count, "compress")) {
+        rc = compress_workload(ctx, &cfg, &lat);
+    }
+    if (rc == 0 && selected(names, name_count, "readdir")) {
+        rc = readdir_workload(ctx, &cfg, &lat);
+    }
+    if (rc == 0 && created && selected(names, name_count, "rename_tree")) {
+        rc = rename_workload(ctx, &cfg, &lat);
+    }
+    if (rc == 0 && selected(names, name_count, "replay")) {
+        rc = replay_workload(&ctx, &cfg, &lat);
+    }
+    if (ctx) {
+        appendfs_close(ctx);
+    }
+    free(lat.ns);
+    return rc == 0 ? 0 : 1;
+}
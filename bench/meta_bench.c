@@ -0,0 +1,111 @@
+#define _GNU_SOURCE
+#include "appendfs.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define DEFAULT_FILES 256
+#define DEFAULT_EXTENTS 256
+#define DEFAULT_CHUNK 4096
+#define DIRS 16
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static off_t file_size(const char *dir, const char *name) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_size : -1;
+}
+
+/*
+ * Write files x extents chunks of chunk bytes, one extent each, then report
+ * the metadata log size per GiB of data and how long a remount takes to
+ * replay it.  DIR must be empty or absent.
+ */
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s DIR [files] [extents-per-file] [chunk-bytes]\n", argv[0]);
+        return 2;
+    }
+    const char *dir = argv[1];
+    size_t files = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_FILES;
+    size_t extents = argc > 3 ? strtoul(argv[3], NULL, 10) : DEFAULT_EXTENTS;
+    size_t chunk = argc > 4 ? strtoul(argv[4], NULL, 10) : DEFAULT_CHUNK;
+    if (files == 0 || extents == 0 || chunk == 0) {
+        fprintf(stderr, "files, extents and chunk must be positive\n");
+        return 2;
+    }
+    unsigned char *buf = malloc(chunk);
+    if (!buf) {
+        perror("malloc");
+        return 1;
+    }
+    for (size_t i = 0; i < chunk; ++i) {
+        buf[i] = (unsigned char)(i * 2654435761u >> 13);
+    }
+
+    struct appendfs_context *ctx = NULL;
+    if (appendfs_open(dir, &ctx) == -1) {
+        perror("appendfs_open");
+        free(buf);
+        return 1;
+    }
+    off_t meta_start = file_size(dir, "meta");
+    double start = now_seconds();
+    for (size_t d = 0; d < DIRS; ++d) {
+        char path[64];
+        snprintf(path, sizeof(path), "/d%zu", d);
+        appendfs_mkdir(ctx, path, 0755);
+    }
+    for (size_t f = 0; f < files; ++f) {
+        char path[64];
+        snprintf(path, sizeof(path), "/d%zu/f%zu", f % DIRS, f);
+        struct appendfs_file *file = appendfs_open_file(ctx, path, O_CREAT | O_RDWR, 0644);
+        if (!file) {
+            perror("appendfs_open_file");
+            appendfs_close(ctx);
+            free(buf);
+            return 1;
+        }
+        for (size_t e = 0; e < extents; ++e) {
+            if (appendfs_write(file, buf, chunk, (off_t)(e * chunk)) != (ssize_t)chunk || appendfs_flush(file) == -1) {
+                perror("appendfs_write");
+                appendfs_close_file(file);
+                appendfs_close(ctx);
+                free(buf);
+                return 1;
+            }
+        }
+        appendfs_close_file(file);
+    }
+    double write_s = now_seconds() - start;
+    appendfs_close(ctx);
+    free(buf);
+
+    double data_gib = (double)files * (double)extents * (double)chunk / (1024.0 * 1024.0 * 1024.0);
+    off_t meta_bytes = file_size(dir, "meta") - meta_start;
+    start = now_seconds();
+    if (appendfs_open(dir, &ctx) == -1) {
+        perror("appendfs_open (replay)");
+        return 1;
+    }
+    double replay_s = now_seconds() - start;
+    appendfs_close(ctx);
+
+    printf("files=%zu extents_per_file=%zu chunk=%zu data_gib=%.3f\n", files, extents, chunk, data_gib);
+    printf("meta_bytes=%lld meta_bytes_per_gib=%.0f meta_bytes_per_extent=%.1f\n", (long long)meta_bytes,
+           (double)meta_bytes / data_gib, (double)meta_bytes / ((double)files * (double)extents));
+    printf("write_s=%.3f replay_s=%.4f replay_mb_s=%.1f\n", write_s, replay_s,
+           replay_s > 0 ? (double)meta_bytes / replay_s / 1e6 : 0.0);
+    return 0;
+}
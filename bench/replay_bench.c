@@ -0,0 +1,323 @@
+/*
+ * Replay benchmark.  The library source is compiled into this program so the
+ * generator can drive the real record encoders directly, without buffering or
+ * writing any file data: a synthetic $dir/meta of any shape takes seconds to
+ * build, and replay_metadata() can be timed on its own.
+ */
+#include "../src/appendfs.c"
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define DEFAULT_FILES 100000
+#define DEFAULT_EXTENTS 16
+#define DEFAULT_EXTENT_SIZE 4096
+#define DEFAULT_DIRS 64
+#define DEFAULT_XATTRS 1
+#define DEFAULT_XATTR_SIZE 32
+#define DEFAULT_RENAME_PCT 10
+#define DEFAULT_UNLINK_PCT 10
+#define DEFAULT_ROUNDS 5
+#define SCRATCH_DIRNAME "replay-scratch"
+
+struct gen_config {
+    size_t files;
+    size_t extents;
+    size_t extent_size;
+    size_t dirs;
+    size_t xattrs;
+    size_t xattr_size;
+    unsigned int rename_pct;
+    unsigned int unlink_pct;
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static struct appendfs_inode *generate_inode(struct appendfs_context *ctx, struct appendfs_inode *parent, const char *name, mode_t mode) {
+    struct appendfs_inode *inode = create_inode(ctx, parent, name, strlen(name), mode);
+    if (!inode) {
+        return NULL;
+    }
+    if (append_create_record(ctx, inode) == -1) {
+        discard_inode(ctx, inode);
+        return NULL;
+    }
+    publish_inode(ctx, inode);
+    return inode;
+}
+
+/*
+ * Build the log in the order a real store would: directories, then each file
+ * with its extents and xattrs, then a pass of renames and unlinks.  Extents
+ * point at a data file that is never written; replay does not read it.
+ */
+static int generate_locked(struct appendfs_context *ctx, const struct gen_config *cfg) {
+    struct appendfs_inode **dirs = malloc(cfg->dirs * sizeof(*dirs));
+    struct appendfs_inode **files = malloc(cfg->files * sizeof(*files));
+    unsigned char *value = malloc(cfg->xattr_size ? cfg->xattr_size : 1);
+    int rc = -1;
+    if (!dirs || !files || !value) {
+        goto out;
+    }
+    memset(value, 'v', cfg->xattr_size ? cfg->xattr_size : 1);
+    char name[64];
+    for (size_t d = 0; d < cfg->dirs; ++d) {
+        snprintf(name, sizeof(name), "d%zu", d);
+        if (!(dirs[d] = generate_inode(ctx, &ctx->root, name, S_IFDIR | 0755))) {
+            goto out;
+        }
+    }
+    off_t data_cursor = 0;
+    for (size_t f = 0; f < cfg->files; ++f) {
+        snprintf(name, sizeof(name), "f%zu", f);
+        struct appendfs_inode *inode = generate_inode(ctx, dirs[f % cfg->dirs], name, S_IFREG | 0644);
+        if (!inode) {
+            goto out;
+        }
+        files[f] = inode;
+        for (size_t e = 0; e < cfg->extents; ++e) {
+            off_t logical = (off_t)(e * cfg->extent_size);
+            inode->size = logical + (off_t)cfg->extent_size;
+            if (append_extent_record(ctx, inode, logical, data_cursor, (uint32_t)cfg->extent_size, (uint32_t)cfg->extent_size, (uint32_t)(f * 2654435761u + e)) == -1) {
+                goto out;
+            }
+            data_cursor += (off_t)cfg->extent_size;
+        }
+        for (size_t x = 0; x < cfg->xattrs; ++x) {
+            snprintf(name, sizeof(name), "user.bench%zu", x);
+            if (append_setxattr_record(ctx, inode, name, value, cfg->xattr_size) == -1) {
+                goto out;
+            }
+        }
+    }
+    uint32_t state = 2463534242u;
+    for (size_t f = 0; f < cfg->files; ++f) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        unsigned int roll = state % 100;
+        if (roll < cfg->unlink_pct) {
+            if (append_unlink_record(ctx, files[f]) == -1) {
+                goto out;
+            }
+        } else if (roll < cfg->unlink_pct + cfg->rename_pct) {
+            snprintf(name, sizeof(name), "m%zu", f);
+            if (append_rename_record(ctx, files[f], dirs[(f + 1) % cfg->dirs], name, strlen(name)) == -1) {
+                goto out;
+            }
+        }
+    }
+    rc = 0;
+out:
+    free(dirs);
+    free(files);
+    free(value);
+    return rc;
+}
+
+/* Runs in a child process so generator memory does not count as replay peak. */
+static int generate(const char *dir, const struct gen_config *cfg) {
+    struct appendfs_context *ctx = NULL;
+    if (appendfs_open(dir, &ctx) == -1) {
+        return -1;
+    }
+    lock_context(ctx);
+    int rc = generate_locked(ctx, cfg);
+    unlock_context(ctx);
+    appendfs_close(ctx);
+    return rc;
+}
+
+/* Count the versioned records at the top level of the log. */
+static uint64_t count_records(const char *path, off_t *bytes) {
+    FILE *f = fopen(path, "rb");
+    uint64_t count = 0;
+    *bytes = 0;
+    if (!f) {
+        return 0;
+    }
+    unsigned char header[RECORD_HEADER_SIZE];
+    while (fread(header, 1, sizeof(header), f) == sizeof(header) && (header[0] & RECORD_FLAG_VERSIONED)) {
+        uint32_t length = (uint32_t)header[4] | (uint32_t)header[5] << 8 | (uint32_t)header[6] << 16 | (uint32_t)header[7] << 24;
+        if (fseeko(f, (off_t)length, SEEK_CUR) != 0) {
+            break;
+        }
+        count++;
+    }
+    fseeko(f, 0, SEEK_END);
+    *bytes = ftello(f);
+    fclose(f);
+    return count;
+}
+
+/*
+ * Replay dir's log into a fresh context.  The context is opened on an empty
+ * scratch store and then pointed at the log, so the timing covers
+ * replay_metadata() alone.
+ */
+static int time_replay(const char *dir, double *seconds, size_t *inodes) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, SCRATCH_DIRNAME);
+    struct appendfs_context *ctx = NULL;
+    if (appendfs_open(path, &ctx) == -1) {
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/%s", dir, META_FILENAME);
+    int fd = open(path, O_RDWR | O_BINARY);
+    if (fd == -1) {
+        appendfs_close(ctx);
+        return -1;
+    }
+    close(ctx->meta_fd);
+    ctx->meta_fd = fd;
+    lock_context(ctx);
+    double start = now_seconds();
+    int rc = replay_metadata(ctx);
+    *seconds = now_seconds() - start;
+    *inodes = ctx->inode_count;
+    unlock_context(ctx);
+    appendfs_close(ctx);
+    return rc;
+}
+
+static long peak_rss_kb(void) {
+    struct rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-n files] [-e extents-per-file] [-s extent-bytes] [-d dirs] [-x xattrs-per-file]\n"
+            "       [-v xattr-bytes] [-R rename-pct] [-U unlink-pct] [-r rounds] [-k] DIR\n"
+            "-k replays the log already in DIR instead of generating one\n",
+            prog);
+}
+
+/*
+ * Generate a synthetic log in DIR (which must not hold one yet), then replay
+ * it several times and print key=value lines: per-round timings and a summary
+ * with the median round's records/s and MB/s and the replay peak RSS.
+ */
+int main(int argc, char **argv) {
+    struct gen_config cfg = {DEFAULT_FILES, DEFAULT_EXTENTS, DEFAULT_EXTENT_SIZE, DEFAULT_DIRS, DEFAULT_XATTRS, DEFAULT_XATTR_SIZE, DEFAULT_RENAME_PCT, DEFAULT_UNLINK_PCT};
+    size_t rounds = DEFAULT_ROUNDS;
+    int keep = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:e:s:d:x:v:R:U:r:kh")) != -1) {
+        switch (opt) {
+        case 'n':
+            cfg.files = strtoul(optarg, NULL, 10);
+            break;
+        case 'e':
+            cfg.extents = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            cfg.extent_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            cfg.dirs = strtoul(optarg, NULL, 10);
+            break;
+        case 'x':
+            cfg.xattrs = strtoul(optarg, NULL, 10);
+            break;
+        case 'v':
+            cfg.xattr_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'R':
+            cfg.rename_pct = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        case 'U':
+            cfg.unlink_pct = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            rounds = strtoul(optarg, NULL, 10);
+            break;
+        case 'k':
+            keep = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind + 1 != argc || cfg.dirs == 0 || cfg.extent_size == 0 || cfg.extent_size > UINT32_MAX || rounds == 0 ||
+        cfg.rename_pct + cfg.unlink_pct > 100) {
+        usage(argv[0]);
+        return 2;
+    }
+    const char *dir = argv[optind];
+    char meta_path[PATH_MAX];
+    snprintf(meta_path, sizeof(meta_path), "%s/%s", dir, META_FILENAME);
+    off_t meta_bytes = 0;
+
+    if (!keep) {
+        struct stat st;
+        if (stat(meta_path, &st) == 0 && st.st_size > 0) {
+            fprintf(stderr, "%s already holds a log; use -k to replay it\n", dir);
+            return 2;
+        }
+        double start = now_seconds();
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("fork");
+            return 1;
+        }
+        if (pid == 0) {
+            if (generate(dir, &cfg) == -1) {
+                perror("generate");
+                _exit(1);
+            }
+            _exit(0);
+        }
+        int status = 0;
+        if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            return 1;
+        }
+        uint64_t records = count_records(meta_path, &meta_bytes);
+        printf("generate files=%zu extents_per_file=%zu extent_size=%zu dirs=%zu xattrs_per_file=%zu xattr_size=%zu rename_pct=%u unlink_pct=%u "
+               "records=%llu meta_bytes=%lld seconds=%.3f\n",
+               cfg.files, cfg.extents, cfg.extent_size, cfg.dirs, cfg.xattrs, cfg.xattr_size, cfg.rename_pct, cfg.unlink_pct,
+               (unsigned long long)records, (long long)meta_bytes, now_seconds() - start);
+    }
+    uint64_t records = count_records(meta_path, &meta_bytes);
+    if (meta_bytes == 0) {
+        fprintf(stderr, "%s: no log to replay\n", meta_path);
+        return 1;
+    }
+
+    double *times = malloc(rounds * sizeof(*times));
+    if (!times) {
+        perror("malloc");
+        return 1;
+    }
+    long base_rss = peak_rss_kb();
+    size_t inodes = 0;
+    for (size_t i = 0; i < rounds; ++i) {
+        if (time_replay(dir, &times[i], &inodes) == -1) {
+            perror("replay");
+            free(times);
+            return 1;
+        }
+        printf("replay round=%zu seconds=%.4f records_s=%.0f mb_s=%.1f inodes=%zu\n", i, times[i], (double)records / times[i],
+               (double)meta_bytes / times[i] / 1e6, inodes);
+    }
+    long peak_rss = peak_rss_kb();
+    qsort(times, rounds, sizeof(*times), compare_double);
+    double median = times[rounds / 2];
+    printf("replay_summary records=%llu meta_bytes=%lld inodes=%zu rounds=%zu min_s=%.4f median_s=%.4f records_s=%.0f mb_s=%.1f "
+           "peak_rss_kb=%ld replay_rss_kb=%ld\n",
+           (unsigned long long)records, (long long)meta_bytes, inodes, rounds, times[0], median, (double)records / median,
+           (double)meta_bytes / median / 1e6, peak_rss, peak_rss - base_rss);
+    free(times);
+    return 0;
+}
@@ -15,6 +15,22 @@ extern "C" {
 #define APPENDFS_MAX_NAME 255
 #define APPENDFS_DEFAULT_BUFFER (4 * 1024 * 1024)
 #define APPENDFS_MIN_FLUSH (4 * 1024)
+#define APPENDFS_DEFAULT_POOL_LIMIT (256 * 1024 * 1024)
+#define APPENDFS_DEFAULT_READ_CACHE (64 * 1024 * 1024)
+#define APPENDFS_MIN_BUFFER (64 * 1024)
+#define APPENDFS_MAX_BUFFER (64 * 1024 * 1024)
+#define APPENDFS_DEFAULT_BUFFER_IDLE_MS 5000
+#define APPENDFS_DEFAULT_FLUSH_INTERVAL_MS 1000
+#define APPENDFS_DEFAULT_DIRTY_AGE_MS 5000
+
+#define APPENDFS_OPT_NO_FLUSHER 0x1
+#define APPENDFS_OPT_VERIFY_READS 0x2
+#define APPENDFS_OPT_STRICTATIME 0x4
+#define APPENDFS_OPT_NOATIME 0x8
+#define APPENDFS_OPT_NO_READ_CACHE 0x10
+#define APPENDFS_OPT_READAHEAD 0x20
+#define APPENDFS_OPT_NO_INLINE 0x40
+#define APPENDFS_OPT_COMPRESS 0x80
 
 struct appendfs_context;
 struct appendfs_file;
@@ -24,19 +40,214 @@ struct appendfs_inode_info {
     uint64_t inode_id;
     mode_t mode;
     off_t size;
-    time_t ctime;
-    time_t mtime;
-    time_t atime;
+    blkcnt_t blocks;
+    struct timespec ctim;
+    struct timespec mtim;
+    struct timespec atim;
 };
 
+/*
+ * Numeric fields left at zero keep their current value; flags replaces the
+ * current APPENDFS_OPT_* set, so start from appendfs_get_options() to change
+ * a single flag.  Handles start with a buffer of min_write_buffer_size and
+ * double it while they write sequentially, up to write_buffer_size, or
+ * max_write_buffer_size for long streaming writers.  Buffers untouched for
+ * buffer_idle_ms are flushed and returned to the pool.
+ *
+ * A background flusher wakes every flush_interval_ms and writes buffers that
+ * have been dirty for dirty_age_ms, or the oldest ones whenever dirty bytes
+ * exceed dirty_high_watermark (half the pool limit by default).
+ *
+ * With APPENDFS_OPT_VERIFY_READS, the first read touching an extent checks
+ * the CRC32C of the whole extent and fails with EIO on a mismatch.
+ *
+ * Reads update atime with relatime rules unless APPENDFS_OPT_STRICTATIME
+ * (every read) or APPENDFS_OPT_NOATIME (never) is set.
+ *
+ * Reads of up to 32 KiB of committed data go through a block cache of
+ * read_cache_size bytes unless APPENDFS_OPT_NO_READ_CACHE is set.  Changing
+ * the size empties the cache.  With APPENDFS_OPT_READAHEAD, sequential reads
+ * through appendfs_read_file() advise the kernel to read ahead in $dir/data.
+ * It is off by default until it shows a gain on real devices.
+ *
+ * Files of up to 512 bytes keep their contents in the metadata log and in
+ * memory unless APPENDFS_OPT_NO_INLINE is set.
+ *
+ * With APPENDFS_OPT_COMPRESS, flushed data is stored LZ4-compressed in
+ * 64 KiB chunks, except chunks that do not compress.  Existing extents are
+ * read either way.
+ */
 struct appendfs_options {
     size_t write_buffer_size;
+    size_t buffer_pool_limit;
+    size_t min_write_buffer_size;
+    size_t max_write_buffer_size;
+    unsigned int buffer_idle_ms;
+    unsigned int flush_interval_ms;
+    unsigned int dirty_age_ms;
+    size_t dirty_high_watermark;
+    size_t read_cache_size;
+    unsigned int flags;
+};
+
+struct appendfs_buffer_stats {
+    size_t pool_limit;
+    size_t bytes_in_use;
+    size_t bytes_cached;
+    size_t bytes_dirty;
+    size_t buffers_in_use;
+    uint64_t grows;
+    uint64_t shrinks;
+    uint64_t spills;
+    uint64_t writeback_batches;
+    uint64_t writeback_files;
+    uint64_t stage_commits;
+};
+
+/*
+ * Metadata memory held by a mounted store.  inode_hot_size is the part of
+ * each inode read by getattr, readdir and lookups; inode_cold_size holds the
+ * extent, symlink and xattr bookkeeping.  The *_bytes fields are totals.
+ */
+struct appendfs_memory_stats {
+    size_t inodes;
+    size_t inode_hot_size;
+    size_t inode_cold_size;
+    size_t inode_table_bytes;
+    size_t extent_bytes;
+    size_t xattr_bytes;
+    size_t string_bytes;
+    size_t name_bytes;
+    size_t index_bytes;
+    size_t inline_bytes;
+};
+
+/*
+ * Operations with latency statistics: every entry point below, plus write
+ * buffer flushes, metadata record writes and data-file reads inside the
+ * library.  Entry point latencies include waiting for the context lock.
+ */
+enum appendfs_op {
+    APPENDFS_OP_MKDIRS,
+    APPENDFS_OP_MKDIR,
+    APPENDFS_OP_CREATE_FILE,
+    APPENDFS_OP_UNLINK,
+    APPENDFS_OP_RMDIR,
+    APPENDFS_OP_RENAME,
+    APPENDFS_OP_SYMLINK,
+    APPENDFS_OP_READLINK,
+    APPENDFS_OP_OPEN_FILE,
+    APPENDFS_OP_WRITE,
+    APPENDFS_OP_READ,
+    APPENDFS_OP_TRUNCATE,
+    APPENDFS_OP_FLUSH,
+    APPENDFS_OP_CLOSE_FILE,
+    APPENDFS_OP_FSYNC,
+    APPENDFS_OP_FSYNCDIR,
+    APPENDFS_OP_SEEK,
+    APPENDFS_OP_SET_TIMES,
+    APPENDFS_OP_STATFS,
+    APPENDFS_OP_IS_DIRECTORY_EMPTY,
+    APPENDFS_OP_SETXATTR,
+    APPENDFS_OP_GETXATTR,
+    APPENDFS_OP_LISTXATTR,
+    APPENDFS_OP_REMOVEXATTR,
+    APPENDFS_OP_ITERATE_CHILDREN,
+    APPENDFS_OP_STAT,
+    APPENDFS_OP_BATCH,
+    APPENDFS_OP_SCRUB,
+    APPENDFS_OP_FLUSH_BUFFER,
+    APPENDFS_OP_WRITE_RECORD,
+    APPENDFS_OP_PREAD,
+    APPENDFS_OP_COUNT
+};
+
+/*
+ * Totals since the store was opened.  Percentiles come from a histogram with
+ * four buckets per power of two, so they are within about 12% of the true
+ * value.  bytes counts data moved by reads and writes and bytes returned by
+ * readlink and the xattr getters.
+ */
+struct appendfs_op_stats {
+    uint64_t count;
+    uint64_t errors;
+    uint64_t bytes;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t p50_ns;
+    uint64_t p90_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
 };
 
+/*
+ * Block cache and readahead counters since the store was opened.
+ * readahead_calls counts posix_fadvise() calls on $dir/data.
+ */
+struct appendfs_cache_stats {
+    size_t budget;
+    size_t bytes_cached;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t readahead_calls;
+    uint64_t readahead_bytes;
+};
+
+/*
+ * Space taken in the store directory, kept up to date as data is written,
+ * truncated and unlinked.  live_bytes is the part of $dir/data still
+ * reachable from a file; dead_bytes is the rest, which compaction could
+ * reclaim.  Ranges hidden by a later overwrite are dead, except that a
+ * compressed extent stays live while any of its bytes is still visible.
+ * data_bytes includes data not yet committed.
+ * The compress_* counters cover flushes since mount: bytes that went into
+ * compressed extents and their stored size, and bytes stored uncompressed
+ * because they did not compress.
+ */
+struct appendfs_space_stats {
+    uint64_t data_bytes;
+    uint64_t meta_bytes;
+    uint64_t live_bytes;
+    uint64_t dead_bytes;
+    uint64_t compress_in_bytes;
+    uint64_t compress_out_bytes;
+    uint64_t compress_skipped_bytes;
+};
+
+struct appendfs_scrub_report {
+    uint64_t extents_checked;
+    uint64_t extents_unchecksummed;
+    uint64_t bytes_checked;
+    uint64_t errors;
+};
+
+typedef void (*appendfs_scrub_error_cb)(const char *path, off_t offset, uint32_t length, void *user_data);
+
 int appendfs_open(const char *root_path, struct appendfs_context **out_ctx);
 void appendfs_close(struct appendfs_context *ctx);
 
 int appendfs_set_options(struct appendfs_context *ctx, const struct appendfs_options *opts);
+int appendfs_get_options(struct appendfs_context *ctx, struct appendfs_options *opts);
+int appendfs_get_buffer_stats(struct appendfs_context *ctx, struct appendfs_buffer_stats *stats);
+int appendfs_get_memory_stats(struct appendfs_context *ctx, struct appendfs_memory_stats *stats);
+int appendfs_get_space_stats(struct appendfs_context *ctx, struct appendfs_space_stats *stats);
+int appendfs_get_cache_stats(struct appendfs_context *ctx, struct appendfs_cache_stats *stats);
+const char *appendfs_op_name(enum appendfs_op op);
+int appendfs_get_op_stats(struct appendfs_context *ctx, struct appendfs_op_stats stats[APPENDFS_OP_COUNT]);
+/*
+ * Format the operation statistics as text, one "op=NAME key=value ..." line
+ * per operation that has run.  Like appendfs_listxattr(), size 0 returns the
+ * length needed and a short buffer fails with ERANGE.
+ */
+ssize_t appendfs_format_op_stats(struct appendfs_context *ctx, char *buf, size_t size);
+/*
+ * Format the trace ring, the last few thousand I/O and metadata events
+ * (record writes, buffer flushes, stage commits, fsyncs, renames and replay
+ * progress), oldest first, one "t_us=... event=NAME key=value ..." line
+ * each.  Sizing works as for appendfs_format_op_stats().
+ */
+ssize_t appendfs_format_trace(struct appendfs_context *ctx, char *buf, size_t size);
 
 int appendfs_mkdirs(struct appendfs_context *ctx, const char *path, mode_t mode);
 int appendfs_mkdir(struct appendfs_context *ctx, const char *path, mode_t mode);
@@ -50,6 +261,7 @@ ssize_t appendfs_readlink(struct appendfs_context *ctx, const char *path, char *
 struct appendfs_file *appendfs_open_file(struct appendfs_context *ctx, const char *path, int flags, mode_t mode);
 ssize_t appendfs_write(struct appendfs_file *file, const void *buf, size_t size, off_t offset);
 ssize_t appendfs_read(struct appendfs_context *ctx, const char *path, void *buf, size_t size, off_t offset);
+ssize_t appendfs_read_file(struct appendfs_file *file, void *buf, size_t size, off_t offset);
 int appendfs_truncate(struct appendfs_context *ctx, const char *path, off_t size);
 int appendfs_flush(struct appendfs_file *file);
 int appendfs_close_file(struct appendfs_file *file);
@@ -70,6 +282,59 @@ int appendfs_iterate_children(struct appendfs_context *ctx, const char *dir_path
 
 int appendfs_stat(struct appendfs_context *ctx, const char *path, struct stat *st);
 
+enum appendfs_batch_op_type {
+    APPENDFS_BATCH_CREATE = 1,
+    APPENDFS_BATCH_MKDIR,
+    APPENDFS_BATCH_SYMLINK,
+    APPENDFS_BATCH_WRITE,
+    APPENDFS_BATCH_TRUNCATE,
+    APPENDFS_BATCH_SET_TIMES,
+    APPENDFS_BATCH_SETXATTR
+};
+
+/*
+ * One operation of a batch.  Fields not used by the type are ignored:
+ * CREATE/MKDIR use mode; SYMLINK uses target; WRITE writes size bytes of data
+ * at offset; TRUNCATE sets the size to offset; SET_TIMES takes times as in
+ * appendfs_set_times(); SETXATTR sets name to size bytes of data.
+ */
+struct appendfs_batch_op {
+    int type;
+    const char *path;
+    mode_t mode;
+    const char *target;
+    const void *data;
+    size_t size;
+    off_t offset;
+    const char *name;
+    int flags;
+    struct timespec times[2];
+};
+
+/*
+ * Apply count operations as one unit.  Every operation is validated against
+ * the tree as earlier operations leave it before any is applied, including
+ * setxattr flags against xattrs set earlier in the batch; if one fails, the
+ * tree is unchanged, *failed_op is its index and errno says why.  The
+ * records of all operations are logged as a single checksummed group, so
+ * after a crash either the whole batch replays or none of it does.
+ *
+ * An I/O or allocation failure while applying operation *failed_op, or while
+ * writing the group (*failed_op is then count), logs nothing.  Entries the
+ * batch would have created from *failed_op on are removed again, but the
+ * operations before it stay applied in memory.  The store then refuses
+ * further changes with EIO until it is reopened, which drops them.
+ */
+int appendfs_batch(struct appendfs_context *ctx, const struct appendfs_batch_op *ops, size_t count, size_t *failed_op);
+
+/*
+ * Verify the data of every checksummed extent using up to threads readers
+ * (0 = one per online CPU).  Mismatches are counted in report->errors and
+ * passed to cb, which must not call back into the library; path is NULL if
+ * the inode has since been removed.
+ */
+int appendfs_scrub(struct appendfs_context *ctx, unsigned int threads, struct appendfs_scrub_report *report, appendfs_scrub_error_cb cb, void *user_data);
+
 #ifdef __cplusplus
 }
 #endif
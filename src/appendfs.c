@@ -1,13 +1,22 @@
 #define _GNU_SOURCE
 #include "appendfs.h"
+#include "arena.h"
+#include "blockcache.h"
+#include "bufpool.h"
 #include "crc32.h"
+#include "lz4.h"
+#include "names.h"
+#include "opstats.h"
+#include "trace.h"
 
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/statvfs.h>
@@ -35,7 +44,52 @@
 #define DATA_FILENAME "data"
 #define META_FILENAME "meta"
 
-#define RECORD_HEADER_SIZE 9
+/*
+ * Records start with a type byte.  Unversioned records (written before the
+ * envelope gained a version) use a 9-byte header: type, length and a CRC32 of
+ * the payload.  Versioned records set RECORD_FLAG_VERSIONED in the type byte
+ * and use the 12-byte header from DESIGN.md: type, version, two reserved
+ * bytes, length and a CRC32C covering the first eight header bytes and the
+ * payload.
+ */
+#define RECORD_LEGACY_HEADER_SIZE 9
+#define RECORD_HEADER_SIZE 12
+#define RECORD_FLAG_VERSIONED 0x80u
+/*
+ * Version 2 records carry timestamps as nanoseconds since the epoch;
+ * unversioned and version 1 records carry whole seconds.  Version 3 payloads
+ * are varint-encoded (see put_varint()) and name entries by parent id.
+ */
+#define RECORD_VERSION 3
+#define VARINT_MAX 10
+#define EXTENT_ENTRY_MAX (VARINT_MAX * 5 + 4)
+#define COMPRESSED_ENTRY_MAX (EXTENT_ENTRY_MAX + VARINT_MAX)
+
+/*
+ * Directories that legacy logs reference only as path prefixes are
+ * synthesized at replay with ids counting down from the top of the range,
+ * which keeps them deterministic across mounts and clear of real ids.
+ */
+#define SYNTHETIC_INODE_BASE (UINT64_C(1) << 63)
+#define INDEX_INITIAL_BUCKETS 1024
+
+#define NSEC_PER_SEC INT64_C(1000000000)
+#define RELATIME_INTERVAL_NS (24 * 3600 * NSEC_PER_SEC)
+
+#define STAGE_SIZE (4 * 1024 * 1024)
+#define STAGE_DIRECT_MIN (STAGE_SIZE / 4)
+#define READAHEAD_MIN (128 * 1024)
+#define READAHEAD_MAX (8 * 1024 * 1024)
+#define READAHEAD_RANGES 8
+/* Longer reads are streaming and bypass the block cache. */
+#define READ_CACHE_MAX_READ APPENDFS_BLOCKCACHE_BLOCK
+#define META_PENDING_MAX (1024 * 1024)
+/* Room an open transaction keeps in meta_pending for its TXN_COMMIT record. */
+#define TXN_RECORD_MAX (RECORD_HEADER_SIZE + VARINT_MAX)
+/* Files no longer than this keep their bytes in the meta log (INLINE_DATA). */
+#define INLINE_DATA_MAX 512
+/* Compressed extents cover at most this many logical bytes each. */
+#define COMPRESS_CHUNK (64 * 1024)
 
 enum appendfs_record_type {
     APPENDFS_RECORD_CREATE = 1,
@@ -46,50 +100,230 @@ enum appendfs_record_type {
     APPENDFS_RECORD_MKDIR = 6,
     APPENDFS_RECORD_SETXATTR = 7,
     APPENDFS_RECORD_REMOVEXATTR = 8,
-    APPENDFS_RECORD_TIMES = 9
+    APPENDFS_RECORD_TIMES = 9,
+    APPENDFS_RECORD_GROUP = 10,
+    APPENDFS_RECORD_TXN_BEGIN = 11,
+    APPENDFS_RECORD_TXN_COMMIT = 12,
+    APPENDFS_RECORD_TXN_ABORT = 13,
+    APPENDFS_RECORD_EXTENT_BATCH = 14,
+    APPENDFS_RECORD_INLINE_DATA = 15,
+    APPENDFS_RECORD_COMPRESSED_EXTENTS = 16
 };
 
+#define EXTENT_CHECKSUMMED 0x1u
+#define EXTENT_VERIFIED 0x2u
+#define EXTENT_COMPRESSED 0x4u
+
+#define VERIFY_CHUNK (1024 * 1024)
+#define SCRUB_MAX_THREADS 64
+
+/*
+ * checksum is the CRC32C of the stored_length bytes written at data_offset.
+ * Truncation only shortens length, so the stored range stays verifiable.
+ * A compressed extent stores an LZ4 block that decodes to at least length
+ * bytes; stored_length is then the compressed size.  visible counts the
+ * bytes of the extent that no newer extent covers (see shade_extents()).
+ */
 struct appendfs_extent {
     off_t logical_offset;
     uint32_t length;
+    uint32_t stored_length;
     off_t data_offset;
+    uint32_t checksum;
+    uint32_t flags;
+    uint32_t visible;
 };
 
+
 struct appendfs_xattr {
     char *name;
     unsigned char *value;
     size_t size;
 };
 
-struct appendfs_inode {
-    uint64_t inode_id;
-    char *path;
-    mode_t mode;
-    off_t size;
-    time_t ctime;
-    time_t mtime;
-    time_t atime;
-    int deleted;
+/*
+ * Per-inode state that getattr, readdir and path lookup never touch.  It is
+ * kept in a parallel slab so walking the inode table stays in hot data.
+ * inline_data holds the first inline_size bytes of a file that has no
+ * extents (see append_inline_data()).  shade_pending marks extents whose
+ * visible counts are stale (see mark_overlap()).
+ */
+struct appendfs_inode_cold {
     struct appendfs_extent *extents;
     size_t extent_count;
     size_t extent_capacity;
+    int shade_pending;
+    size_t shaded_extents;
+    off_t log_logical_end;
+    off_t log_data_end;
     char *symlink_target;
+    unsigned char *inline_data;
+    size_t inline_size;
     struct appendfs_xattr *xattrs;
     size_t xattr_count;
     size_t xattr_capacity;
 };
 
+/*
+ * Inodes are linked into a tree by parent + interned name.  Live entries sit
+ * in the (parent, name) hash index and on their parent's child list; unlinked
+ * inodes have neither a parent nor a name.  Fields are ordered so that stat
+ * data and the lookup chain share the first cache line.  allocated is the
+ * inode's share of $dir/data (see charge_inode()) and backs st_blocks.
+ * dirty_head lists the handles holding unflushed bytes of the inode, in the
+ * order they last wrote (see dirty_touch()).
+ */
+struct appendfs_inode {
+    uint64_t inode_id;
+    mode_t mode;
+    int deleted;
+    off_t size;
+    int64_t ctime_ns;
+    int64_t mtime_ns;
+    int64_t atime_ns;
+    const struct appendfs_name *name;
+    struct appendfs_inode *dir_next;
+    struct appendfs_inode *parent;
+    struct appendfs_inode *first_child;
+    struct appendfs_inode *next_sibling;
+    struct appendfs_inode *prev_sibling;
+    struct appendfs_inode *id_next;
+    struct appendfs_inode_cold *cold;
+    uint64_t allocated;
+    struct appendfs_file *dirty_head;
+    struct appendfs_file *dirty_tail;
+};
+
+/* An extent record held back while extent_batching is set. */
+struct pending_extent {
+    struct appendfs_inode *inode;
+    off_t logical;
+    off_t data_offset;
+    off_t size;
+    off_t prev_logical_end;
+    off_t prev_data_end;
+    uint32_t length;
+    uint32_t stored_length;
+    uint32_t checksum;
+};
+
 struct appendfs_context {
     char *root_path;
     int data_fd;
     int meta_fd;
     uint64_t next_inode_id;
-    struct appendfs_inode *inodes;
+    struct appendfs_inode **inodes;
     size_t inode_count;
     size_t inode_capacity;
+    struct appendfs_inode *inode_slabs[64];
+    size_t inode_slab_count;
+    struct appendfs_arena strings;
+    struct appendfs_inode root;
+    struct appendfs_inode_cold root_cold;
+    struct appendfs_names names;
+    struct appendfs_inode **dir_buckets;
+    size_t dir_bucket_count;
+    size_t dir_entries;
+    struct appendfs_inode **id_buckets;
+    size_t id_bucket_count;
+    size_t id_entries;
+    uint64_t next_synthetic_id;
     size_t write_buffer_size;
+    size_t min_write_buffer_size;
+    size_t max_write_buffer_size;
+    unsigned int buffer_idle_ms;
+    struct appendfs_bufpool buffer_pool;
+    struct appendfs_blockcache read_cache;
+    struct appendfs_file *lru_head;
+    struct appendfs_file *lru_tail;
+    size_t buffer_count;
+    size_t dirty_bytes;
+    uint64_t buffer_grows;
+    uint64_t buffer_shrinks;
+    uint64_t buffer_spills;
+    unsigned int flags;
+    unsigned int flush_interval_ms;
+    unsigned int dirty_age_ms;
+    size_t dirty_high_watermark;
+    pthread_mutex_t lock;
+    pthread_cond_t flusher_cond;
+    pthread_t flusher;
+    int flusher_started;
+    int flusher_stop;
+    uint64_t writeback_batches;
+    uint64_t writeback_files;
+    unsigned char *stage;
+    size_t stage_used;
+    off_t stage_offset;
+    uint64_t stage_since_ms;
+    unsigned char *meta_pending;
+    size_t meta_pending_used;
+    size_t meta_pending_capacity;
+    uint64_t stage_commits;
+    int group_capture;
+    int log_failed;
+    unsigned char *group;
+    size_t group_used;
+    size_t group_capacity;
+    int txn_open;
+    int txn_flushed;
+    uint64_t txn_id;
+    size_t txn_mark;
+    int extent_batching;
+    struct pending_extent *pending_extents;
+    size_t pending_extent_count;
+    size_t pending_extent_capacity;
+    int shade_pending;
+    off_t *shade_points;
+    size_t *shade_next;
+    size_t shade_capacity;
+    struct appendfs_opstats opstats;
+    struct appendfs_trace trace;
+    uint64_t live_bytes;
+    off_t meta_size;
+    uint64_t readahead_calls;
+    uint64_t readahead_bytes;
+    unsigned char *compress_buf;
+    unsigned char *inflate_buf;
+    off_t inflate_offset;
+    uint64_t compress_in_bytes;
+    uint64_t compress_out_bytes;
+    uint64_t compress_skipped_bytes;
 };
 
+/*
+ * appendfs_batch() sets group_capture while it applies its operations, so
+ * their records collect in ctx->group and are then written as the payload of
+ * one GROUP record.  The group's checksum covers all of them: a torn group
+ * fails verification and replays as nothing.  If an operation fails while
+ * applying, or the GROUP record cannot be written, the applied operations and
+ * the delta cursors their extent records advanced no longer match the log,
+ * so nothing is logged, log_failed is set and every later record and write
+ * fails with EIO until the store is reopened.
+ */
+
+/*
+ * Small flushes from all handles are packed into ctx->stage, a 4 MiB chunk
+ * that becomes the next region of $dir/data at stage_offset.  Extents point
+ * at their final data offsets straight away and reads of the staged range are
+ * served from memory.  While the stage holds data, metadata records are queued
+ * in ctx->meta_pending so that they reach $dir/meta only after the data they
+ * describe, and in log order; commit_stage() writes both with one call each.
+ * Closing a file only stages its data.  The flusher, which staging data
+ * starts, commits a stage once it is dirty_age_ms old; fsync, a full stage
+ * and unmount commit it sooner.  Without a flusher thread nothing would commit
+ * it later, so the operation that staged data commits it (settle_stage()).
+ */
+
+/*
+ * Write buffers are taken from ctx->buffer_pool on the first write and handed
+ * back on close or when the pool runs out of room.  Handles holding a buffer
+ * sit on the context LRU list, oldest write first, so the pool can spill the
+ * least recently written handle when it reaches its limit.  seq_bytes counts
+ * the current run of back-to-back writes and drives buffer growth.  A handle
+ * with buffered bytes is also on its inode's dirty list.  The ra_ fields
+ * track sequential reads through the handle (see readahead_file()).
+ */
 struct appendfs_file {
     struct appendfs_context *ctx;
     struct appendfs_inode *inode;
@@ -99,8 +333,45 @@ struct appendfs_file {
     off_t buffer_offset;
     int flags;
     off_t position;
+    struct appendfs_file *lru_prev;
+    struct appendfs_file *lru_next;
+    struct appendfs_file *dirty_prev;
+    struct appendfs_file *dirty_next;
+    off_t next_write_offset;
+    uint64_t seq_bytes;
+    uint64_t bytes_written;
+    uint64_t last_write_ms;
+    uint64_t dirty_since_ms;
+    off_t ra_next;
+    off_t ra_end;
+    size_t ra_window;
 };
 
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+/*
+ * Every public entry point holds ctx->lock for its whole duration and calls
+ * the matching *_locked function; the background flusher takes it too.
+ */
+static void lock_context(struct appendfs_context *ctx) {
+    pthread_mutex_lock(&ctx->lock);
+}
+
+static void unlock_context(struct appendfs_context *ctx) {
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+static int is_directory_empty_locked(struct appendfs_context *ctx, const char *path);
+static int truncate_locked(struct appendfs_context *ctx, const char *path, off_t size);
+static int flush_buffer(struct appendfs_file *file);
+static size_t dirty_high_watermark(const struct appendfs_context *ctx);
+static void start_flusher(struct appendfs_context *ctx);
+static void stop_flusher(struct appendfs_context *ctx);
+
 static int ensure_directory(const char *path) {
     struct stat st;
     if (stat(path, &st) == 0) {
@@ -161,47 +432,11 @@ static int write_all(int fd, const void *buf, size_t size) {
     return 0;
 }
 
-static char *normalize_path_copy(const char *path) {
-    if (!path) {
-        errno = EINVAL;
-        return NULL;
-    }
-    if (path[0] == '/') {
-        return strdup(path);
-    }
-    size_t len = strlen(path);
-    char *copy = malloc(len + 2);
-    if (!copy) {
-        errno = ENOMEM;
-        return NULL;
-    }
-    copy[0] = '/';
-    memcpy(copy + 1, path, len + 1);
-    return copy;
-}
-
-static const char *normalize_path_view(const char *path, char **allocated) {
-    if (!path) {
-        errno = EINVAL;
-        return NULL;
-    }
-    if (path[0] == '/') {
-        *allocated = NULL;
-        return path;
-    }
-    char *copy = normalize_path_copy(path);
-    if (!copy) {
-        return NULL;
-    }
-    *allocated = copy;
-    return copy;
-}
-
-static int read_all(int fd, void *buf, size_t size) {
+static int pread_all(int fd, void *buf, size_t size, off_t offset) {
     unsigned char *p = (unsigned char *)buf;
     size_t read_bytes = 0;
     while (read_bytes < size) {
-        ssize_t rc = read(fd, p + read_bytes, size - read_bytes);
+        ssize_t rc = pread(fd, p + read_bytes, size - read_bytes, offset + (off_t)read_bytes);
         if (rc < 0) {
             if (errno == EINTR) {
                 continue;
@@ -209,6 +444,7 @@ static int read_all(int fd, void *buf, size_t size) {
             return -1;
         }
         if (rc == 0) {
+            errno = EIO;
             return -1;
         }
         read_bytes += (size_t)rc;
@@ -216,1112 +452,4049 @@ static int read_all(int fd, void *buf, size_t size) {
     return 0;
 }
 
-static void free_inode(struct appendfs_inode *inode) {
+/*
+ * Strings loaded by replay live in ctx->strings; everything created later is
+ * malloc'd.  Release inode strings through here so either kind is handled.
+ */
+static void release_string(struct appendfs_context *ctx, void *ptr) {
+    if (ptr && !appendfs_arena_owns(&ctx->strings, ptr)) {
+        free(ptr);
+    }
+}
+
+/*
+ * Inode timestamps come from the coarse realtime clock, which is read from
+ * the vDSO without a syscall; its tick resolution is plenty for file times.
+ */
+static int64_t clock_now_ns(void) {
+    struct timespec ts;
+#ifdef CLOCK_REALTIME_COARSE
+    if (clock_gettime(CLOCK_REALTIME_COARSE, &ts) == 0) {
+        return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+    }
+#endif
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static int64_t timespec_to_ns(const struct timespec *ts) {
+    return (int64_t)ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+static struct timespec ns_to_timespec(int64_t ns) {
+    struct timespec ts;
+    int64_t sec = ns / NSEC_PER_SEC;
+    int64_t nsec = ns % NSEC_PER_SEC;
+    if (nsec < 0) {
+        sec--;
+        nsec += NSEC_PER_SEC;
+    }
+    ts.tv_sec = (time_t)sec;
+    ts.tv_nsec = (long)nsec;
+    return ts;
+}
+
+/*
+ * Version 3 payloads store integers as LEB128 varints; signed values are
+ * zigzag-encoded first so small negative deltas stay short.
+ */
+static unsigned char *put_varint(unsigned char *p, uint64_t value) {
+    while (value >= 0x80) {
+        *p++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (unsigned char)value;
+    return p;
+}
+
+static unsigned char *put_svarint(unsigned char *p, int64_t value) {
+    uint64_t zigzag = value < 0 ? ~((uint64_t)value << 1) : (uint64_t)value << 1;
+    return put_varint(p, zigzag);
+}
+
+static unsigned char *put_bytes(unsigned char *p, const void *data, size_t length) {
+    p = put_varint(p, length);
+    if (length > 0) {
+        memcpy(p, data, length);
+    }
+    return p + length;
+}
+
+/* Bounds-checked cursor over a record payload; bad latches on overrun. */
+struct record_reader {
+    const unsigned char *p;
+    const unsigned char *end;
+    int bad;
+};
+
+static uint64_t read_varint(struct record_reader *r) {
+    uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64 && r->p < r->end; shift += 7) {
+        unsigned char byte = *r->p++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+    r->bad = 1;
+    return 0;
+}
+
+static int64_t read_svarint(struct record_reader *r) {
+    uint64_t zigzag = read_varint(r);
+    return (zigzag & 1) ? (int64_t)~(zigzag >> 1) : (int64_t)(zigzag >> 1);
+}
+
+static const unsigned char *read_bytes(struct record_reader *r, uint64_t length) {
+    if (r->bad || length > (uint64_t)(r->end - r->p)) {
+        r->bad = 1;
+        return NULL;
+    }
+    const unsigned char *p = r->p;
+    r->p += length;
+    return p;
+}
+
+static int64_t record_time_ns(uint8_t version, int64_t raw) {
+    return version >= 2 ? raw : raw * NSEC_PER_SEC;
+}
+
+/*
+ * Reads update atime in memory only.  By default this follows relatime: the
+ * stamp moves only when it is not newer than mtime/ctime or is a day old, so
+ * repeated reads leave the inode untouched.
+ */
+static void touch_atime(struct appendfs_context *ctx, struct appendfs_inode *inode) {
+    if (ctx->flags & APPENDFS_OPT_NOATIME) {
+        return;
+    }
+    int64_t now = clock_now_ns();
+    if (!(ctx->flags & APPENDFS_OPT_STRICTATIME) &&
+        inode->atime_ns > inode->mtime_ns && inode->atime_ns > inode->ctime_ns &&
+        now - inode->atime_ns < RELATIME_INTERVAL_NS) {
+        return;
+    }
+    inode->atime_ns = now;
+}
+
+static void free_inode(struct appendfs_context *ctx, struct appendfs_inode *inode) {
     if (!inode) {
         return;
     }
-    free(inode->path);
-    free(inode->extents);
-    free(inode->symlink_target);
-    for (size_t i = 0; i < inode->xattr_count; ++i) {
-        free(inode->xattrs[i].name);
-        free(inode->xattrs[i].value);
+    appendfs_names_release(&ctx->names, inode->name);
+    free(inode->cold->extents);
+    free(inode->cold->inline_data);
+    release_string(ctx, inode->cold->symlink_target);
+    for (size_t i = 0; i < inode->cold->xattr_count; ++i) {
+        release_string(ctx, inode->cold->xattrs[i].name);
+        release_string(ctx, inode->cold->xattrs[i].value);
     }
-    free(inode->xattrs);
+    free(inode->cold->xattrs);
 }
 
-static struct appendfs_inode *find_inode_by_path(struct appendfs_context *ctx, const char *path) {
-    char *normalized = NULL;
-    const char *needle = normalize_path_view(path, &normalized);
-    if (!needle) {
-        return NULL;
+static size_t mix_key(uint64_t key, size_t bucket_count) {
+    key *= UINT64_C(0x9e3779b97f4a7c15);
+    return (size_t)(key ^ (key >> 29)) & (bucket_count - 1);
+}
+
+static size_t dir_slot(size_t bucket_count, const struct appendfs_inode *parent, const struct appendfs_name *name) {
+    return mix_key((uint64_t)(uintptr_t)parent ^ name->hash, bucket_count);
+}
+
+/* Indexes grow opportunistically; if the grow fails the chains just get longer. */
+static void grow_dir_index(struct appendfs_context *ctx) {
+    size_t new_count = ctx->dir_bucket_count * 2;
+    struct appendfs_inode **buckets = calloc(new_count, sizeof(*buckets));
+    if (!buckets) {
+        return;
     }
-    for (size_t i = 0; i < ctx->inode_count; ++i) {
-        struct appendfs_inode *inode = &ctx->inodes[i];
-        if (!inode->deleted && inode->path && strcmp(inode->path, needle) == 0) {
-            free(normalized);
-            return inode;
+    for (size_t i = 0; i < ctx->dir_bucket_count; ++i) {
+        struct appendfs_inode *it = ctx->dir_buckets[i];
+        while (it) {
+            struct appendfs_inode *next = it->dir_next;
+            size_t slot = dir_slot(new_count, it->parent, it->name);
+            it->dir_next = buckets[slot];
+            buckets[slot] = it;
+            it = next;
         }
-        if (!inode->deleted && inode->path && inode->path[0] != '/' && needle[0] == '/' && strcmp(inode->path, needle + 1) == 0) {
-            free(normalized);
-            return inode;
-        }
-        if (!inode->deleted && inode->path && inode->path[0] == '/' && needle[0] != '/' && strcmp(inode->path + 1, needle) == 0) {
-            free(normalized);
-            return inode;
+    }
+    free(ctx->dir_buckets);
+    ctx->dir_buckets = buckets;
+    ctx->dir_bucket_count = new_count;
+}
+
+static void grow_id_index(struct appendfs_context *ctx) {
+    size_t new_count = ctx->id_bucket_count * 2;
+    struct appendfs_inode **buckets = calloc(new_count, sizeof(*buckets));
+    if (!buckets) {
+        return;
+    }
+    for (size_t i = 0; i < ctx->id_bucket_count; ++i) {
+        struct appendfs_inode *it = ctx->id_buckets[i];
+        while (it) {
+            struct appendfs_inode *next = it->id_next;
+            size_t slot = mix_key(it->inode_id, new_count);
+            it->id_next = buckets[slot];
+            buckets[slot] = it;
+            it = next;
         }
     }
-    free(normalized);
-    return NULL;
+    free(ctx->id_buckets);
+    ctx->id_buckets = buckets;
+    ctx->id_bucket_count = new_count;
+}
+
+static void index_inode_id(struct appendfs_context *ctx, struct appendfs_inode *inode) {
+    if (ctx->id_entries >= ctx->id_bucket_count) {
+        grow_id_index(ctx);
+    }
+    size_t slot = mix_key(inode->inode_id, ctx->id_bucket_count);
+    inode->id_next = ctx->id_buckets[slot];
+    ctx->id_buckets[slot] = inode;
+    ctx->id_entries++;
+}
+
+static void unindex_inode_id(struct appendfs_context *ctx, struct appendfs_inode *inode) {
+    struct appendfs_inode **link = &ctx->id_buckets[mix_key(inode->inode_id, ctx->id_bucket_count)];
+    while (*link && *link != inode) {
+        link = &(*link)->id_next;
+    }
+    if (*link) {
+        *link = inode->id_next;
+        ctx->id_entries--;
+    }
+    inode->id_next = NULL;
 }
 
 static struct appendfs_inode *find_inode_by_id(struct appendfs_context *ctx, uint64_t inode_id) {
-    for (size_t i = 0; i < ctx->inode_count; ++i) {
-        if (ctx->inodes[i].inode_id == inode_id) {
-            return &ctx->inodes[i];
+    for (struct appendfs_inode *it = ctx->id_buckets[mix_key(inode_id, ctx->id_bucket_count)]; it; it = it->id_next) {
+        if (it->inode_id == inode_id) {
+            return it;
         }
     }
     return NULL;
 }
 
-static int ensure_inode_capacity(struct appendfs_context *ctx) {
-    if (ctx->inode_count >= ctx->inode_capacity) {
-        size_t new_capacity = ctx->inode_capacity ? ctx->inode_capacity * 2 : 16;
-        struct appendfs_inode *new_inodes = realloc(ctx->inodes, new_capacity * sizeof(*new_inodes));
-        if (!new_inodes) {
-            return -1;
+static struct appendfs_inode *lookup_child(struct appendfs_context *ctx, const struct appendfs_inode *parent, const char *name, size_t name_len) {
+    const struct appendfs_name *interned = appendfs_names_find(&ctx->names, name, name_len);
+    if (!interned) {
+        return NULL;
+    }
+    for (struct appendfs_inode *it = ctx->dir_buckets[dir_slot(ctx->dir_bucket_count, parent, interned)]; it; it = it->dir_next) {
+        if (it->parent == parent && it->name == interned) {
+            return it;
         }
-        for (size_t i = ctx->inode_capacity; i < new_capacity; ++i) {
-            memset(&new_inodes[i], 0, sizeof(*new_inodes));
+    }
+    return NULL;
+}
+
+/* Link an inode whose parent and name are set into the index and child list. */
+static void attach_inode(struct appendfs_context *ctx, struct appendfs_inode *inode) {
+    if (ctx->dir_entries >= ctx->dir_bucket_count) {
+        grow_dir_index(ctx);
+    }
+    size_t slot = dir_slot(ctx->dir_bucket_count, inode->parent, inode->name);
+    inode->dir_next = ctx->dir_buckets[slot];
+    ctx->dir_buckets[slot] = inode;
+    ctx->dir_entries++;
+    struct appendfs_inode *parent = inode->parent;
+    inode->prev_sibling = NULL;
+    inode->next_sibling = parent->first_child;
+    if (parent->first_child) {
+        parent->first_child->prev_sibling = inode;
+    }
+    parent->first_child = inode;
+}
+
+static void detach_inode(struct appendfs_context *ctx, struct appendfs_inode *inode) {
+    if (!inode->parent) {
+        return;
+    }
+    struct appendfs_inode **link = &ctx->dir_buckets[dir_slot(ctx->dir_bucket_count, inode->parent, inode->name)];
+    while (*link && *link != inode) {
+        link = &(*link)->dir_next;
+    }
+    if (*link) {
+        *link = inode->dir_next;
+        ctx->dir_entries--;
+    }
+    if (inode->prev_sibling) {
+        inode->prev_sibling->next_sibling = inode->next_sibling;
+    } else {
+        inode->parent->first_child = inode->next_sibling;
+    }
+    if (inode->next_sibling) {
+        inode->next_sibling->prev_sibling = inode->prev_sibling;
+    }
+    inode->dir_next = NULL;
+    inode->next_sibling = NULL;
+    inode->prev_sibling = NULL;
+    inode->parent = NULL;
+    appendfs_names_release(&ctx->names, inode->name);
+    inode->name = NULL;
+}
+
+/* The inode's data turns dead even while open handles can still read it. */
+static void delete_inode(struct appendfs_context *ctx, struct appendfs_inode *inode) {
+    if (!inode->deleted) {
+        ctx->live_bytes -= inode->allocated;
+        inode->deleted = 1;
+    }
+}
+
+/*
+ * Reads see bytes still buffered in any handle of the inode, so a file can
+ * be larger than its extents until those buffers are flushed.
+ */
+static off_t visible_size(const struct appendfs_inode *inode) {
+    off_t size = inode->size;
+    for (const struct appendfs_file *file = inode->dirty_head; file; file = file->dirty_next) {
+        if (file->buffer_offset + (off_t)file->buffer_used > size) {
+            size = file->buffer_offset + (off_t)file->buffer_used;
         }
-        ctx->inodes = new_inodes;
-        ctx->inode_capacity = new_capacity;
     }
-    return 0;
+    return size;
 }
 
-static int add_extent(struct appendfs_inode *inode, off_t logical, off_t data_offset, uint32_t length) {
-    if (inode->extent_count >= inode->extent_capacity) {
-        size_t new_capacity = inode->extent_capacity ? inode->extent_capacity * 2 : 8;
-        struct appendfs_extent *extents = realloc(inode->extents, new_capacity * sizeof(*extents));
-        if (!extents) {
-            return -1;
+/*
+ * Copy buffered bytes of the inode that fall in [offset, limit) over out.
+ * Buffers land on top of every extent when flushed, and the dirty list runs
+ * from the oldest write, so later writers overwrite earlier ones here too.
+ */
+static void overlay_buffers(const struct appendfs_inode *inode, unsigned char *out, off_t offset, off_t limit) {
+    for (const struct appendfs_file *file = inode->dirty_head; file; file = file->dirty_next) {
+        off_t buf_end = file->buffer_offset + (off_t)file->buffer_used;
+        off_t start = offset > file->buffer_offset ? offset : file->buffer_offset;
+        off_t end = buf_end < limit ? buf_end : limit;
+        if (start < end) {
+            memcpy(out + (start - offset), file->buffer + (start - file->buffer_offset), (size_t)(end - start));
         }
-        inode->extents = extents;
-        inode->extent_capacity = new_capacity;
     }
-    inode->extents[inode->extent_count].logical_offset = logical;
-    inode->extents[inode->extent_count].data_offset = data_offset;
-    inode->extents[inode->extent_count].length = length;
-    inode->extent_count += 1;
+}
+
+/* Move an inode to parent/name; the name is interned before anything changes. */
+static int relocate_inode(struct appendfs_context *ctx, struct appendfs_inode *inode, struct appendfs_inode *parent, const char *name, size_t name_len) {
+    const struct appendfs_name *interned = appendfs_names_intern(&ctx->names, name, name_len);
+    if (!interned) {
+        return -1;
+    }
+    detach_inode(ctx, inode);
+    inode->parent = parent;
+    inode->name = interned;
+    attach_inode(ctx, inode);
     return 0;
 }
 
-static struct appendfs_xattr *find_xattr(struct appendfs_inode *inode, const char *name) {
-    for (size_t i = 0; i < inode->xattr_count; ++i) {
-        if (strcmp(inode->xattrs[i].name, name) == 0) {
-            return &inode->xattrs[i];
+static int is_ancestor(const struct appendfs_inode *ancestor, const struct appendfs_inode *inode) {
+    for (const struct appendfs_inode *it = inode; it; it = it->parent) {
+        if (it == ancestor) {
+            return 1;
         }
     }
-    return NULL;
+    return 0;
 }
 
-static int ensure_xattr_capacity(struct appendfs_inode *inode) {
-    if (inode->xattr_count >= inode->xattr_capacity) {
-        size_t new_capacity = inode->xattr_capacity ? inode->xattr_capacity * 2 : 4;
-        struct appendfs_xattr *items = realloc(inode->xattrs, new_capacity * sizeof(*items));
-        if (!items) {
-            return -1;
-        }
-        inode->xattrs = items;
-        inode->xattr_capacity = new_capacity;
+/* Split off the last component of a path, ignoring repeated and trailing slashes. */
+static int split_last(const char *path, size_t len, size_t *parent_len, const char **name, size_t *name_len) {
+    while (len > 0 && path[len - 1] == '/') {
+        len--;
+    }
+    size_t start = len;
+    while (start > 0 && path[start - 1] != '/') {
+        start--;
+    }
+    if (start == len) {
+        errno = EINVAL;
+        return -1;
     }
+    *parent_len = start;
+    *name = path + start;
+    *name_len = len - start;
     return 0;
 }
 
-static int set_xattr_internal(struct appendfs_inode *inode, const char *name, const void *value, size_t size, int flags) {
-    struct appendfs_xattr *existing = find_xattr(inode, name);
-    if (flags & XATTR_CREATE) {
-        if (existing) {
-            errno = EEXIST;
-            return -1;
+static struct appendfs_inode *resolve_path(struct appendfs_context *ctx, const char *path, size_t len) {
+    struct appendfs_inode *node = &ctx->root;
+    size_t i = 0;
+    while (i < len) {
+        while (i < len && path[i] == '/') {
+            i++;
         }
-    }
-    if (flags & XATTR_REPLACE) {
-        if (!existing) {
-            errno = ENODATA;
-            return -1;
+        size_t start = i;
+        while (i < len && path[i] != '/') {
+            i++;
+        }
+        if (i > start) {
+            node = lookup_child(ctx, node, path + start, i - start);
+            if (!node) {
+                return NULL;
+            }
         }
     }
-    if (!existing) {
-        if (ensure_xattr_capacity(inode) == -1) {
+    return node;
+}
+
+static struct appendfs_inode *find_inode_by_path(struct appendfs_context *ctx, const char *path) {
+    if (!path) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return resolve_path(ctx, path, strlen(path));
+}
+
+/* Resolve the directory that would hold path; fails with ENOENT if it is missing. */
+static struct appendfs_inode *find_parent(struct appendfs_context *ctx, const char *path, const char **name, size_t *name_len) {
+    size_t parent_len = 0;
+    if (split_last(path, strlen(path), &parent_len, name, name_len) == -1) {
+        return NULL;
+    }
+    struct appendfs_inode *parent = resolve_path(ctx, path, parent_len);
+    if (!parent || !S_ISDIR(parent->mode)) {
+        errno = ENOENT;
+        return NULL;
+    }
+    return parent;
+}
+
+/* Full path of an attached inode (or of name under parent), malloc'd. */
+static char *build_child_path(const struct appendfs_inode *parent, const char *name, size_t name_len) {
+    size_t len = name_len + 1;
+    for (const struct appendfs_inode *it = parent; it && it->name; it = it->parent) {
+        len += it->name->len + 1;
+    }
+    char *path = malloc(len + 1);
+    if (!path) {
+        return NULL;
+    }
+    size_t pos = len;
+    path[pos] = '\0';
+    pos -= name_len;
+    memcpy(path + pos, name, name_len);
+    path[--pos] = '/';
+    for (const struct appendfs_inode *it = parent; it && it->name; it = it->parent) {
+        pos -= it->name->len;
+        memcpy(path + pos, it->name->str, it->name->len);
+        path[--pos] = '/';
+    }
+    return path;
+}
+
+static char *build_path(const struct appendfs_inode *inode) {
+    if (!inode->name) {
+        errno = ENOENT;
+        return NULL;
+    }
+    return build_child_path(inode->parent, inode->name->str, inode->name->len);
+}
+
+/*
+ * Inodes are carved from slabs that double with the table, so pointers held
+ * by open handles and the indexes stay valid as it grows.  Each slab holds the
+ * hot inode array followed by the matching cold records.
+ */
+static int ensure_inode_capacity(struct appendfs_context *ctx) {
+    if (ctx->inode_count >= ctx->inode_capacity) {
+        size_t new_capacity = ctx->inode_capacity ? ctx->inode_capacity * 2 : 16;
+        if (ctx->inode_slab_count == sizeof(ctx->inode_slabs) / sizeof(ctx->inode_slabs[0])) {
+            errno = ENOMEM;
             return -1;
         }
-        existing = &inode->xattrs[inode->xattr_count++];
-        existing->name = strdup(name);
-        if (!existing->name) {
-            inode->xattr_count--;
+        struct appendfs_inode **new_inodes = realloc(ctx->inodes, new_capacity * sizeof(*new_inodes));
+        if (!new_inodes) {
             return -1;
         }
-        existing->value = NULL;
-        existing->size = 0;
-    } else {
-        unsigned char *new_value = realloc(existing->value, size);
-        if (!new_value && size > 0) {
+        ctx->inodes = new_inodes;
+        size_t count = new_capacity - ctx->inode_capacity;
+        struct appendfs_inode *slab = calloc(count, sizeof(*slab) + sizeof(struct appendfs_inode_cold));
+        if (!slab) {
             return -1;
         }
-        existing->value = new_value;
-        existing->size = size;
-        if (size > 0) {
-            memcpy(existing->value, value, size);
+        struct appendfs_inode_cold *cold = (struct appendfs_inode_cold *)(slab + count);
+        for (size_t i = 0; i < count; ++i) {
+            slab[i].cold = &cold[i];
+            new_inodes[ctx->inode_capacity + i] = &slab[i];
         }
-        return 0;
+        ctx->inode_slabs[ctx->inode_slab_count++] = slab;
+        ctx->inode_capacity = new_capacity;
     }
+    return 0;
+}
 
-    if (size > 0) {
-        existing->value = malloc(size);
-        if (!existing->value) {
-            free(existing->name);
-            existing->name = NULL;
-            inode->xattr_count--;
+/* Zero an inode slot, keeping the link to its cold record. */
+static void clear_inode(struct appendfs_inode *inode) {
+    struct appendfs_inode_cold *cold = inode->cold;
+    memset(cold, 0, sizeof(*cold));
+    memset(inode, 0, sizeof(*inode));
+    inode->cold = cold;
+}
+
+static struct appendfs_inode *take_inode_slot(struct appendfs_context *ctx) {
+    struct appendfs_inode *inode = ctx->inodes[ctx->inode_count++];
+    clear_inode(inode);
+    return inode;
+}
+
+static int add_extent(struct appendfs_inode *inode, off_t logical, off_t data_offset, uint32_t length, uint32_t stored_length, uint32_t checksum, uint32_t flags) {
+    if (inode->cold->extent_count >= inode->cold->extent_capacity) {
+        size_t new_capacity = inode->cold->extent_capacity ? inode->cold->extent_capacity * 2 : 1;
+        struct appendfs_extent *extents = realloc(inode->cold->extents, new_capacity * sizeof(*extents));
+        if (!extents) {
             return -1;
         }
-        memcpy(existing->value, value, size);
-    } else {
-        existing->value = NULL;
-    }
-    existing->size = size;
+        inode->cold->extents = extents;
+        inode->cold->extent_capacity = new_capacity;
+    }
+    inode->cold->extents[inode->cold->extent_count].logical_offset = logical;
+    inode->cold->extents[inode->cold->extent_count].data_offset = data_offset;
+    inode->cold->extents[inode->cold->extent_count].length = length;
+    inode->cold->extents[inode->cold->extent_count].stored_length = stored_length;
+    inode->cold->extents[inode->cold->extent_count].checksum = checksum;
+    inode->cold->extents[inode->cold->extent_count].flags = flags;
+    inode->cold->extents[inode->cold->extent_count].visible = length;
+    inode->cold->extent_count += 1;
     return 0;
 }
 
-static int remove_xattr_internal(struct appendfs_inode *inode, const char *name) {
-    for (size_t i = 0; i < inode->xattr_count; ++i) {
-        if (strcmp(inode->xattrs[i].name, name) == 0) {
-            free(inode->xattrs[i].name);
-            free(inode->xattrs[i].value);
-            if (i + 1 < inode->xattr_count) {
-                memmove(&inode->xattrs[i], &inode->xattrs[i + 1], (inode->xattr_count - i - 1) * sizeof(*inode->xattrs));
-            }
-            inode->xattr_count--;
-            return 0;
-        }
+static void drop_inline_data(struct appendfs_inode *inode) {
+    free(inode->cold->inline_data);
+    inode->cold->inline_data = NULL;
+    inode->cold->inline_size = 0;
+}
+
+static void trim_inline_data(struct appendfs_inode *inode, off_t size) {
+    if (size == 0) {
+        drop_inline_data(inode);
+    } else if ((off_t)inode->cold->inline_size > size) {
+        inode->cold->inline_size = (size_t)size;
     }
-    errno = ENODATA;
-    return -1;
 }
 
-static int write_record(struct appendfs_context *ctx, uint8_t type, const void *payload, uint32_t length) {
-    uint8_t header[RECORD_HEADER_SIZE];
-    header[0] = type;
-    header[1] = (uint8_t)(length & 0xffu);
-    header[2] = (uint8_t)((length >> 8) & 0xffu);
-    header[3] = (uint8_t)((length >> 16) & 0xffu);
-    header[4] = (uint8_t)((length >> 24) & 0xffu);
-    uint32_t checksum = appendfs_crc32(payload, length);
-    header[5] = (uint8_t)(checksum & 0xffu);
-    header[6] = (uint8_t)((checksum >> 8) & 0xffu);
-    header[7] = (uint8_t)((checksum >> 16) & 0xffu);
-    header[8] = (uint8_t)((checksum >> 24) & 0xffu);
+/*
+ * Space accounting.  An extent is charged for the bytes of $dir/data it
+ * keeps reachable: its visible bytes, since ranges that truncation cut off
+ * or a later overwrite covers are never read again.  A compressed extent
+ * needs all of its stored bytes while any of it is visible.  ctx->live_bytes
+ * sums the charges of inodes that are not deleted; the rest of $dir/data is
+ * dead.
+ */
+static uint64_t extent_charge(const struct appendfs_extent *ext) {
+    if (ext->flags & EXTENT_COMPRESSED) {
+        return ext->visible > 0 ? ext->stored_length : 0;
+    }
+    return ext->visible < ext->stored_length ? ext->visible : ext->stored_length;
+}
 
-    if (write_all(ctx->meta_fd, header, sizeof(header)) == -1) {
-        return -1;
+static void charge_inode(struct appendfs_context *ctx, struct appendfs_inode *inode, uint64_t bytes) {
+    inode->allocated += bytes;
+    if (!inode->deleted) {
+        ctx->live_bytes += bytes;
     }
-    if (write_all(ctx->meta_fd, payload, length) == -1) {
-        return -1;
+}
+
+static void uncharge_inode(struct appendfs_context *ctx, struct appendfs_inode *inode, uint64_t bytes) {
+    inode->allocated -= bytes;
+    if (!inode->deleted) {
+        ctx->live_bytes -= bytes;
     }
-    return 0;
 }
 
-static int replay_metadata(struct appendfs_context *ctx) {
-    if (lseek(ctx->meta_fd, 0, SEEK_SET) == (off_t)-1) {
-        return -1;
+/* Extents with nothing visible are never read again; drop them, keeping write order. */
+static void drop_hidden_extents(struct appendfs_inode *inode) {
+    size_t keep = 0;
+    for (size_t i = 0; i < inode->cold->extent_count; ++i) {
+        if (inode->cold->extents[i].visible > 0) {
+            inode->cold->extents[keep++] = inode->cold->extents[i];
+        }
     }
-    uint8_t header[RECORD_HEADER_SIZE];
-    while (1) {
-        ssize_t hdr = read(ctx->meta_fd, header, sizeof(header));
-        if (hdr == 0) {
-            break;
+    inode->cold->extent_count = keep;
+}
+
+static int compare_offsets(const void *a, const void *b) {
+    off_t x = *(const off_t *)a;
+    off_t y = *(const off_t *)b;
+    return (x > y) - (x < y);
+}
+
+static size_t find_offset(const off_t *points, size_t count, off_t offset) {
+    size_t lo = 0;
+    size_t hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (points[mid] < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* The first piece at or after piece that is not painted yet. */
+static size_t next_unpainted(size_t *next, size_t piece) {
+    size_t root = piece;
+    while (next[root] != root) {
+        root = next[root];
+    }
+    while (next[piece] != root) {
+        size_t up = next[piece];
+        next[piece] = root;
+        piece = up;
+    }
+    return root;
+}
+
+/*
+ * Work out every extent's visible bytes and drop the hidden extents.  The
+ * extents' start and end offsets cut the file into pieces.  Extents are
+ * painted newest first and each piece goes to the first one that covers it;
+ * a union-find over the pieces skips those already painted, so the pass is
+ * dominated by sorting the offsets.  Returns -1, leaving the counts as they
+ * were, if the scratch arrays cannot be had.
+ */
+static int shade_extents(struct appendfs_context *ctx, struct appendfs_inode *inode) {
+    size_t count = inode->cold->extent_count;
+    if (count * 2 > ctx->shade_capacity) {
+        size_t new_capacity = ctx->shade_capacity ? ctx->shade_capacity : 256;
+        while (new_capacity < count * 2) {
+            new_capacity *= 2;
+        }
+        off_t *points = malloc(new_capacity * sizeof(*points));
+        size_t *next = malloc(new_capacity * sizeof(*next));
+        if (!points || !next) {
+            free(points);
+            free(next);
+            return -1;
+        }
+        free(ctx->shade_points);
+        free(ctx->shade_next);
+        ctx->shade_points = points;
+        ctx->shade_next = next;
+        ctx->shade_capacity = new_capacity;
+    }
+    off_t *points = ctx->shade_points;
+    size_t *next = ctx->shade_next;
+    for (size_t i = 0; i < count; ++i) {
+        points[2 * i] = inode->cold->extents[i].logical_offset;
+        points[2 * i + 1] = inode->cold->extents[i].logical_offset + inode->cold->extents[i].length;
+    }
+    qsort(points, count * 2, sizeof(*points), compare_offsets);
+    size_t unique = 0;
+    for (size_t i = 0; i < count * 2; ++i) {
+        if (unique == 0 || points[unique - 1] != points[i]) {
+            points[unique++] = points[i];
+        }
+    }
+    for (size_t i = 0; i < unique; ++i) {
+        next[i] = i;
+    }
+    for (size_t i = count; i-- > 0;) {
+        struct appendfs_extent *ext = &inode->cold->extents[i];
+        size_t last = find_offset(points, unique, ext->logical_offset + ext->length);
+        uint32_t visible = 0;
+        for (size_t piece = next_unpainted(next, find_offset(points, unique, ext->logical_offset)); piece < last;
+             piece = next_unpainted(next, piece)) {
+            visible += (uint32_t)(points[piece + 1] - points[piece]);
+            next[piece] = piece + 1;
+        }
+        ext->visible = visible;
+    }
+    drop_hidden_extents(inode);
+    inode->cold->shade_pending = 0;
+    inode->cold->shaded_extents = inode->cold->extent_count;
+    return 0;
+}
+
+/*
+ * An extent written below the end of the file may cover older ones.  The
+ * bytes it hides stay charged, and count in st_blocks, until the inode is
+ * settled: on truncate, when the store's space stats are read, and whenever
+ * its extent count has grown fourfold since the last pass.  That keeps the
+ * cost of settling proportional to the writes and drops hidden extents from
+ * memory.
+ */
+static void mark_overlap(struct appendfs_context *ctx, struct appendfs_inode *inode) {
+    inode->cold->shade_pending = 1;
+    ctx->shade_pending = 1;
+}
+
+/*
+ * Cut the inode's extents to size.  Extents are in write order, not sorted
+ * by offset, so each one is checked.  A cut extent keeps at most its new
+ * length visible until the inode is settled.
+ */
+static void truncate_extents(struct appendfs_context *ctx, struct appendfs_inode *inode, off_t size) {
+    for (size_t i = 0; i < inode->cold->extent_count; ++i) {
+        struct appendfs_extent *ext = &inode->cold->extents[i];
+        if (ext->logical_offset >= size) {
+            ext->length = 0;
+            mark_overlap(ctx, inode);
+        } else if (ext->logical_offset + (off_t)ext->length > size) {
+            ext->length = (uint32_t)(size - ext->logical_offset);
+            mark_overlap(ctx, inode);
+        } else {
+            continue;
+        }
+        if (ext->visible > ext->length) {
+            ext->visible = ext->length;
+        }
+    }
+}
+
+static uint64_t inode_charge(const struct appendfs_inode *inode) {
+    uint64_t charge = 0;
+    for (size_t e = 0; e < inode->cold->extent_count; ++e) {
+        charge += extent_charge(&inode->cold->extents[e]);
+    }
+    return charge;
+}
+
+static void settle_inode(struct appendfs_context *ctx, struct appendfs_inode *inode) {
+    if (!inode->cold->shade_pending || shade_extents(ctx, inode) == -1) {
+        return;
+    }
+    uint64_t charge = inode_charge(inode);
+    if (charge < inode->allocated) {
+        uncharge_inode(ctx, inode, inode->allocated - charge);
+    } else {
+        charge_inode(ctx, inode, charge - inode->allocated);
+    }
+}
+
+static void settle_space(struct appendfs_context *ctx) {
+    if (!ctx->shade_pending) {
+        return;
+    }
+    ctx->shade_pending = 0;
+    for (size_t i = 0; i < ctx->inode_count; ++i) {
+        settle_inode(ctx, ctx->inodes[i]);
+        ctx->shade_pending |= ctx->inodes[i]->cold->shade_pending;
+    }
+}
+
+/*
+ * Replay applies records without accounting, so charges are rebuilt after
+ * it.  Inodes that replay marked overlapped are settled later, as at run
+ * time, which keeps mount a single pass.
+ */
+static void recount_space(struct appendfs_context *ctx) {
+    ctx->live_bytes = 0;
+    for (size_t i = 0; i < ctx->inode_count; ++i) {
+        struct appendfs_inode *inode = ctx->inodes[i];
+        inode->allocated = inode_charge(inode);
+        if (!inode->deleted) {
+            ctx->live_bytes += inode->allocated;
+        }
+    }
+}
+
+static struct appendfs_xattr *find_xattr(struct appendfs_inode *inode, const char *name) {
+    for (size_t i = 0; i < inode->cold->xattr_count; ++i) {
+        if (strcmp(inode->cold->xattrs[i].name, name) == 0) {
+            return &inode->cold->xattrs[i];
+        }
+    }
+    return NULL;
+}
+
+static struct appendfs_xattr *find_xattr_len(struct appendfs_inode *inode, const char *name, size_t name_len) {
+    for (size_t i = 0; i < inode->cold->xattr_count; ++i) {
+        if (strncmp(inode->cold->xattrs[i].name, name, name_len) == 0 && inode->cold->xattrs[i].name[name_len] == '\0') {
+            return &inode->cold->xattrs[i];
+        }
+    }
+    return NULL;
+}
+
+static void remove_xattr_at(struct appendfs_context *ctx, struct appendfs_inode *inode, struct appendfs_xattr *xattr) {
+    size_t i = (size_t)(xattr - inode->cold->xattrs);
+    release_string(ctx, xattr->name);
+    release_string(ctx, xattr->value);
+    if (i + 1 < inode->cold->xattr_count) {
+        memmove(&inode->cold->xattrs[i], &inode->cold->xattrs[i + 1], (inode->cold->xattr_count - i - 1) * sizeof(*inode->cold->xattrs));
+    }
+    inode->cold->xattr_count--;
+}
+
+static int ensure_xattr_capacity(struct appendfs_inode *inode) {
+    if (inode->cold->xattr_count >= inode->cold->xattr_capacity) {
+        size_t new_capacity = inode->cold->xattr_capacity ? inode->cold->xattr_capacity * 2 : 4;
+        struct appendfs_xattr *items = realloc(inode->cold->xattrs, new_capacity * sizeof(*items));
+        if (!items) {
+            return -1;
+        }
+        inode->cold->xattrs = items;
+        inode->cold->xattr_capacity = new_capacity;
+    }
+    return 0;
+}
+
+static int set_xattr_internal(struct appendfs_context *ctx, struct appendfs_inode *inode, const char *name, const void *value, size_t size, int flags) {
+    struct appendfs_xattr *existing = find_xattr(inode, name);
+    if (flags & XATTR_CREATE) {
+        if (existing) {
+            errno = EEXIST;
+            return -1;
+        }
+    }
+    if (flags & XATTR_REPLACE) {
+        if (!existing) {
+            errno = ENODATA;
+            return -1;
+        }
+    }
+    if (!existing) {
+        if (ensure_xattr_capacity(inode) == -1) {
+            return -1;
+        }
+        existing = &inode->cold->xattrs[inode->cold->xattr_count++];
+        existing->name = strdup(name);
+        if (!existing->name) {
+            inode->cold->xattr_count--;
+            return -1;
+        }
+        existing->value = NULL;
+        existing->size = 0;
+    } else {
+        unsigned char *new_value;
+        if (appendfs_arena_owns(&ctx->strings, existing->value)) {
+            new_value = malloc(size);
+        } else {
+            new_value = realloc(existing->value, size);
+        }
+        if (!new_value && size > 0) {
+            return -1;
+        }
+        existing->value = new_value;
+        existing->size = size;
+        if (size > 0) {
+            memcpy(existing->value, value, size);
+        }
+        return 0;
+    }
+
+    if (size > 0) {
+        existing->value = malloc(size);
+        if (!existing->value) {
+            free(existing->name);
+            existing->name = NULL;
+            inode->cold->xattr_count--;
+            return -1;
         }
-        if (hdr < 0) {
+        memcpy(existing->value, value, size);
+    } else {
+        existing->value = NULL;
+    }
+    existing->size = size;
+    return 0;
+}
+
+static int remove_xattr_internal(struct appendfs_context *ctx, struct appendfs_inode *inode, const char *name) {
+    struct appendfs_xattr *xattr = find_xattr(inode, name);
+    if (!xattr) {
+        errno = ENODATA;
+        return -1;
+    }
+    remove_xattr_at(ctx, inode, xattr);
+    return 0;
+}
+
+static int pwrite_all(int fd, const void *buf, size_t size, off_t offset) {
+    const unsigned char *p = (const unsigned char *)buf;
+    size_t written = 0;
+    while (written < size) {
+        ssize_t rc = pwrite(fd, p + written, size - written, offset + (off_t)written);
+        if (rc < 0) {
             if (errno == EINTR) {
                 continue;
             }
             return -1;
         }
-        if ((size_t)hdr < sizeof(header)) {
-            break;
+        if (rc == 0) {
+            errno = EIO;
+            return -1;
         }
-        uint8_t type = header[0];
-        uint32_t length = (uint32_t)header[1] |
-                          ((uint32_t)header[2] << 8) |
-                          ((uint32_t)header[3] << 16) |
-                          ((uint32_t)header[4] << 24);
-        uint32_t checksum = (uint32_t)header[5] |
-                            ((uint32_t)header[6] << 8) |
-                            ((uint32_t)header[7] << 16) |
-                            ((uint32_t)header[8] << 24);
-        unsigned char *payload = malloc(length);
-        if (!payload) {
-            return -1;
-        }
-        if (read_all(ctx->meta_fd, payload, length) == -1) {
-            free(payload);
-            break;
+        written += (size_t)rc;
+    }
+    return 0;
+}
+
+static int commit_stage(struct appendfs_context *ctx) {
+    size_t data_bytes = ctx->stage_used;
+    size_t meta_bytes = ctx->meta_pending_used;
+    if (data_bytes == 0 && meta_bytes == 0) {
+        return 0;
+    }
+    uint64_t start = appendfs_opstats_now();
+    if (ctx->stage_used > 0) {
+        if (pwrite_all(ctx->data_fd, ctx->stage, ctx->stage_used, ctx->stage_offset) == -1) {
+            return -1;
         }
-        uint32_t actual = appendfs_crc32(payload, length);
-        if (actual != checksum) {
-            free(payload);
-            continue;
+        ctx->stage_offset += (off_t)ctx->stage_used;
+        ctx->stage_used = 0;
+        ctx->stage_commits++;
+    }
+    if (ctx->meta_pending_used > 0) {
+        if (write_all(ctx->meta_fd, ctx->meta_pending, ctx->meta_pending_used) == -1) {
+            return -1;
         }
-        const unsigned char *p = payload;
-        switch (type) {
-        case APPENDFS_RECORD_CREATE:
-        case APPENDFS_RECORD_MKDIR: {
-            if (length < sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint64_t)) {
-                break;
-            }
-            uint64_t inode_id = 0;
-            uint32_t mode = 0;
-            uint64_t size = 0;
-            uint64_t ts = 0;
-            uint32_t path_len = 0;
-            memcpy(&inode_id, p, sizeof(uint64_t));
-            memcpy(&mode, p + sizeof(uint64_t), sizeof(uint32_t));
-            memcpy(&size, p + sizeof(uint64_t) + sizeof(uint32_t), sizeof(uint64_t));
-            memcpy(&ts, p + sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint64_t), sizeof(uint64_t));
-            memcpy(&path_len, p + sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint64_t), sizeof(uint32_t));
-            size_t offset = sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint64_t) + sizeof(uint32_t);
-            if (offset + path_len > length) {
-                break;
-            }
-            char *path = strndup((const char *)(p + offset), path_len);
-            if (!path) {
-                break;
-            }
-            struct appendfs_inode *inode = find_inode_by_id(ctx, inode_id);
-            if (!inode) {
-                if (ensure_inode_capacity(ctx) == -1) {
-                    free(path);
-                    break;
-                }
-                inode = &ctx->inodes[ctx->inode_count++];
-                memset(inode, 0, sizeof(*inode));
-                inode->inode_id = inode_id;
-            } else {
-                free(inode->path);
-                inode->extent_count = 0;
-                free(inode->symlink_target);
-                inode->symlink_target = NULL;
-                for (size_t i = 0; i < inode->xattr_count; ++i) {
-                    free(inode->xattrs[i].name);
-                    free(inode->xattrs[i].value);
-                }
-                inode->xattr_count = 0;
-            }
-            inode->path = path;
-            inode->mode = (mode_t)mode;
-            inode->size = (off_t)size;
-            inode->ctime = (time_t)ts;
-            inode->mtime = (time_t)ts;
-            inode->atime = (time_t)ts;
-            inode->deleted = 0;
-            offset += path_len;
-            if (S_ISLNK(inode->mode)) {
-                if (offset + sizeof(uint32_t) <= length) {
-                    uint32_t target_len = 0;
-                    memcpy(&target_len, p + offset, sizeof(uint32_t));
-                    offset += sizeof(uint32_t);
-                    if (offset + target_len <= length) {
-                        char *target = strndup((const char *)(p + offset), target_len);
-                        if (target) {
-                            inode->symlink_target = target;
-                        }
-                    }
-                }
-            }
-            if (ctx->next_inode_id <= inode_id) {
-                ctx->next_inode_id = inode_id + 1;
-            }
-            break;
+        ctx->meta_size += (off_t)ctx->meta_pending_used;
+        ctx->meta_pending_used = 0;
+        if (ctx->txn_open) {
+            ctx->txn_mark = 0;
+            ctx->txn_flushed = 1;
         }
-        case APPENDFS_RECORD_EXTENT: {
-            if (length < sizeof(uint64_t) * 4 + sizeof(uint32_t)) {
-                break;
-            }
-            uint64_t inode_id = 0;
-            uint64_t logical_raw = 0;
-            uint64_t data_raw = 0;
-            uint32_t len = 0;
-            uint64_t new_size_raw = 0;
-            memcpy(&inode_id, p, sizeof(uint64_t));
-            memcpy(&logical_raw, p + sizeof(uint64_t), sizeof(uint64_t));
-            memcpy(&data_raw, p + sizeof(uint64_t) * 2, sizeof(uint64_t));
-            memcpy(&len, p + sizeof(uint64_t) * 3, sizeof(uint32_t));
-            memcpy(&new_size_raw, p + sizeof(uint64_t) * 3 + sizeof(uint32_t), sizeof(uint64_t));
-            off_t logical = (off_t)logical_raw;
-            off_t data_offset = (off_t)data_raw;
-            off_t new_size = (off_t)new_size_raw;
-            struct appendfs_inode *inode = find_inode_by_id(ctx, inode_id);
-            if (!inode) {
-                break;
-            }
-            add_extent(inode, logical, data_offset, len);
-            if (new_size > inode->size) {
-                inode->size = new_size;
-            }
-            break;
+    }
+    APPENDFS_TRACE(&ctx->trace, commit, APPENDFS_TRACE_COMMIT, 0, data_bytes, meta_bytes, appendfs_opstats_now() - start);
+    return 0;
+}
+
+static int settle_stage(struct appendfs_context *ctx) {
+    return ctx->flusher_started == 1 ? 0 : commit_stage(ctx);
+}
+
+/*
+ * Queue a record, leaving at least spare bytes free after it.  Records of an
+ * open transaction keep TXN_RECORD_MAX spare, so queuing its commit record
+ * never needs memory and txn_commit() cannot fail to close it.
+ */
+static int queue_meta(struct appendfs_context *ctx, const void *header, size_t header_len, const void *payload, size_t length, size_t spare) {
+    size_t needed = ctx->meta_pending_used + header_len + length + spare;
+    if (needed > ctx->meta_pending_capacity) {
+        size_t new_capacity = ctx->meta_pending_capacity ? ctx->meta_pending_capacity : 64 * 1024;
+        while (new_capacity < needed) {
+            new_capacity *= 2;
         }
-        case APPENDFS_RECORD_TRUNCATE: {
-            if (length < sizeof(uint64_t) * 2) {
-                break;
-            }
-            uint64_t inode_id = 0;
-            uint64_t new_size_raw = 0;
-            memcpy(&inode_id, p, sizeof(uint64_t));
-            memcpy(&new_size_raw, p + sizeof(uint64_t), sizeof(uint64_t));
-            off_t new_size = (off_t)new_size_raw;
-            struct appendfs_inode *inode = find_inode_by_id(ctx, inode_id);
-            if (!inode) {
-                break;
+        unsigned char *pending = realloc(ctx->meta_pending, new_capacity);
+        if (!pending) {
+            return -1;
+        }
+        ctx->meta_pending = pending;
+        ctx->meta_pending_capacity = new_capacity;
+    }
+    memcpy(ctx->meta_pending + ctx->meta_pending_used, header, header_len);
+    memcpy(ctx->meta_pending + ctx->meta_pending_used + header_len, payload, length);
+    ctx->meta_pending_used += header_len + length;
+    if (ctx->meta_pending_used >= META_PENDING_MAX) {
+        /*
+         * The record is queued either way, so it is not reported as failed:
+         * a failed commit leaves everything pending for the next commit,
+         * whose caller (fsync, the flusher) sees the error.
+         */
+        commit_stage(ctx);
+    }
+    return 0;
+}
+
+/*
+ * Place data at the end of $dir/data and return its offset.  Chunks of at
+ * least STAGE_DIRECT_MIN bytes are written directly once the stage has been
+ * committed; smaller ones are copied into the stage.
+ */
+static int stage_data(struct appendfs_context *ctx, const void *data, size_t length, off_t *data_offset) {
+    if (ctx->stage_used > 0 && (length >= STAGE_DIRECT_MIN || ctx->stage_used + length > STAGE_SIZE)) {
+        if (commit_stage(ctx) == -1) {
+            return -1;
+        }
+    }
+    if (length >= STAGE_DIRECT_MIN) {
+        if (commit_stage(ctx) == -1) {
+            return -1;
+        }
+        if (pwrite_all(ctx->data_fd, data, length, ctx->stage_offset) == -1) {
+            return -1;
+        }
+        *data_offset = ctx->stage_offset;
+        ctx->stage_offset += (off_t)length;
+        return 0;
+    }
+    if (!ctx->stage) {
+        ctx->stage = malloc(STAGE_SIZE);
+        if (!ctx->stage) {
+            return -1;
+        }
+    }
+    if (ctx->stage_used == 0) {
+        ctx->stage_since_ms = monotonic_ms();
+        start_flusher(ctx);
+    }
+    memcpy(ctx->stage + ctx->stage_used, data, length);
+    *data_offset = ctx->stage_offset + (off_t)ctx->stage_used;
+    ctx->stage_used += length;
+    return 0;
+}
+
+/* Copy bytes of $dir/data, taking the staged tail from memory. */
+static int pread_data(struct appendfs_context *ctx, void *buf, size_t length, off_t data_offset) {
+    uint64_t start = appendfs_opstats_now();
+    int rc = pread_all(ctx->data_fd, buf, length, data_offset);
+    appendfs_opstats_record(&ctx->opstats, APPENDFS_OP_PREAD, start, rc == -1, rc == 0 ? length : 0);
+    return rc;
+}
+
+/*
+ * Read committed data through the block cache.  A block is filled with as
+ * much of it as is committed, so the last block of $dir/data is refilled
+ * when a later read needs bytes committed since.
+ */
+static int read_data_cached(struct appendfs_context *ctx, unsigned char *out, size_t length, off_t data_offset) {
+    while (length > 0) {
+        uint64_t block = (uint64_t)data_offset / APPENDFS_BLOCKCACHE_BLOCK;
+        off_t block_start = (off_t)(block * APPENDFS_BLOCKCACHE_BLOCK);
+        size_t in_block = (size_t)(data_offset - block_start);
+        size_t n = APPENDFS_BLOCKCACHE_BLOCK - in_block;
+        if (n > length) {
+            n = length;
+        }
+        struct appendfs_blockcache_entry *entry = appendfs_blockcache_get(&ctx->read_cache, block, in_block + n);
+        if (!entry) {
+            if (pread_data(ctx, out, n, data_offset) == -1) {
+                return -1;
             }
-            inode->size = new_size;
-            for (size_t i = 0; i < inode->extent_count; ++i) {
-                struct appendfs_extent *ext = &inode->extents[i];
-                if (ext->logical_offset >= new_size) {
-                    inode->extent_count = i;
-                    break;
+        } else {
+            if (entry->valid == 0) {
+                size_t fill = APPENDFS_BLOCKCACHE_BLOCK;
+                if ((off_t)fill > ctx->stage_offset - block_start) {
+                    fill = (size_t)(ctx->stage_offset - block_start);
                 }
-                off_t end = ext->logical_offset + ext->length;
-                if (end > new_size) {
-                    ext->length = (uint32_t)(new_size - ext->logical_offset);
-                    inode->extent_count = i + 1;
-                    break;
+                if (pread_data(ctx, entry->data, fill, block_start) == -1) {
+                    return -1;
                 }
+                entry->valid = (uint32_t)fill;
             }
-            break;
+            memcpy(out, entry->data + in_block, n);
         }
-        case APPENDFS_RECORD_UNLINK: {
-            if (length < sizeof(uint64_t)) {
-                break;
-            }
-            uint64_t inode_id = 0;
-            memcpy(&inode_id, p, sizeof(uint64_t));
-            struct appendfs_inode *inode = find_inode_by_id(ctx, inode_id);
-            if (inode) {
-                inode->deleted = 1;
-            }
-            break;
+        out += n;
+        length -= n;
+        data_offset += (off_t)n;
+    }
+    return 0;
+}
+
+static int read_data(struct appendfs_context *ctx, void *buf, size_t length, off_t data_offset) {
+    unsigned char *out = buf;
+    if (data_offset < ctx->stage_offset) {
+        size_t disk_len = length;
+        if ((off_t)disk_len > ctx->stage_offset - data_offset) {
+            disk_len = (size_t)(ctx->stage_offset - data_offset);
         }
-        case APPENDFS_RECORD_RENAME: {
-            if (length < sizeof(uint64_t) + sizeof(uint32_t)) {
-                break;
-            }
-            uint64_t inode_id = 0;
-            uint32_t path_len = 0;
-            memcpy(&inode_id, p, sizeof(uint64_t));
-            memcpy(&path_len, p + sizeof(uint64_t), sizeof(uint32_t));
-            if (sizeof(uint64_t) + sizeof(uint32_t) + path_len > length) {
-                break;
-            }
-            struct appendfs_inode *inode = find_inode_by_id(ctx, inode_id);
-            if (!inode) {
-                break;
-            }
-            char *path = strndup((const char *)(p + sizeof(uint64_t) + sizeof(uint32_t)), path_len);
-            if (!path) {
-                break;
+        int rc;
+        if (disk_len <= READ_CACHE_MAX_READ && !(ctx->flags & APPENDFS_OPT_NO_READ_CACHE)) {
+            rc = read_data_cached(ctx, out, disk_len, data_offset);
+        } else {
+            rc = pread_data(ctx, out, disk_len, data_offset);
+        }
+        if (rc == -1) {
+            return -1;
+        }
+        out += disk_len;
+        length -= disk_len;
+        data_offset += (off_t)disk_len;
+    }
+    if (length > 0) {
+        off_t staged = data_offset - ctx->stage_offset;
+        if (staged < 0 || (size_t)staged + length > ctx->stage_used) {
+            errno = EIO;
+            return -1;
+        }
+        memcpy(out, ctx->stage + staged, length);
+    }
+    return 0;
+}
+
+static int capture_record(struct appendfs_context *ctx, const void *header, size_t header_len, const void *payload, size_t length) {
+    size_t needed = ctx->group_used + header_len + length;
+    if (needed > UINT32_MAX) {
+        errno = E2BIG;
+        return -1;
+    }
+    if (needed > ctx->group_capacity) {
+        size_t new_capacity = ctx->group_capacity ? ctx->group_capacity : 4096;
+        while (new_capacity < needed) {
+            new_capacity *= 2;
+        }
+        unsigned char *group = realloc(ctx->group, new_capacity);
+        if (!group) {
+            return -1;
+        }
+        ctx->group = group;
+        ctx->group_capacity = new_capacity;
+    }
+    memcpy(ctx->group + ctx->group_used, header, header_len);
+    memcpy(ctx->group + ctx->group_used + header_len, payload, length);
+    ctx->group_used += header_len + length;
+    return 0;
+}
+
+static int write_record(struct appendfs_context *ctx, uint8_t type, const void *payload, uint32_t length) {
+    uint8_t header[RECORD_HEADER_SIZE];
+    header[0] = (uint8_t)(type | RECORD_FLAG_VERSIONED);
+    header[1] = RECORD_VERSION;
+    header[2] = 0;
+    header[3] = 0;
+    header[4] = (uint8_t)(length & 0xffu);
+    header[5] = (uint8_t)((length >> 8) & 0xffu);
+    header[6] = (uint8_t)((length >> 16) & 0xffu);
+    header[7] = (uint8_t)((length >> 24) & 0xffu);
+    uint32_t checksum = appendfs_crc32c(header, 8);
+    checksum = appendfs_crc32c_update(checksum, payload, length);
+    header[8] = (uint8_t)(checksum & 0xffu);
+    header[9] = (uint8_t)((checksum >> 8) & 0xffu);
+    header[10] = (uint8_t)((checksum >> 16) & 0xffu);
+    header[11] = (uint8_t)((checksum >> 24) & 0xffu);
+
+    uint64_t start = appendfs_opstats_now();
+    int rc;
+    if (ctx->log_failed) {
+        errno = EIO;
+        rc = -1;
+    } else if (ctx->group_capture) {
+        rc = capture_record(ctx, header, sizeof(header), payload, length);
+    } else if (ctx->txn_open || ctx->stage_used > 0 || ctx->meta_pending_used > 0) {
+        size_t spare = ctx->txn_open && type != APPENDFS_RECORD_TXN_COMMIT ? TXN_RECORD_MAX : 0;
+        rc = queue_meta(ctx, header, sizeof(header), payload, length, spare);
+    } else if (write_all(ctx->meta_fd, header, sizeof(header)) == -1 || write_all(ctx->meta_fd, payload, length) == -1) {
+        rc = -1;
+    } else {
+        ctx->meta_size += (off_t)(sizeof(header) + length);
+        rc = 0;
+    }
+    uint64_t elapsed = appendfs_opstats_record(&ctx->opstats, APPENDFS_OP_WRITE_RECORD, start, rc == -1, rc == 0 ? sizeof(header) + length : 0);
+    if (rc == 0) {
+        APPENDFS_TRACE(&ctx->trace, record, APPENDFS_TRACE_RECORD, type, sizeof(header) + length, 0, elapsed);
+    }
+    return rc;
+}
+
+/*
+ * Operations that log several records bracket them in TXN_BEGIN/TXN_COMMIT.
+ * The records of an open transaction are queued in meta_pending and reach the
+ * log in one write at commit (later, if data is still staged).  Replay holds
+ * them back until the matching commit, so a crash in between loses the whole
+ * operation.  Only one transaction is open at a time, under the context lock.
+ */
+static int append_txn_record(struct appendfs_context *ctx, uint8_t type) {
+    unsigned char payload[VARINT_MAX];
+    unsigned char *p = put_varint(payload, ctx->txn_id);
+    return write_record(ctx, type, payload, (uint32_t)(p - payload));
+}
+
+static int txn_begin(struct appendfs_context *ctx) {
+    ctx->txn_id++;
+    ctx->txn_open = 1;
+    ctx->txn_flushed = 0;
+    ctx->txn_mark = ctx->meta_pending_used;
+    if (append_txn_record(ctx, APPENDFS_RECORD_TXN_BEGIN) == -1) {
+        ctx->meta_pending_used = ctx->txn_mark;
+        ctx->txn_open = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Drop the queued records of the open transaction.  If part of it was already
+ * written (a full meta_pending buffer is committed early), an abort record
+ * tells replay to discard that part.
+ */
+static void txn_abort(struct appendfs_context *ctx) {
+    int saved_errno = errno;
+    ctx->meta_pending_used = ctx->txn_mark;
+    ctx->txn_open = 0;
+    if (ctx->txn_flushed) {
+        append_txn_record(ctx, APPENDFS_RECORD_TXN_ABORT);
+    }
+    errno = saved_errno;
+}
+
+/*
+ * Queue the commit record and write the transaction out unless it has to
+ * wait for staged data.  Queuing cannot fail (queue_meta() kept room for the
+ * record), so the operation always stands once its records are queued.  If
+ * the write fails they stay queued for the next commit, as staged metadata
+ * does, and the error is returned for the caller to report.
+ */
+static int txn_commit(struct appendfs_context *ctx) {
+    append_txn_record(ctx, APPENDFS_RECORD_TXN_COMMIT);
+    ctx->txn_open = 0;
+    if (ctx->stage_used == 0) {
+        return commit_stage(ctx);
+    }
+    return settle_stage(ctx);
+}
+
+/*
+ * Resolve the parent directory of a replayed path.  Legacy logs may name
+ * entries whose parents were never logged as directories; those parents are
+ * synthesized so the tree stays connected.
+ */
+static struct appendfs_inode *replay_parent(struct appendfs_context *ctx, const char *path, size_t len, const char **name, size_t *name_len, int64_t ts) {
+    size_t parent_len = 0;
+    if (split_last(path, len, &parent_len, name, name_len) == -1) {
+        return NULL;
+    }
+    struct appendfs_inode *node = &ctx->root;
+    size_t i = 0;
+    while (i < parent_len) {
+        while (i < parent_len && path[i] == '/') {
+            i++;
+        }
+        size_t start = i;
+        while (i < parent_len && path[i] != '/') {
+            i++;
+        }
+        if (i == start) {
+            continue;
+        }
+        struct appendfs_inode *child = lookup_child(ctx, node, path + start, i - start);
+        if (!child) {
+            if (ensure_inode_capacity(ctx) == -1) {
+                return NULL;
+            }
+            const struct appendfs_name *interned = appendfs_names_intern(&ctx->names, path + start, i - start);
+            if (!interned) {
+                return NULL;
+            }
+            child = take_inode_slot(ctx);
+            child->inode_id = ctx->next_synthetic_id--;
+            child->mode = S_IFDIR | 0755;
+            child->ctime_ns = ts;
+            child->mtime_ns = ts;
+            child->atime_ns = ts;
+            child->parent = node;
+            child->name = interned;
+            index_inode_id(ctx, child);
+            attach_inode(ctx, child);
+        } else if (!S_ISDIR(child->mode)) {
+            return NULL;
+        }
+        node = child;
+    }
+    return node;
+}
+
+/*
+ * Place a replayed inode at parent/name.  Whatever held that name before is
+ * superseded; a synthesized directory hands its children to the real one.
+ */
+static void replay_place(struct appendfs_context *ctx, struct appendfs_inode *inode, struct appendfs_inode *parent, const char *name, size_t name_len) {
+    if (is_ancestor(inode, parent)) {
+        return;
+    }
+    struct appendfs_inode *occupant = lookup_child(ctx, parent, name, name_len);
+    if (occupant == inode) {
+        return;
+    }
+    if (occupant) {
+        if (occupant->inode_id >= SYNTHETIC_INODE_BASE && S_ISDIR(inode->mode)) {
+            while (occupant->first_child) {
+                struct appendfs_inode *child = occupant->first_child;
+                if (child != inode) {
+                    replay_place(ctx, child, inode, child->name->str, child->name->len);
+                }
+                if (child->parent == occupant) {
+                    detach_inode(ctx, child);
+                    child->deleted = child != inode;
+                }
+            }
+        }
+        detach_inode(ctx, occupant);
+        occupant->deleted = 1;
+    }
+    relocate_inode(ctx, inode, parent, name, name_len);
+}
+
+/* The first extent of an inline file holds the inline bytes (see spill_inline_data()). */
+static void replay_extent(struct appendfs_context *ctx, struct appendfs_inode *inode, off_t logical, off_t data_offset, uint32_t length, uint32_t stored_length, off_t new_size, uint32_t checksum, uint32_t flags) {
+    drop_inline_data(inode);
+    if (logical < inode->size) {
+        mark_overlap(ctx, inode);
+    }
+    inode->cold->log_logical_end = logical + (off_t)length;
+    inode->cold->log_data_end = data_offset + (off_t)stored_length;
+    add_extent(inode, logical, data_offset, length, stored_length, checksum, flags);
+    if (new_size > inode->size) {
+        inode->size = new_size;
+    }
+}
+
+static void replay_inline_data(struct appendfs_context *ctx, struct record_reader *r) {
+    struct appendfs_inode *inode = find_inode_by_id(ctx, read_varint(r));
+    uint64_t size = read_varint(r);
+    uint64_t data_len = read_varint(r);
+    const unsigned char *data = read_bytes(r, data_len);
+    if (!inode || !data || data_len == 0 || data_len > INLINE_DATA_MAX) {
+        return;
+    }
+    unsigned char *bytes = realloc(inode->cold->inline_data, (size_t)data_len);
+    if (!bytes) {
+        return;
+    }
+    memcpy(bytes, data, (size_t)data_len);
+    inode->cold->inline_data = bytes;
+    inode->cold->inline_size = (size_t)data_len;
+    inode->size = (off_t)size;
+}
+
+/*
+ * Decode one version 3 extent entry (a whole EXTENT payload, or one element
+ * of an EXTENT_BATCH) and apply it.  Entries of COMPRESSED_EXTENTS carry the
+ * stored length after the checksum; one shorter than length marks the
+ * extent compressed.  Returns -1 on a malformed entry.
+ */
+static int apply_compact_extent(struct appendfs_context *ctx, struct record_reader *r, int has_stored_length) {
+    struct appendfs_inode *inode = find_inode_by_id(ctx, read_varint(r));
+    int64_t logical_delta = read_svarint(r);
+    int64_t data_delta = read_svarint(r);
+    uint32_t length = (uint32_t)read_varint(r);
+    int64_t size_delta = read_svarint(r);
+    const unsigned char *checksum_bytes = read_bytes(r, sizeof(uint32_t));
+    uint64_t stored_length = has_stored_length ? read_varint(r) : length;
+    if (!checksum_bytes || r->bad || stored_length > length || (stored_length == 0 && length > 0)) {
+        return -1;
+    }
+    if (inode) {
+        uint32_t checksum = 0;
+        memcpy(&checksum, checksum_bytes, sizeof(uint32_t));
+        off_t logical = inode->cold->log_logical_end + (off_t)logical_delta;
+        off_t data_offset = inode->cold->log_data_end + (off_t)data_delta;
+        off_t new_size = logical + (off_t)length + (off_t)size_delta;
+        uint32_t flags = EXTENT_CHECKSUMMED | (stored_length < length ? EXTENT_COMPRESSED : 0);
+        replay_extent(ctx, inode, logical, data_offset, length, (uint32_t)stored_length, new_size, checksum, flags);
+    }
+    return 0;
+}
+
+static void apply_record(struct appendfs_context *ctx, uint8_t type, uint8_t version, const unsigned char *p, uint32_t length) {
+    struct record_reader r = {p, p + length, 0};
+    switch (type) {
+    case APPENDFS_RECORD_CREATE:
+    case APPENDFS_RECORD_MKDIR: {
+        uint64_t inode_id = 0;
+        uint32_t mode = 0;
+        uint64_t size = 0;
+        int64_t ts = 0;
+        const char *name = NULL;
+        size_t name_len = 0;
+        struct appendfs_inode *parent = NULL;
+        if (version >= 3) {
+            inode_id = read_varint(&r);
+            mode = (uint32_t)read_varint(&r);
+            size = read_varint(&r);
+            ts = read_svarint(&r);
+            parent = find_inode_by_id(ctx, read_varint(&r));
+            name_len = (size_t)read_varint(&r);
+            name = (const char *)read_bytes(&r, name_len);
+            if (r.bad || !parent || !S_ISDIR(parent->mode) || name_len == 0) {
+                break;
+            }
+        } else {
+            if (length < sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint64_t) + sizeof(uint32_t)) {
+                break;
+            }
+            uint32_t path_len = 0;
+            memcpy(&inode_id, p, sizeof(uint64_t));
+            memcpy(&mode, p + sizeof(uint64_t), sizeof(uint32_t));
+            memcpy(&size, p + sizeof(uint64_t) + sizeof(uint32_t), sizeof(uint64_t));
+            memcpy(&ts, p + sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint64_t), sizeof(uint64_t));
+            memcpy(&path_len, p + sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint64_t), sizeof(uint32_t));
+            r.p = p + sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint64_t) + sizeof(uint32_t);
+            const char *path = (const char *)read_bytes(&r, path_len);
+            if (!path) {
+                break;
+            }
+            ts = record_time_ns(version, ts);
+            parent = replay_parent(ctx, path, path_len, &name, &name_len, ts);
+            if (!parent) {
+                break;
+            }
+        }
+        struct appendfs_inode *inode = find_inode_by_id(ctx, inode_id);
+        if (!inode) {
+            if (ensure_inode_capacity(ctx) == -1) {
+                break;
             }
-            free(inode->path);
-            inode->path = path;
-            inode->deleted = 0;
+            inode = take_inode_slot(ctx);
+            inode->inode_id = inode_id;
+            index_inode_id(ctx, inode);
+        } else {
+            inode->cold->extent_count = 0;
+            inode->cold->log_logical_end = 0;
+            inode->cold->log_data_end = 0;
+            drop_inline_data(inode);
+            release_string(ctx, inode->cold->symlink_target);
+            inode->cold->symlink_target = NULL;
+            for (size_t i = 0; i < inode->cold->xattr_count; ++i) {
+                release_string(ctx, inode->cold->xattrs[i].name);
+                release_string(ctx, inode->cold->xattrs[i].value);
+            }
+            inode->cold->xattr_count = 0;
+        }
+        inode->mode = (mode_t)mode;
+        inode->size = (off_t)size;
+        inode->ctime_ns = ts;
+        inode->mtime_ns = ts;
+        inode->atime_ns = ts;
+        inode->deleted = 0;
+        replay_place(ctx, inode, parent, name, name_len);
+        if (S_ISLNK(inode->mode) && r.p < r.end) {
+            uint64_t target_len = 0;
+            if (version >= 3) {
+                target_len = read_varint(&r);
+            } else if (r.end - r.p >= (ptrdiff_t)sizeof(uint32_t)) {
+                uint32_t target_len32 = 0;
+                memcpy(&target_len32, r.p, sizeof(uint32_t));
+                r.p += sizeof(uint32_t);
+                target_len = target_len32;
+            } else {
+                r.bad = 1;
+            }
+            const char *target = (const char *)read_bytes(&r, target_len);
+            if (target) {
+                inode->cold->symlink_target = appendfs_arena_strndup(&ctx->strings, target, (size_t)target_len);
+            }
+        }
+        if (ctx->next_inode_id <= inode_id) {
+            ctx->next_inode_id = inode_id + 1;
+        }
+        break;
+    }
+    case APPENDFS_RECORD_EXTENT: {
+        if (version >= 3) {
+            apply_compact_extent(ctx, &r, 0);
             break;
         }
-        case APPENDFS_RECORD_SETXATTR: {
-            if (length < sizeof(uint64_t) + sizeof(uint32_t) * 2) {
+        if (length < sizeof(uint64_t) * 4 + sizeof(uint32_t)) {
+            break;
+        }
+        uint64_t inode_id = 0;
+        uint64_t logical_raw = 0;
+        uint64_t data_raw = 0;
+        uint32_t len = 0;
+        uint64_t new_size_raw = 0;
+        memcpy(&inode_id, p, sizeof(uint64_t));
+        memcpy(&logical_raw, p + sizeof(uint64_t), sizeof(uint64_t));
+        memcpy(&data_raw, p + sizeof(uint64_t) * 2, sizeof(uint64_t));
+        memcpy(&len, p + sizeof(uint64_t) * 3, sizeof(uint32_t));
+        memcpy(&new_size_raw, p + sizeof(uint64_t) * 3 + sizeof(uint32_t), sizeof(uint64_t));
+        uint32_t data_checksum = 0;
+        uint32_t extent_flags = 0;
+        if (length >= sizeof(uint64_t) * 4 + sizeof(uint32_t) * 2) {
+            memcpy(&data_checksum, p + sizeof(uint64_t) * 4 + sizeof(uint32_t), sizeof(uint32_t));
+            extent_flags = EXTENT_CHECKSUMMED;
+        }
+        struct appendfs_inode *inode = find_inode_by_id(ctx, inode_id);
+        if (inode) {
+            replay_extent(ctx, inode, (off_t)logical_raw, (off_t)data_raw, len, len, (off_t)new_size_raw, data_checksum, extent_flags);
+        }
+        break;
+    }
+    case APPENDFS_RECORD_EXTENT_BATCH:
+    case APPENDFS_RECORD_COMPRESSED_EXTENTS:
+        while (r.p < r.end && apply_compact_extent(ctx, &r, type == APPENDFS_RECORD_COMPRESSED_EXTENTS) == 0) {
+        }
+        break;
+    case APPENDFS_RECORD_INLINE_DATA:
+        replay_inline_data(ctx, &r);
+        break;
+    case APPENDFS_RECORD_TRUNCATE: {
+        uint64_t inode_id = 0;
+        uint64_t new_size_raw = 0;
+        if (version >= 3) {
+            inode_id = read_varint(&r);
+            new_size_raw = read_varint(&r);
+            if (r.bad) {
+                break;
+            }
+        } else {
+            if (length < sizeof(uint64_t) * 2) {
+                break;
+            }
+            memcpy(&inode_id, p, sizeof(uint64_t));
+            memcpy(&new_size_raw, p + sizeof(uint64_t), sizeof(uint64_t));
+        }
+        off_t new_size = (off_t)new_size_raw;
+        struct appendfs_inode *inode = find_inode_by_id(ctx, inode_id);
+        if (!inode) {
+            break;
+        }
+        inode->size = new_size;
+        trim_inline_data(inode, new_size);
+        truncate_extents(ctx, inode, new_size);
+        break;
+    }
+    case APPENDFS_RECORD_UNLINK: {
+        uint64_t inode_id = 0;
+        if (version >= 3) {
+            inode_id = read_varint(&r);
+            if (r.bad) {
+                break;
+            }
+        } else {
+            if (length < sizeof(uint64_t)) {
+                break;
+            }
+            memcpy(&inode_id, p, sizeof(uint64_t));
+        }
+        struct appendfs_inode *inode = find_inode_by_id(ctx, inode_id);
+        if (inode) {
+            detach_inode(ctx, inode);
+            inode->deleted = 1;
+        }
+        break;
+    }
+    case APPENDFS_RECORD_RENAME: {
+        const char *name = NULL;
+        size_t name_len = 0;
+        struct appendfs_inode *parent = NULL;
+        struct appendfs_inode *inode = NULL;
+        if (version >= 3) {
+            inode = find_inode_by_id(ctx, read_varint(&r));
+            parent = find_inode_by_id(ctx, read_varint(&r));
+            name_len = (size_t)read_varint(&r);
+            name = (const char *)read_bytes(&r, name_len);
+            if (r.bad || !inode || !parent || !S_ISDIR(parent->mode) || name_len == 0) {
+                break;
+            }
+        } else {
+            if (length < sizeof(uint64_t) + sizeof(uint32_t)) {
                 break;
             }
             uint64_t inode_id = 0;
-            uint32_t name_len = 0;
-            uint32_t value_len = 0;
+            uint32_t path_len = 0;
             memcpy(&inode_id, p, sizeof(uint64_t));
-            memcpy(&name_len, p + sizeof(uint64_t), sizeof(uint32_t));
-            memcpy(&value_len, p + sizeof(uint64_t) + sizeof(uint32_t), sizeof(uint32_t));
-            size_t offset = sizeof(uint64_t) + sizeof(uint32_t) * 2;
-            if (offset + name_len + value_len > length) {
+            memcpy(&path_len, p + sizeof(uint64_t), sizeof(uint32_t));
+            if (sizeof(uint64_t) + sizeof(uint32_t) + path_len > length) {
                 break;
             }
-            struct appendfs_inode *inode = find_inode_by_id(ctx, inode_id);
+            inode = find_inode_by_id(ctx, inode_id);
             if (!inode) {
                 break;
             }
-            char *name = strndup((const char *)(p + offset), name_len);
-            if (!name) {
-                break;
+            parent = replay_parent(ctx, (const char *)(p + sizeof(uint64_t) + sizeof(uint32_t)), path_len, &name, &name_len, 0);
+            if (!parent) {
+                break;
+            }
+        }
+        inode->deleted = 0;
+        replay_place(ctx, inode, parent, name, name_len);
+        break;
+    }
+    case APPENDFS_RECORD_SETXATTR: {
+        uint64_t inode_id = 0;
+        uint64_t name_len = 0;
+        uint64_t value_len = 0;
+        if (version >= 3) {
+            inode_id = read_varint(&r);
+            name_len = read_varint(&r);
+            value_len = read_varint(&r);
+        } else {
+            if (length < sizeof(uint64_t) + sizeof(uint32_t) * 2) {
+                break;
+            }
+            uint32_t name_len32 = 0;
+            uint32_t value_len32 = 0;
+            memcpy(&inode_id, p, sizeof(uint64_t));
+            memcpy(&name_len32, p + sizeof(uint64_t), sizeof(uint32_t));
+            memcpy(&value_len32, p + sizeof(uint64_t) + sizeof(uint32_t), sizeof(uint32_t));
+            r.p = p + sizeof(uint64_t) + sizeof(uint32_t) * 2;
+            name_len = name_len32;
+            value_len = value_len32;
+        }
+        const char *name = (const char *)read_bytes(&r, name_len);
+        const unsigned char *value_bytes = read_bytes(&r, value_len);
+        if (r.bad) {
+            break;
+        }
+        struct appendfs_inode *inode = find_inode_by_id(ctx, inode_id);
+        if (!inode) {
+            break;
+        }
+        unsigned char *value = NULL;
+        if (value_len > 0) {
+            value = appendfs_arena_memdup(&ctx->strings, value_bytes, (size_t)value_len);
+            if (!value) {
+                break;
+            }
+        }
+        struct appendfs_xattr *xattr = find_xattr_len(inode, name, (size_t)name_len);
+        if (!xattr) {
+            char *name_copy = appendfs_arena_strndup(&ctx->strings, name, (size_t)name_len);
+            if (!name_copy || ensure_xattr_capacity(inode) == -1) {
+                break;
+            }
+            xattr = &inode->cold->xattrs[inode->cold->xattr_count++];
+            xattr->name = name_copy;
+        } else {
+            release_string(ctx, xattr->value);
+        }
+        xattr->value = value;
+        xattr->size = (size_t)value_len;
+        break;
+    }
+    case APPENDFS_RECORD_REMOVEXATTR: {
+        uint64_t inode_id = 0;
+        uint64_t name_len = 0;
+        if (version >= 3) {
+            inode_id = read_varint(&r);
+            name_len = read_varint(&r);
+        } else {
+            if (length < sizeof(uint64_t) + sizeof(uint32_t)) {
+                break;
+            }
+            uint32_t name_len32 = 0;
+            memcpy(&inode_id, p, sizeof(uint64_t));
+            memcpy(&name_len32, p + sizeof(uint64_t), sizeof(uint32_t));
+            r.p = p + sizeof(uint64_t) + sizeof(uint32_t);
+            name_len = name_len32;
+        }
+        const char *name = (const char *)read_bytes(&r, name_len);
+        if (r.bad) {
+            break;
+        }
+        struct appendfs_inode *inode = find_inode_by_id(ctx, inode_id);
+        if (!inode) {
+            break;
+        }
+        struct appendfs_xattr *xattr = find_xattr_len(inode, name, (size_t)name_len);
+        if (xattr) {
+            remove_xattr_at(ctx, inode, xattr);
+        }
+        break;
+    }
+    case APPENDFS_RECORD_TIMES: {
+        uint64_t inode_id = 0;
+        int64_t atime_raw = 0;
+        int64_t mtime_raw = 0;
+        if (version >= 3) {
+            inode_id = read_varint(&r);
+            atime_raw = read_svarint(&r);
+            mtime_raw = read_svarint(&r);
+            if (r.bad) {
+                break;
+            }
+        } else {
+            if (length < sizeof(uint64_t) + sizeof(int64_t) * 2) {
+                break;
+            }
+            memcpy(&inode_id, p, sizeof(uint64_t));
+            memcpy(&atime_raw, p + sizeof(uint64_t), sizeof(int64_t));
+            memcpy(&mtime_raw, p + sizeof(uint64_t) + sizeof(int64_t), sizeof(int64_t));
+        }
+        struct appendfs_inode *inode = find_inode_by_id(ctx, inode_id);
+        if (!inode) {
+            break;
+        }
+        inode->atime_ns = record_time_ns(version, atime_raw);
+        inode->mtime_ns = record_time_ns(version, mtime_raw);
+        break;
+    }
+    case APPENDFS_RECORD_GROUP: {
+        /* The group was verified as a whole; inner records are applied in order. */
+        size_t offset = 0;
+        while (offset + RECORD_HEADER_SIZE <= length) {
+            const unsigned char *h = p + offset;
+            uint32_t inner_len = (uint32_t)h[4] | ((uint32_t)h[5] << 8) | ((uint32_t)h[6] << 16) | ((uint32_t)h[7] << 24);
+            if (!(h[0] & RECORD_FLAG_VERSIONED) || inner_len > length - offset - RECORD_HEADER_SIZE) {
+                break;
+            }
+            uint8_t inner_type = (uint8_t)(h[0] & ~RECORD_FLAG_VERSIONED);
+            if (h[1] <= RECORD_VERSION && inner_type != APPENDFS_RECORD_GROUP) {
+                apply_record(ctx, inner_type, h[1], h + RECORD_HEADER_SIZE, inner_len);
+            }
+            offset += RECORD_HEADER_SIZE + inner_len;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/*
+ * Replay runs as a pipeline over an mmap of $dir/meta (or a copy read in one
+ * pass when mmap is unavailable).  The main thread splits the log into
+ * batches of record boundaries, worker threads verify the checksums of
+ * submitted batches, and the main thread applies verified batches strictly in
+ * log order, validating a batch itself when no worker has claimed it yet.
+ */
+#define REPLAY_BATCH_RECORDS 4096
+#define REPLAY_MAX_WORKERS 8
+#define REPLAY_SLOTS (REPLAY_MAX_WORKERS * 2 + 2)
+#define REPLAY_TRACE_INTERVAL (8u * 1024 * 1024)
+
+enum replay_batch_state {
+    REPLAY_BATCH_FREE,
+    REPLAY_BATCH_SUBMITTED,
+    REPLAY_BATCH_CLAIMED,
+    REPLAY_BATCH_VERIFIED
+};
+
+struct replay_record {
+    const unsigned char *header;
+    const unsigned char *payload;
+    uint32_t length;
+    uint32_t checksum;
+    uint8_t type;
+    uint8_t version;
+    uint8_t valid;
+};
+
+struct replay_batch {
+    enum replay_batch_state state;
+    size_t count;
+    struct replay_record records[REPLAY_BATCH_RECORDS];
+};
+
+struct replay_pipeline {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int stop;
+    size_t submitted;
+    size_t head;
+    struct replay_batch *slots;
+};
+
+/* Records of a transaction whose commit has not been seen yet. */
+struct replay_txn {
+    int open;
+    int broken;
+    uint64_t id;
+    uint64_t max_id;
+    struct replay_record *held;
+    size_t count;
+    size_t capacity;
+};
+
+static int replay_txn_hold(struct replay_txn *txn, const struct replay_record *rec) {
+    if (txn->count == txn->capacity) {
+        size_t new_capacity = txn->capacity ? txn->capacity * 2 : 16;
+        struct replay_record *held = realloc(txn->held, new_capacity * sizeof(*held));
+        if (!held) {
+            return -1;
+        }
+        txn->held = held;
+        txn->capacity = new_capacity;
+    }
+    txn->held[txn->count++] = *rec;
+    return 0;
+}
+
+/*
+ * Apply one record in log order, holding transaction members back until
+ * their commit.  A transaction that is aborted, interrupted by another begin,
+ * or contains a record that failed verification is dropped.
+ */
+static int replay_apply(struct appendfs_context *ctx, struct replay_txn *txn, const struct replay_record *rec) {
+    if (!rec->valid) {
+        txn->broken |= txn->open;
+        return 0;
+    }
+    struct record_reader r = {rec->payload, rec->payload + rec->length, 0};
+    uint64_t id = 0;
+    switch (rec->type) {
+    case APPENDFS_RECORD_TXN_BEGIN:
+    case APPENDFS_RECORD_TXN_COMMIT:
+    case APPENDFS_RECORD_TXN_ABORT:
+        id = read_varint(&r);
+        if (r.bad) {
+            return 0;
+        }
+        if (id > txn->max_id) {
+            txn->max_id = id;
+        }
+        if (rec->type == APPENDFS_RECORD_TXN_BEGIN) {
+            txn->open = 1;
+            txn->broken = 0;
+            txn->id = id;
+            txn->count = 0;
+            return 0;
+        }
+        if (!txn->open || txn->id != id) {
+            return 0;
+        }
+        if (rec->type == APPENDFS_RECORD_TXN_COMMIT && !txn->broken) {
+            for (size_t i = 0; i < txn->count; ++i) {
+                const struct replay_record *held = &txn->held[i];
+                apply_record(ctx, held->type, held->version, held->payload, held->length);
+            }
+        }
+        txn->open = 0;
+        txn->count = 0;
+        return 0;
+    default:
+        break;
+    }
+    if (txn->open) {
+        return replay_txn_hold(txn, rec);
+    }
+    apply_record(ctx, rec->type, rec->version, rec->payload, rec->length);
+    return 0;
+}
+
+static void verify_batch(struct replay_batch *batch) {
+    for (size_t i = 0; i < batch->count; ++i) {
+        struct replay_record *rec = &batch->records[i];
+        uint32_t actual;
+        if (rec->version == 0) {
+            actual = appendfs_crc32(rec->payload, rec->length);
+        } else {
+            actual = appendfs_crc32c(rec->header, 8);
+            actual = appendfs_crc32c_update(actual, rec->payload, rec->length);
+        }
+        rec->valid = actual == rec->checksum && rec->version <= RECORD_VERSION;
+    }
+}
+
+/* Claim the oldest submitted batch; the caller holds pipe->lock. */
+static struct replay_batch *claim_batch(struct replay_pipeline *pipe) {
+    for (size_t seq = pipe->head; seq < pipe->submitted; ++seq) {
+        struct replay_batch *batch = &pipe->slots[seq % REPLAY_SLOTS];
+        if (batch->state == REPLAY_BATCH_SUBMITTED) {
+            batch->state = REPLAY_BATCH_CLAIMED;
+            return batch;
+        }
+    }
+    return NULL;
+}
+
+static void *replay_worker(void *arg) {
+    struct replay_pipeline *pipe = arg;
+    pthread_mutex_lock(&pipe->lock);
+    while (!pipe->stop) {
+        struct replay_batch *batch = claim_batch(pipe);
+        if (!batch) {
+            pthread_cond_wait(&pipe->cond, &pipe->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&pipe->lock);
+        verify_batch(batch);
+        pthread_mutex_lock(&pipe->lock);
+        batch->state = REPLAY_BATCH_VERIFIED;
+        pthread_cond_broadcast(&pipe->cond);
+    }
+    pthread_mutex_unlock(&pipe->lock);
+    return NULL;
+}
+
+/*
+ * Split records starting at *pos into batch.  Stops at the end of the log or
+ * at a truncated record, which ends replay as before.
+ */
+static int scan_batch(const unsigned char *map, size_t map_len, size_t *pos, struct replay_batch *batch) {
+    batch->count = 0;
+    while (batch->count < REPLAY_BATCH_RECORDS) {
+        size_t at = *pos;
+        if (map_len - at < RECORD_LEGACY_HEADER_SIZE) {
+            return 0;
+        }
+        const unsigned char *header = map + at;
+        uint8_t type = header[0];
+        uint8_t version = 0;
+        const unsigned char *fields = header + 1;
+        size_t header_len = RECORD_LEGACY_HEADER_SIZE;
+        if (type & RECORD_FLAG_VERSIONED) {
+            if (map_len - at < RECORD_HEADER_SIZE) {
+                return 0;
+            }
+            type &= (uint8_t)~RECORD_FLAG_VERSIONED;
+            version = header[1];
+            fields = header + 4;
+            header_len = RECORD_HEADER_SIZE;
+        }
+        uint32_t length = (uint32_t)fields[0] |
+                          ((uint32_t)fields[1] << 8) |
+                          ((uint32_t)fields[2] << 16) |
+                          ((uint32_t)fields[3] << 24);
+        if (map_len - at - header_len < length) {
+            return 0;
+        }
+        struct replay_record *rec = &batch->records[batch->count++];
+        rec->header = header;
+        rec->payload = header + header_len;
+        rec->length = length;
+        rec->checksum = (uint32_t)fields[4] |
+                        ((uint32_t)fields[5] << 8) |
+                        ((uint32_t)fields[6] << 16) |
+                        ((uint32_t)fields[7] << 24);
+        rec->type = type;
+        rec->version = version;
+        rec->valid = 0;
+        *pos = at + header_len + length;
+    }
+    return 1;
+}
+
+/* Bytes needed to hold the arena strings an inode still references. */
+static size_t inode_arena_bytes(struct appendfs_context *ctx, const struct appendfs_inode *inode) {
+    size_t total = 0;
+    if (appendfs_arena_owns(&ctx->strings, inode->cold->symlink_target)) {
+        total += strlen(inode->cold->symlink_target) + 1;
+    }
+    for (size_t x = 0; x < inode->cold->xattr_count; ++x) {
+        if (appendfs_arena_owns(&ctx->strings, inode->cold->xattrs[x].name)) {
+            total += strlen(inode->cold->xattrs[x].name) + 1;
+        }
+        if (appendfs_arena_owns(&ctx->strings, inode->cold->xattrs[x].value)) {
+            total += inode->cold->xattrs[x].size;
+        }
+    }
+    return total;
+}
+
+static void *move_to_block(struct appendfs_context *ctx, unsigned char **cursor, void *ptr, size_t size) {
+    if (!appendfs_arena_owns(&ctx->strings, ptr)) {
+        return ptr;
+    }
+    void *moved = *cursor;
+    memcpy(moved, ptr, size);
+    *cursor += size;
+    return moved;
+}
+
+/*
+ * Replay copies every symlink target and xattr into ctx->strings,
+ * including ones later superseded in the log.  Once the log is applied, move
+ * the live strings into a single exactly-sized block and drop the rest.  If
+ * that block cannot be allocated the replay arena is simply kept.
+ */
+static void compact_inode_strings(struct appendfs_context *ctx, struct appendfs_inode *inode, unsigned char **cursor) {
+    if (inode->cold->symlink_target) {
+        inode->cold->symlink_target = move_to_block(ctx, cursor, inode->cold->symlink_target, strlen(inode->cold->symlink_target) + 1);
+    }
+    for (size_t x = 0; x < inode->cold->xattr_count; ++x) {
+        struct appendfs_xattr *xattr = &inode->cold->xattrs[x];
+        xattr->name = move_to_block(ctx, cursor, xattr->name, strlen(xattr->name) + 1);
+        if (xattr->value) {
+            xattr->value = move_to_block(ctx, cursor, xattr->value, xattr->size);
+        }
+    }
+}
+
+static void compact_replay_strings(struct appendfs_context *ctx) {
+    size_t total = inode_arena_bytes(ctx, &ctx->root);
+    for (size_t i = 0; i < ctx->inode_count; ++i) {
+        total += inode_arena_bytes(ctx, ctx->inodes[i]);
+    }
+    if (total == ctx->strings.bytes_used && ctx->strings.blocks <= 1) {
+        return;
+    }
+    struct appendfs_arena live;
+    appendfs_arena_init(&live, total);
+    unsigned char *cursor = NULL;
+    if (total > 0) {
+        cursor = appendfs_arena_alloc(&live, total);
+        if (!cursor) {
+            return;
+        }
+    }
+    compact_inode_strings(ctx, &ctx->root, &cursor);
+    for (size_t i = 0; i < ctx->inode_count; ++i) {
+        compact_inode_strings(ctx, ctx->inodes[i], &cursor);
+    }
+    appendfs_arena_destroy(&ctx->strings);
+    ctx->strings = live;
+}
+
+static int replay_metadata(struct appendfs_context *ctx) {
+    struct stat st;
+    if (fstat(ctx->meta_fd, &st) == -1) {
+        return -1;
+    }
+    size_t map_len = (size_t)st.st_size;
+    ctx->meta_size = st.st_size;
+    if (map_len == 0) {
+        return lseek(ctx->meta_fd, 0, SEEK_END) == (off_t)-1 ? -1 : 0;
+    }
+    unsigned char *copy = NULL;
+    const unsigned char *map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, ctx->meta_fd, 0);
+    if (map == MAP_FAILED) {
+        copy = malloc(map_len);
+        if (!copy) {
+            return -1;
+        }
+        if (pread_all(ctx->meta_fd, copy, map_len, 0) == -1) {
+            free(copy);
+            return -1;
+        }
+        map = copy;
+    } else {
+        madvise((void *)map, map_len, MADV_SEQUENTIAL);
+    }
+
+    struct replay_pipeline pipe;
+    memset(&pipe, 0, sizeof(pipe));
+    pipe.slots = malloc(REPLAY_SLOTS * sizeof(*pipe.slots));
+    if (!pipe.slots) {
+        if (copy) {
+            free(copy);
+        } else {
+            munmap((void *)map, map_len);
+        }
+        return -1;
+    }
+    pthread_mutex_init(&pipe.lock, NULL);
+    pthread_cond_init(&pipe.cond, NULL);
+    for (size_t i = 0; i < REPLAY_SLOTS; ++i) {
+        pipe.slots[i].state = REPLAY_BATCH_FREE;
+    }
+
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t worker_count = online > 1 ? (size_t)online - 1 : 0;
+    if (worker_count > REPLAY_MAX_WORKERS) {
+        worker_count = REPLAY_MAX_WORKERS;
+    }
+    if (map_len < (size_t)REPLAY_BATCH_RECORDS * 64) {
+        worker_count = 0;
+    }
+    pthread_t workers[REPLAY_MAX_WORKERS];
+    size_t started = 0;
+    while (started < worker_count && pthread_create(&workers[started], NULL, replay_worker, &pipe) == 0) {
+        started++;
+    }
+
+    struct replay_txn txn;
+    memset(&txn, 0, sizeof(txn));
+    int rc = 0;
+    size_t pos = 0;
+    int more = 1;
+    uint64_t replay_start = appendfs_opstats_now();
+    uint64_t applied = 0;
+    size_t next_progress = REPLAY_TRACE_INTERVAL;
+    while (more || pipe.head < pipe.submitted) {
+        pthread_mutex_lock(&pipe.lock);
+        while (more && pipe.submitted - pipe.head < REPLAY_SLOTS) {
+            struct replay_batch *batch = &pipe.slots[pipe.submitted % REPLAY_SLOTS];
+            pthread_mutex_unlock(&pipe.lock);
+            more = scan_batch(map, map_len, &pos, batch);
+            pthread_mutex_lock(&pipe.lock);
+            batch->state = REPLAY_BATCH_SUBMITTED;
+            pipe.submitted++;
+            pthread_cond_broadcast(&pipe.cond);
+        }
+        struct replay_batch *batch = &pipe.slots[pipe.head % REPLAY_SLOTS];
+        while (batch->state != REPLAY_BATCH_VERIFIED) {
+            if (batch->state == REPLAY_BATCH_SUBMITTED) {
+                batch->state = REPLAY_BATCH_CLAIMED;
+                pthread_mutex_unlock(&pipe.lock);
+                verify_batch(batch);
+                pthread_mutex_lock(&pipe.lock);
+                batch->state = REPLAY_BATCH_VERIFIED;
+                break;
+            }
+            pthread_cond_wait(&pipe.cond, &pipe.lock);
+        }
+        pthread_mutex_unlock(&pipe.lock);
+
+        for (size_t i = 0; rc == 0 && i < batch->count; ++i) {
+            if (replay_apply(ctx, &txn, &batch->records[i]) == -1) {
+                rc = -1;
+                more = 0;
+            }
+        }
+        applied += batch->count;
+        if (pos >= next_progress) {
+            APPENDFS_TRACE(&ctx->trace, replay, APPENDFS_TRACE_REPLAY, 0, applied, pos, appendfs_opstats_now() - replay_start);
+            next_progress = pos + REPLAY_TRACE_INTERVAL;
+        }
+
+        pthread_mutex_lock(&pipe.lock);
+        batch->state = REPLAY_BATCH_FREE;
+        pipe.head++;
+        pthread_mutex_unlock(&pipe.lock);
+    }
+
+    pthread_mutex_lock(&pipe.lock);
+    pipe.stop = 1;
+    pthread_cond_broadcast(&pipe.cond);
+    pthread_mutex_unlock(&pipe.lock);
+    for (size_t i = 0; i < started; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+    pthread_cond_destroy(&pipe.cond);
+    pthread_mutex_destroy(&pipe.lock);
+    free(pipe.slots);
+    free(txn.held);
+    if (copy) {
+        free(copy);
+    } else {
+        munmap((void *)map, map_len);
+    }
+    if (rc == -1) {
+        return -1;
+    }
+    APPENDFS_TRACE(&ctx->trace, replay_done, APPENDFS_TRACE_REPLAY_DONE, 0, applied, map_len, appendfs_opstats_now() - replay_start);
+    compact_replay_strings(ctx);
+    recount_space(ctx);
+    /*
+     * Cut a torn trailing record off before appending: its length field
+     * would otherwise swallow the next records, including the abort below.
+     */
+    if (pos < map_len) {
+        if (ftruncate(ctx->meta_fd, (off_t)pos) == -1) {
+            return -1;
+        }
+        ctx->meta_size = (off_t)pos;
+    }
+    lseek(ctx->meta_fd, 0, SEEK_END);
+    if (txn.open) {
+        /* Close the interrupted transaction so later records are not held. */
+        ctx->txn_id = txn.id;
+        if (append_txn_record(ctx, APPENDFS_RECORD_TXN_ABORT) == -1) {
+            return -1;
+        }
+    }
+    ctx->txn_id = txn.max_id;
+    return 0;
+}
+
+static int append_create_record(struct appendfs_context *ctx, struct appendfs_inode *inode) {
+    size_t name_len = inode->name->len;
+    size_t target_len = 0;
+    if (S_ISLNK(inode->mode) && inode->cold->symlink_target) {
+        target_len = strlen(inode->cold->symlink_target);
+    }
+    unsigned char *payload = malloc(VARINT_MAX * 7 + name_len + target_len);
+    if (!payload) {
+        return -1;
+    }
+    unsigned char *p = payload;
+    p = put_varint(p, inode->inode_id);
+    p = put_varint(p, (uint32_t)inode->mode);
+    p = put_varint(p, (uint64_t)inode->size);
+    p = put_svarint(p, inode->mtime_ns);
+    p = put_varint(p, inode->parent->inode_id);
+    p = put_bytes(p, inode->name->str, name_len);
+    if (S_ISLNK(inode->mode) && inode->cold->symlink_target) {
+        p = put_bytes(p, inode->cold->symlink_target, target_len);
+    }
+    int rc = write_record(ctx, S_ISDIR(inode->mode) ? APPENDFS_RECORD_MKDIR : APPENDFS_RECORD_CREATE, payload, (uint32_t)(p - payload));
+    free(payload);
+    return rc;
+}
+
+/*
+ * Offsets are logged relative to the end of the inode's previous extent
+ * record, so sequential writes cost a byte each.  Replay tracks the same
+ * cursor; it only advances once the record is in the log.
+ */
+static unsigned char *put_extent(unsigned char *p, const struct appendfs_inode *inode, off_t logical, off_t data_offset, uint32_t length, off_t size, uint32_t checksum) {
+    p = put_varint(p, inode->inode_id);
+    p = put_svarint(p, logical - inode->cold->log_logical_end);
+    p = put_svarint(p, data_offset - inode->cold->log_data_end);
+    p = put_varint(p, length);
+    p = put_svarint(p, size - (logical + (off_t)length));
+    memcpy(p, &checksum, sizeof(uint32_t));
+    return p + sizeof(uint32_t);
+}
+
+static int queue_extent(struct appendfs_context *ctx, struct appendfs_inode *inode, off_t logical, off_t data_offset, uint32_t length, uint32_t stored_length, uint32_t checksum) {
+    if (ctx->pending_extent_count == ctx->pending_extent_capacity) {
+        size_t new_capacity = ctx->pending_extent_capacity ? ctx->pending_extent_capacity * 2 : 64;
+        struct pending_extent *pending = realloc(ctx->pending_extents, new_capacity * sizeof(*pending));
+        if (!pending) {
+            return -1;
+        }
+        ctx->pending_extents = pending;
+        ctx->pending_extent_capacity = new_capacity;
+    }
+    struct pending_extent *ext = &ctx->pending_extents[ctx->pending_extent_count++];
+    ext->inode = inode;
+    ext->logical = logical;
+    ext->data_offset = data_offset;
+    ext->size = inode->size;
+    ext->length = length;
+    ext->stored_length = stored_length;
+    ext->checksum = checksum;
+    return 0;
+}
+
+/*
+ * A compressed extent (stored_length below length) is logged as a
+ * COMPRESSED_EXTENTS record, whose entries add the stored length.  The data
+ * cursor advances by the stored length either way.
+ */
+static int append_extent_record(struct appendfs_context *ctx, struct appendfs_inode *inode, off_t logical, off_t data_offset, uint32_t length, uint32_t stored_length, uint32_t checksum) {
+    if (ctx->extent_batching) {
+        return queue_extent(ctx, inode, logical, data_offset, length, stored_length, checksum);
+    }
+    unsigned char payload[COMPRESSED_ENTRY_MAX];
+    unsigned char *p = put_extent(payload, inode, logical, data_offset, length, inode->size, checksum);
+    uint8_t type = APPENDFS_RECORD_EXTENT;
+    if (stored_length != length) {
+        p = put_varint(p, stored_length);
+        type = APPENDFS_RECORD_COMPRESSED_EXTENTS;
+    }
+    if (write_record(ctx, type, payload, (uint32_t)(p - payload)) == -1) {
+        return -1;
+    }
+    inode->cold->log_logical_end = logical + (off_t)length;
+    inode->cold->log_data_end = data_offset + (off_t)stored_length;
+    return 0;
+}
+
+/*
+ * Flushes of several buffers run between begin_extent_batch() and
+ * end_extent_batch(); their extents are logged as one EXTENT_BATCH record.
+ * The extents are already live in memory by then, so a failed write only
+ * rolls the cursors back to what the log holds.
+ */
+static void begin_extent_batch(struct appendfs_context *ctx) {
+    ctx->extent_batching = 1;
+    ctx->pending_extent_count = 0;
+}
+
+static int end_extent_batch(struct appendfs_context *ctx) {
+    size_t count = ctx->pending_extent_count;
+    ctx->extent_batching = 0;
+    ctx->pending_extent_count = 0;
+    if (count == 0) {
+        return 0;
+    }
+    struct pending_extent *pending = ctx->pending_extents;
+    if (count == 1) {
+        return append_extent_record(ctx, pending[0].inode, pending[0].logical, pending[0].data_offset, pending[0].length, pending[0].stored_length,
+                                    pending[0].checksum);
+    }
+    int compressed = 0;
+    for (size_t i = 0; i < count; ++i) {
+        compressed |= pending[i].stored_length != pending[i].length;
+    }
+    unsigned char *payload = malloc(count * COMPRESSED_ENTRY_MAX);
+    if (!payload) {
+        return -1;
+    }
+    unsigned char *p = payload;
+    for (size_t i = 0; i < count; ++i) {
+        struct appendfs_inode_cold *cold = pending[i].inode->cold;
+        pending[i].prev_logical_end = cold->log_logical_end;
+        pending[i].prev_data_end = cold->log_data_end;
+        p = put_extent(p, pending[i].inode, pending[i].logical, pending[i].data_offset, pending[i].length, pending[i].size, pending[i].checksum);
+        if (compressed) {
+            p = put_varint(p, pending[i].stored_length);
+        }
+        cold->log_logical_end = pending[i].logical + (off_t)pending[i].length;
+        cold->log_data_end = pending[i].data_offset + (off_t)pending[i].stored_length;
+    }
+    int rc = write_record(ctx, compressed ? APPENDFS_RECORD_COMPRESSED_EXTENTS : APPENDFS_RECORD_EXTENT_BATCH, payload, (uint32_t)(p - payload));
+    if (rc == -1) {
+        for (size_t i = count; i-- > 0;) {
+            pending[i].inode->cold->log_logical_end = pending[i].prev_logical_end;
+            pending[i].inode->cold->log_data_end = pending[i].prev_data_end;
+        }
+    }
+    free(payload);
+    return rc;
+}
+
+static int append_truncate_record(struct appendfs_context *ctx, struct appendfs_inode *inode) {
+    unsigned char payload[VARINT_MAX * 2];
+    unsigned char *p = put_varint(payload, inode->inode_id);
+    p = put_varint(p, (uint64_t)inode->size);
+    return write_record(ctx, APPENDFS_RECORD_TRUNCATE, payload, (uint32_t)(p - payload));
+}
+
+/* The whole inline content is logged on every change; replay keeps the last. */
+static int append_inline_record(struct appendfs_context *ctx, struct appendfs_inode *inode) {
+    unsigned char payload[VARINT_MAX * 3 + INLINE_DATA_MAX];
+    unsigned char *p = put_varint(payload, inode->inode_id);
+    p = put_varint(p, (uint64_t)inode->size);
+    p = put_bytes(p, inode->cold->inline_data, inode->cold->inline_size);
+    return write_record(ctx, APPENDFS_RECORD_INLINE_DATA, payload, (uint32_t)(p - payload));
+}
+
+static int append_unlink_record(struct appendfs_context *ctx, struct appendfs_inode *inode) {
+    unsigned char payload[VARINT_MAX];
+    unsigned char *p = put_varint(payload, inode->inode_id);
+    return write_record(ctx, APPENDFS_RECORD_UNLINK, payload, (uint32_t)(p - payload));
+}
+
+static int append_rename_record(struct appendfs_context *ctx, struct appendfs_inode *inode, struct appendfs_inode *parent, const char *name, size_t name_len) {
+    unsigned char *payload = malloc(VARINT_MAX * 3 + name_len);
+    if (!payload) {
+        return -1;
+    }
+    unsigned char *p = put_varint(payload, inode->inode_id);
+    p = put_varint(p, parent->inode_id);
+    p = put_bytes(p, name, name_len);
+    int rc = write_record(ctx, APPENDFS_RECORD_RENAME, payload, (uint32_t)(p - payload));
+    free(payload);
+    return rc;
+}
+
+static int append_setxattr_record(struct appendfs_context *ctx, struct appendfs_inode *inode, const char *name, const void *value, size_t size) {
+    size_t name_len = strlen(name);
+    unsigned char *payload = malloc(VARINT_MAX * 3 + name_len + size);
+    if (!payload) {
+        return -1;
+    }
+    unsigned char *p = put_varint(payload, inode->inode_id);
+    p = put_varint(p, name_len);
+    p = put_varint(p, size);
+    memcpy(p, name, name_len);
+    p += name_len;
+    if (size > 0) {
+        memcpy(p, value, size);
+        p += size;
+    }
+    int rc = write_record(ctx, APPENDFS_RECORD_SETXATTR, payload, (uint32_t)(p - payload));
+    free(payload);
+    return rc;
+}
+
+static int append_removexattr_record(struct appendfs_context *ctx, struct appendfs_inode *inode, const char *name) {
+    size_t name_len = strlen(name);
+    unsigned char *payload = malloc(VARINT_MAX * 2 + name_len);
+    if (!payload) {
+        return -1;
+    }
+    unsigned char *p = put_varint(payload, inode->inode_id);
+    p = put_bytes(p, name, name_len);
+    int rc = write_record(ctx, APPENDFS_RECORD_REMOVEXATTR, payload, (uint32_t)(p - payload));
+    free(payload);
+    return rc;
+}
+
+static int append_times_record(struct appendfs_context *ctx, struct appendfs_inode *inode) {
+    unsigned char payload[VARINT_MAX * 3];
+    unsigned char *p = put_varint(payload, inode->inode_id);
+    p = put_svarint(p, inode->atime_ns);
+    p = put_svarint(p, inode->mtime_ns);
+    return write_record(ctx, APPENDFS_RECORD_TIMES, payload, (uint32_t)(p - payload));
+}
+
+int appendfs_open(const char *root_path, struct appendfs_context **out_ctx) {
+    if (!root_path || !out_ctx) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct appendfs_context *ctx = calloc(1, sizeof(*ctx));
+    if (!ctx) {
+        return -1;
+    }
+    pthread_mutex_init(&ctx->lock, NULL);
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&ctx->flusher_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    ctx->data_fd = -1;
+    ctx->meta_fd = -1;
+    ctx->flush_interval_ms = APPENDFS_DEFAULT_FLUSH_INTERVAL_MS;
+    ctx->dirty_age_ms = APPENDFS_DEFAULT_DIRTY_AGE_MS;
+    ctx->write_buffer_size = APPENDFS_DEFAULT_BUFFER;
+    ctx->min_write_buffer_size = APPENDFS_MIN_BUFFER;
+    ctx->max_write_buffer_size = APPENDFS_MAX_BUFFER;
+    ctx->buffer_idle_ms = APPENDFS_DEFAULT_BUFFER_IDLE_MS;
+    appendfs_bufpool_init(&ctx->buffer_pool, APPENDFS_DEFAULT_POOL_LIMIT);
+    appendfs_blockcache_init(&ctx->read_cache, APPENDFS_DEFAULT_READ_CACHE);
+    ctx->inflate_offset = -1;
+    appendfs_arena_init(&ctx->strings, 64 * 1024);
+    appendfs_names_init(&ctx->names);
+    ctx->root.cold = &ctx->root_cold;
+    ctx->next_inode_id = 1;
+    ctx->next_synthetic_id = UINT64_MAX;
+    ctx->root_path = realpath(root_path, NULL);
+    if (!ctx->root_path) {
+        if (errno == ENOENT) {
+            if (ensure_directory(root_path) == -1) {
+                free(ctx);
+                return -1;
+            }
+            ctx->root_path = realpath(root_path, NULL);
+            if (!ctx->root_path) {
+                free(ctx);
+                return -1;
+            }
+        } else {
+            free(ctx);
+            return -1;
+        }
+    }
+
+    ctx->dir_buckets = calloc(INDEX_INITIAL_BUCKETS, sizeof(*ctx->dir_buckets));
+    ctx->id_buckets = calloc(INDEX_INITIAL_BUCKETS, sizeof(*ctx->id_buckets));
+    if (!ctx->dir_buckets || !ctx->id_buckets || appendfs_opstats_init(&ctx->opstats) == -1 ||
+        appendfs_trace_init(&ctx->trace) == -1) {
+        appendfs_close(ctx);
+        return -1;
+    }
+    ctx->dir_bucket_count = INDEX_INITIAL_BUCKETS;
+    ctx->id_bucket_count = INDEX_INITIAL_BUCKETS;
+    ctx->root.mode = S_IFDIR | 0755;
+    ctx->root.ctime_ns = ctx->root.mtime_ns = ctx->root.atime_ns = clock_now_ns();
+    index_inode_id(ctx, &ctx->root);
+
+    char data_path[PATH_MAX];
+    char meta_path[PATH_MAX];
+    snprintf(data_path, sizeof(data_path), "%s/%s", ctx->root_path, DATA_FILENAME);
+    snprintf(meta_path, sizeof(meta_path), "%s/%s", ctx->root_path, META_FILENAME);
+
+    ctx->data_fd = open(data_path, O_RDWR | O_CREAT | O_BINARY, 0644);
+    if (ctx->data_fd == -1) {
+        appendfs_close(ctx);
+        return -1;
+    }
+    ctx->meta_fd = open(meta_path, O_RDWR | O_CREAT | O_BINARY, 0644);
+    if (ctx->meta_fd == -1) {
+        appendfs_close(ctx);
+        return -1;
+    }
+    if (replay_metadata(ctx) == -1) {
+        appendfs_close(ctx);
+        return -1;
+    }
+    ctx->stage_offset = lseek(ctx->data_fd, 0, SEEK_END);
+    if (ctx->stage_offset == (off_t)-1) {
+        appendfs_close(ctx);
+        return -1;
+    }
+
+    *out_ctx = ctx;
+    return 0;
+}
+
+void appendfs_close(struct appendfs_context *ctx) {
+    if (!ctx) {
+        return;
+    }
+    stop_flusher(ctx);
+    begin_extent_batch(ctx);
+    for (struct appendfs_file *file = ctx->lru_head; file; file = file->lru_next) {
+        flush_buffer(file);
+    }
+    end_extent_batch(ctx);
+    if (ctx->data_fd != -1 && ctx->meta_fd != -1) {
+        commit_stage(ctx);
+    }
+    free(ctx->stage);
+    free(ctx->compress_buf);
+    free(ctx->inflate_buf);
+    free(ctx->meta_pending);
+    free(ctx->group);
+    free(ctx->pending_extents);
+    free(ctx->shade_points);
+    free(ctx->shade_next);
+    if (ctx->data_fd != -1) {
+        close(ctx->data_fd);
+    }
+    if (ctx->meta_fd != -1) {
+        close(ctx->meta_fd);
+    }
+    for (size_t i = 0; i < ctx->inode_count; ++i) {
+        free_inode(ctx, ctx->inodes[i]);
+    }
+    free_inode(ctx, &ctx->root);
+    for (size_t i = 0; i < ctx->inode_slab_count; ++i) {
+        free(ctx->inode_slabs[i]);
+    }
+    free(ctx->inodes);
+    free(ctx->dir_buckets);
+    free(ctx->id_buckets);
+    appendfs_names_destroy(&ctx->names);
+    appendfs_arena_destroy(&ctx->strings);
+    appendfs_bufpool_destroy(&ctx->buffer_pool);
+    appendfs_blockcache_destroy(&ctx->read_cache);
+    appendfs_opstats_destroy(&ctx->opstats);
+    appendfs_trace_destroy(&ctx->trace);
+    pthread_cond_destroy(&ctx->flusher_cond);
+    pthread_mutex_destroy(&ctx->lock);
+    free(ctx->root_path);
+    free(ctx);
+}
+
+static int set_options_locked(struct appendfs_context *ctx, const struct appendfs_options *opts) {
+    if (!ctx || !opts) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (opts->write_buffer_size != 0 && opts->write_buffer_size < APPENDFS_MIN_FLUSH) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (opts->buffer_pool_limit != 0 && opts->buffer_pool_limit < APPENDFS_MIN_FLUSH) {
+        errno = EINVAL;
+        return -1;
+    }
+    size_t min_size = opts->min_write_buffer_size ? opts->min_write_buffer_size : ctx->min_write_buffer_size;
+    size_t max_size = opts->max_write_buffer_size ? opts->max_write_buffer_size : ctx->max_write_buffer_size;
+    if (min_size < APPENDFS_MIN_FLUSH || max_size < min_size) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (opts->write_buffer_size != 0) {
+        ctx->write_buffer_size = opts->write_buffer_size;
+    }
+    if (opts->buffer_pool_limit != 0) {
+        appendfs_bufpool_set_limit(&ctx->buffer_pool, opts->buffer_pool_limit);
+    }
+    if (opts->read_cache_size != 0) {
+        appendfs_blockcache_set_budget(&ctx->read_cache, opts->read_cache_size);
+    }
+    ctx->min_write_buffer_size = min_size;
+    ctx->max_write_buffer_size = max_size;
+    if (opts->buffer_idle_ms != 0) {
+        ctx->buffer_idle_ms = opts->buffer_idle_ms;
+    }
+    if (opts->flush_interval_ms != 0) {
+        ctx->flush_interval_ms = opts->flush_interval_ms;
+    }
+    if (opts->dirty_age_ms != 0) {
+        ctx->dirty_age_ms = opts->dirty_age_ms;
+    }
+    if (opts->dirty_high_watermark != 0) {
+        ctx->dirty_high_watermark = opts->dirty_high_watermark;
+    }
+    ctx->flags = opts->flags;
+    return 0;
+}
+
+int appendfs_set_options(struct appendfs_context *ctx, const struct appendfs_options *opts) {
+    if (!ctx) {
+        errno = EINVAL;
+        return -1;
+    }
+    lock_context(ctx);
+    int rc = set_options_locked(ctx, opts);
+    unlock_context(ctx);
+    return rc;
+}
+
+static int get_options_locked(struct appendfs_context *ctx, struct appendfs_options *opts) {
+    if (!opts) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(opts, 0, sizeof(*opts));
+    opts->write_buffer_size = ctx->write_buffer_size;
+    opts->buffer_pool_limit = ctx->buffer_pool.limit;
+    opts->read_cache_size = ctx->read_cache.budget;
+    opts->min_write_buffer_size = ctx->min_write_buffer_size;
+    opts->max_write_buffer_size = ctx->max_write_buffer_size;
+    opts->buffer_idle_ms = ctx->buffer_idle_ms;
+    opts->flush_interval_ms = ctx->flush_interval_ms;
+    opts->dirty_age_ms = ctx->dirty_age_ms;
+    opts->dirty_high_watermark = dirty_high_watermark(ctx);
+    opts->flags = ctx->flags;
+    return 0;
+}
+
+int appendfs_get_options(struct appendfs_context *ctx, struct appendfs_options *opts) {
+    if (!ctx) {
+        errno = EINVAL;
+        return -1;
+    }
+    lock_context(ctx);
+    int rc = get_options_locked(ctx, opts);
+    unlock_context(ctx);
+    return rc;
+}
+
+static int get_buffer_stats_locked(struct appendfs_context *ctx, struct appendfs_buffer_stats *stats) {
+    if (!ctx || !stats) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(stats, 0, sizeof(*stats));
+    stats->pool_limit = ctx->buffer_pool.limit;
+    stats->bytes_in_use = ctx->buffer_pool.in_use;
+    stats->bytes_cached = ctx->buffer_pool.cached;
+    stats->bytes_dirty = ctx->dirty_bytes;
+    stats->buffers_in_use = ctx->buffer_count;
+    stats->grows = ctx->buffer_grows;
+    stats->shrinks = ctx->buffer_shrinks;
+    stats->spills = ctx->buffer_spills;
+    stats->writeback_batches = ctx->writeback_batches;
+    stats->writeback_files = ctx->writeback_files;
+    stats->stage_commits = ctx->stage_commits;
+    return 0;
+}
+
+int appendfs_get_buffer_stats(struct appendfs_context *ctx, struct appendfs_buffer_stats *stats) {
+    if (!ctx) {
+        errno = EINVAL;
+        return -1;
+    }
+    lock_context(ctx);
+    int rc = get_buffer_stats_locked(ctx, stats);
+    unlock_context(ctx);
+    return rc;
+}
+
+static size_t inode_heap_string_bytes(struct appendfs_context *ctx, const struct appendfs_inode *inode) {
+    size_t total = 0;
+    if (inode->cold->symlink_target && !appendfs_arena_owns(&ctx->strings, inode->cold->symlink_target)) {
+        total += strlen(inode->cold->symlink_target) + 1;
+    }
+    for (size_t x = 0; x < inode->cold->xattr_count; ++x) {
+        const struct appendfs_xattr *xattr = &inode->cold->xattrs[x];
+        if (!appendfs_arena_owns(&ctx->strings, xattr->name)) {
+            total += strlen(xattr->name) + 1;
+        }
+        if (xattr->value && !appendfs_arena_owns(&ctx->strings, xattr->value)) {
+            total += xattr->size;
+        }
+    }
+    return total;
+}
+
+static int get_memory_stats_locked(struct appendfs_context *ctx, struct appendfs_memory_stats *stats) {
+    if (!ctx || !stats) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(stats, 0, sizeof(*stats));
+    stats->inodes = ctx->inode_count;
+    stats->inode_hot_size = sizeof(struct appendfs_inode);
+    stats->inode_cold_size = sizeof(struct appendfs_inode_cold);
+    stats->inode_table_bytes = ctx->inode_capacity * (sizeof(struct appendfs_inode) + sizeof(struct appendfs_inode_cold) + sizeof(struct appendfs_inode *));
+    stats->string_bytes = ctx->strings.bytes_used + inode_heap_string_bytes(ctx, &ctx->root);
+    stats->xattr_bytes = ctx->root.cold->xattr_capacity * sizeof(struct appendfs_xattr);
+    for (size_t i = 0; i < ctx->inode_count; ++i) {
+        const struct appendfs_inode *inode = ctx->inodes[i];
+        stats->extent_bytes += inode->cold->extent_capacity * sizeof(struct appendfs_extent);
+        stats->xattr_bytes += inode->cold->xattr_capacity * sizeof(struct appendfs_xattr);
+        stats->string_bytes += inode_heap_string_bytes(ctx, inode);
+        stats->inline_bytes += inode->cold->inline_size;
+    }
+    stats->name_bytes = ctx->names.bytes + ctx->names.count * sizeof(struct appendfs_name) + ctx->names.bucket_count * sizeof(struct appendfs_name *);
+    stats->index_bytes = (ctx->dir_bucket_count + ctx->id_bucket_count) * sizeof(struct appendfs_inode *);
+    return 0;
+}
+
+int appendfs_get_memory_stats(struct appendfs_context *ctx, struct appendfs_memory_stats *stats) {
+    if (!ctx) {
+        errno = EINVAL;
+        return -1;
+    }
+    lock_context(ctx);
+    int rc = get_memory_stats_locked(ctx, stats);
+    unlock_context(ctx);
+    return rc;
+}
+
+static int get_space_stats_locked(struct appendfs_context *ctx, struct appendfs_space_stats *stats) {
+    if (!ctx || !stats) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(stats, 0, sizeof(*stats));
+    settle_space(ctx);
+    stats->data_bytes = (uint64_t)ctx->stage_offset + ctx->stage_used;
+    stats->meta_bytes = (uint64_t)ctx->meta_size + ctx->meta_pending_used;
+    stats->live_bytes = ctx->live_bytes;
+    stats->dead_bytes = stats->data_bytes > ctx->live_bytes ? stats->data_bytes - ctx->live_bytes : 0;
+    stats->compress_in_bytes = ctx->compress_in_bytes;
+    stats->compress_out_bytes = ctx->compress_out_bytes;
+    stats->compress_skipped_bytes = ctx->compress_skipped_bytes;
+    return 0;
+}
+
+int appendfs_get_space_stats(struct appendfs_context *ctx, struct appendfs_space_stats *stats) {
+    if (!ctx) {
+        errno = EINVAL;
+        return -1;
+    }
+    lock_context(ctx);
+    int rc = get_space_stats_locked(ctx, stats);
+    unlock_context(ctx);
+    return rc;
+}
+
+static int get_cache_stats_locked(struct appendfs_context *ctx, struct appendfs_cache_stats *stats) {
+    if (!ctx || !stats) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(stats, 0, sizeof(*stats));
+    stats->budget = ctx->read_cache.budget;
+    stats->bytes_cached = ctx->read_cache.count * (size_t)APPENDFS_BLOCKCACHE_BLOCK;
+    stats->hits = ctx->read_cache.hits;
+    stats->misses = ctx->read_cache.misses;
+    stats->evictions = ctx->read_cache.evictions;
+    stats->readahead_calls = ctx->readahead_calls;
+    stats->readahead_bytes = ctx->readahead_bytes;
+    return 0;
+}
+
+int appendfs_get_cache_stats(struct appendfs_context *ctx, struct appendfs_cache_stats *stats) {
+    if (!ctx) {
+        errno = EINVAL;
+        return -1;
+    }
+    lock_context(ctx);
+    int rc = get_cache_stats_locked(ctx, stats);
+    unlock_context(ctx);
+    return rc;
+}
+
+const char *appendfs_op_name(enum appendfs_op op) {
+    return appendfs_opstats_name(op);
+}
+
+/* Operation statistics are lock-free and read without the context lock. */
+int appendfs_get_op_stats(struct appendfs_context *ctx, struct appendfs_op_stats stats[APPENDFS_OP_COUNT]) {
+    if (!ctx || !stats) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (int op = 0; op < APPENDFS_OP_COUNT; ++op) {
+        appendfs_opstats_collect(&ctx->opstats, (enum appendfs_op)op, &stats[op]);
+    }
+    return 0;
+}
+
+ssize_t appendfs_format_op_stats(struct appendfs_context *ctx, char *buf, size_t size) {
+    if (!ctx || (!buf && size > 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+    size_t used = 0;
+    for (int op = 0; op < APPENDFS_OP_COUNT; ++op) {
+        struct appendfs_op_stats st;
+        appendfs_opstats_collect(&ctx->opstats, (enum appendfs_op)op, &st);
+        if (st.count == 0) {
+            continue;
+        }
+        char line[320];
+        int len = snprintf(line, sizeof(line),
+                           "op=%s count=%llu errors=%llu bytes=%llu total_us=%llu avg_us=%.1f p50_us=%.1f p90_us=%.1f p99_us=%.1f p999_us=%.1f max_us=%.1f\n",
+                           appendfs_opstats_name((enum appendfs_op)op), (unsigned long long)st.count, (unsigned long long)st.errors,
+                           (unsigned long long)st.bytes, (unsigned long long)(st.total_ns / 1000), (double)st.total_ns / (double)st.count / 1e3,
+                           (double)st.p50_ns / 1e3, (double)st.p90_ns / 1e3, (double)st.p99_ns / 1e3, (double)st.p999_ns / 1e3,
+                           (double)st.max_ns / 1e3);
+        if (len < 0) {
+            return -1;
+        }
+        if (size > 0) {
+            if (used + (size_t)len > size) {
+                errno = ERANGE;
+                return -1;
+            }
+            memcpy(buf + used, line, (size_t)len);
+        }
+        used += (size_t)len;
+    }
+    return (ssize_t)used;
+}
+
+ssize_t appendfs_format_trace(struct appendfs_context *ctx, char *buf, size_t size) {
+    if (!ctx || (!buf && size > 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+    return appendfs_trace_format(&ctx->trace, buf, size);
+}
+
+/*
+ * New inodes carry their parent and name from the start so the create record
+ * can be built, but are only indexed by publish_inode once it is logged.
+ */
+static struct appendfs_inode *create_inode(struct appendfs_context *ctx, struct appendfs_inode *parent, const char *name, size_t name_len, mode_t mode) {
+    if (ensure_inode_capacity(ctx) == -1) {
+        return NULL;
+    }
+    const struct appendfs_name *interned = appendfs_names_intern(&ctx->names, name, name_len);
+    if (!interned) {
+        return NULL;
+    }
+    struct appendfs_inode *inode = take_inode_slot(ctx);
+    inode->inode_id = ctx->next_inode_id++;
+    inode->parent = parent;
+    inode->name = interned;
+    inode->mode = mode;
+    inode->ctime_ns = inode->mtime_ns = inode->atime_ns = clock_now_ns();
+    inode->size = 0;
+    inode->deleted = 0;
+    return inode;
+}
+
+static void discard_inode(struct appendfs_context *ctx, struct appendfs_inode *inode) {
+    free_inode(ctx, inode);
+    clear_inode(inode);
+    ctx->inode_count--;
+}
+
+static void publish_inode(struct appendfs_context *ctx, struct appendfs_inode *inode) {
+    index_inode_id(ctx, inode);
+    attach_inode(ctx, inode);
+}
+
+static int create_file_locked(struct appendfs_context *ctx, const char *path, mode_t mode) {
+    if (!ctx || !path) {
+        errno = EINVAL;
+        return -1;
+    }
+    const char *name = NULL;
+    size_t name_len = 0;
+    struct appendfs_inode *parent = find_parent(ctx, path, &name, &name_len);
+    if (!parent) {
+        return -1;
+    }
+    if (lookup_child(ctx, parent, name, name_len)) {
+        errno = EEXIST;
+        return -1;
+    }
+    struct appendfs_inode *inode = create_inode(ctx, parent, name, name_len, S_IFREG | mode);
+    if (!inode) {
+        return -1;
+    }
+    if (append_create_record(ctx, inode) == -1) {
+        discard_inode(ctx, inode);
+        return -1;
+    }
+    publish_inode(ctx, inode);
+    return 0;
+}
+
+int appendfs_create_file(struct appendfs_context *ctx, const char *path, mode_t mode) {
+    if (!ctx) {
+        errno = EINVAL;
+        return -1;
+    }
+    uint64_t start = appendfs_opstats_now();
+    lock_context(ctx);
+    int rc = create_file_locked(ctx, path, mode);
+    unlock_context(ctx);
+    appendfs_opstats_record(&ctx->opstats, APPENDFS_OP_CREATE_FILE, start, rc == -1, 0);
+    return rc;
+}
+
+static int symlink_locked(struct appendfs_context *ctx, const char *target, const char *linkpath, mode_t mode) {
+    (void)mode;
+    if (!ctx || !target || !linkpath) {
+        errno = EINVAL;
+        return -1;
+    }
+    const char *name = NULL;
+    size_t name_len = 0;
+    struct appendfs_inode *parent = find_parent(ctx, linkpath, &name, &name_len);
+    if (!parent) {
+        return -1;
+    }
+    if (lookup_child(ctx, parent, name, name_len)) {
+        errno = EEXIST;
+        return -1;
+    }
+    struct appendfs_inode *inode = create_inode(ctx, parent, name, name_len, S_IFLNK | 0777);
+    if (!inode) {
+        return -1;
+    }
+    inode->cold->symlink_target = strdup(target);
+    if (!inode->cold->symlink_target) {
+        discard_inode(ctx, inode);
+        return -1;
+    }
+    inode->size = (off_t)strlen(target);
+    if (append_create_record(ctx, inode) == -1) {
+        discard_inode(ctx, inode);
+        return -1;
+    }
+    publish_inode(ctx, inode);
+    return 0;
+}
+
+int appendfs_symlink(struct appendfs_context *ctx, const char *target, const char *linkpath, mode_t mode) {
+    if (!ctx) {
+        errno = EINVAL;
+        return -1;
+    }
+    uint64_t start = appendfs_opstats_now();
+    lock_context(ctx);
+    int rc = symlink_locked(ctx, target, linkpath, mode);
+    unlock_context(ctx);
+    appendfs_opstats_record(&ctx->opstats, APPENDFS_OP_SYMLINK, start, rc == -1, 0);
+    return rc;
+}
+
+static ssize_t readlink_locked(struct appendfs_context *ctx, const char *path, char *buf, size_t size) {
+    if (!ctx || !path || !buf) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct appendfs_inode *inode = find_inode_by_path(ctx, path);
+    if (!inode || inode->deleted) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (!S_ISLNK(inode->mode)) {
+        errno = EINVAL;
+        return -1;
+    }
+    size_t target_len = inode->cold->symlink_target ? strlen(inode->cold->symlink_target) : 0;
+    if (size == 0) {
+        return (ssize_t)target_len;
+    }
+    size_t copy_len = target_len < size - 1 ? target_len : size - 1;
+    if (size == 1) {
+        buf[0] = '\0';
+        return (ssize_t)target_len;
+    }
+    if (inode->cold->symlink_target) {
+        memcpy(buf, inode->cold->symlink_target, copy_len);
+    }
+    buf[copy_len] = '\0';
+    touch_atime(ctx, inode);
+    return (ssize_t)target_len;
+}
+
+ssize_t appendfs_readlink(struct appendfs_context *ctx, const char *path, char *buf, size_t size) {
+    if (!ctx) {
+        errno = EINVAL;
+        return -1;
+    }
+    uint64_t start = appendfs_opstats_now();
+    lock_context(ctx);
+    ssize_t rc = readlink_locked(ctx, path, buf, size);
+    unlock_context(ctx);
+    appendfs_opstats_record(&ctx->opstats, APPENDFS_OP_READLINK, start, rc < 0, rc > 0 ? (uint64_t)rc : 0);
+    return rc;
+}
+
+static int mkdirs_locked(struct appendfs_context *ctx, const char *path, mode_t mode) {
+    if (!ctx || !path) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct appendfs_inode *node = &ctx->root;
+    size_t len = strlen(path);
+    size_t i = 0;
+    int in_txn = 0;
+    int rc = 0;
+    while (rc == 0 && i < len) {
+        while (i < len && path[i] == '/') {
+            i++;
+        }
+        size_t start = i;
+        while (i < len && path[i] != '/') {
+            i++;
+        }
+        if (i == start) {
+            continue;
+        }
+        struct appendfs_inode *child = lookup_child(ctx, node, path + start, i - start);
+        if (!child) {
+            /* Missing parents are logged as one transaction and written together. */
+            if (!in_txn && txn_begin(ctx) == -1) {
+                return -1;
+            }
+            in_txn = 1;
+            child = create_inode(ctx, node, path + start, i - start, S_IFDIR | mode);
+            if (!child) {
+                rc = -1;
+                break;
+            }
+            if (append_create_record(ctx, child) == -1) {
+                discard_inode(ctx, child);
+                rc = -1;
+                break;
+            }
+            publish_inode(ctx, child);
+        } else if (!S_ISDIR(child->mode)) {
+            if (i < len) {
+                errno = ENOTDIR;
+                rc = -1;
+            }
+            break;
+        }
+        node = child;
+    }
+    /*
+     * Directories already created stay, so their records are committed.  If
+     * that write fails they stay queued and the error is reported.
+     */
+    if (in_txn) {
+        int saved_errno = errno;
+        if (txn_commit(ctx) == -1) {
+            return -1;
+        }
+        errno = saved_errno;
+    }
+    return rc;
+}
+
+int appendfs_mkdirs(struct appendfs_context *ctx, const char *path, mode_t mode) {
+    if (!ctx) {
+        errno = EINVAL;
+        return -1;
+    }
+    uint64_t start = appendfs_opstats_now();
+    lock_context(ctx);
+    int rc = mkdirs_locked(ctx, path, mode);
+    unlock_context(ctx);
+    appendfs_opstats_record(&ctx->opstats, APPENDFS_OP_MKDIRS, start, rc == -1, 0);
+    return rc;
+}
+
+static int mkdir_locked(struct appendfs_context *ctx, const char *path, mode_t mode) {
+    if (!ctx || !path || path[0] == '\0') {
+        errno = EINVAL;
+        return -1;
+    }
+    const char *name = NULL;
+    size_t name_len = 0;
+    struct appendfs_inode *parent = find_parent(ctx, path, &name, &name_len);
+    if (!parent) {
+        return -1;
+    }
+    if (lookup_child(ctx, parent, name, name_len)) {
+        errno = EEXIST;
+        return -1;
+    }
+    struct appendfs_inode *inode = create_inode(ctx, parent, name, name_len, S_IFDIR | (mode & 0777));
+    if (!inode) {
+        return -1;
+    }
+    if (append_create_record(ctx, inode) == -1) {
+        discard_inode(ctx, inode);
+        return -1;
+    }
+    publish_inode(ctx, inode);
+    return 0;
+}
+
+int appendfs_mkdir(struct appendfs_context *ctx, const char *path, mode_t mode) {
+    if (!ctx) {
+        errno = EINVAL;
+        return -1;
+    }
+    uint64_t start = appendfs_opstats_now();
+    lock_context(ctx);
+    int rc = mkdir_locked(ctx, path, mode);
+    unlock_context(ctx);
+    appendfs_opstats_record(&ctx->opstats, APPENDFS_OP_MKDIR, start, rc == -1, 0);
+    return rc;
+}
+
+static int unlink_locked(struct appendfs_context *ctx, const char *path) {
+    if (!ctx || !path) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct appendfs_inode *inode = find_inode_by_path(ctx, path);
+    if (!inode) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (S_ISDIR(inode->mode)) {
+        errno = EISDIR;
+        return -1;
+    }
+    if (append_unlink_record(ctx, inode) == -1) {
+        return -1;
+    }
+    detach_inode(ctx, inode);
+    delete_inode(ctx, inode);
+    return 0;
+}
+
+int appendfs_unlink(struct appendfs_context *ctx, const char *path) {
+    if (!ctx) {
+        errno = EINVAL;
+        return -1;
+    }
+    uint64_t start = appendfs_opstats_now();
+    lock_context(ctx);
+    int rc = unlink_locked(ctx, path);
+    unlock_context(ctx);
+    appendfs_opstats_record(&ctx->opstats, APPENDFS_OP_UNLINK, start, rc == -1, 0);
+    return rc;
+}
+
+static int rmdir_locked(struct appendfs_context *ctx, const char *path) {
+    if (!ctx || !path) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct appendfs_inode *inode = find_inode_by_path(ctx, path);
+    if (!inode) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (inode == &ctx->root) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!S_ISDIR(inode->mode)) {
+        errno = ENOTDIR;
+        return -1;
+    }
+    if (inode->first_child) {
+        errno = ENOTEMPTY;
+        return -1;
+    }
+    if (append_unlink_record(ctx, inode) == -1) {
+        return -1;
+    }
+    detach_inode(ctx, inode);
+    delete_inode(ctx, inode);
+    inode->mtime_ns = clock_now_ns();
+    return 0;
+}
+
+int appendfs_rmdir(struct appendfs_context *ctx, const char *path) {
+    if (!ctx) {
+        errno = EINVAL;
+        return -1;
+    }
+    uint64_t start = appendfs_opstats_now();
+    lock_context(ctx);
+    int rc = rmdir_locked(ctx, path);
+    unlock_context(ctx);
+    appendfs_opstats_record(&ctx->opstats, APPENDFS_OP_RMDIR, start, rc == -1, 0);
+    return rc;
+}
+
+/*
+ * Descendants hang off the renamed inode by parent pointer, so moving a
+ * directory is a single RENAME record however large the subtree is.
+ */
+static int rename_locked(struct appendfs_context *ctx, const char *from_path, const char *to_path) {
+    if (!ctx || !from_path || !to_path) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct appendfs_inode *inode = find_inode_by_path(ctx, from_path);
+    if (!inode) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (inode == &ctx->root) {
+        errno = EINVAL;
+        return -1;
+    }
+    const char *name = NULL;
+    size_t name_len = 0;
+    struct appendfs_inode *parent = find_parent(ctx, to_path, &name, &name_len);
+    if (!parent) {
+        return -1;
+    }
+    struct appendfs_inode *dest = lookup_child(ctx, parent, name, name_len);
+    if (dest == inode) {
+        return 0;
+    }
+    if (S_ISDIR(inode->mode) && is_ancestor(inode, parent)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (dest) {
+        if (S_ISDIR(inode->mode)) {
+            if (!S_ISDIR(dest->mode)) {
+                errno = ENOTDIR;
+                return -1;
+            }
+            if (dest->first_child) {
+                errno = ENOTEMPTY;
+                return -1;
             }
-            offset += name_len;
-            const void *value = p + offset;
-            set_xattr_internal(inode, name, value, value_len, 0);
-            free(name);
-            break;
+        } else if (S_ISDIR(dest->mode)) {
+            errno = EISDIR;
+            return -1;
         }
-        case APPENDFS_RECORD_REMOVEXATTR: {
-            if (length < sizeof(uint64_t) + sizeof(uint32_t)) {
-                break;
-            }
-            uint64_t inode_id = 0;
-            uint32_t name_len = 0;
-            memcpy(&inode_id, p, sizeof(uint64_t));
-            memcpy(&name_len, p + sizeof(uint64_t), sizeof(uint32_t));
-            if (sizeof(uint64_t) + sizeof(uint32_t) + name_len > length) {
-                break;
-            }
-            struct appendfs_inode *inode = find_inode_by_id(ctx, inode_id);
-            if (!inode) {
-                break;
-            }
-            char *name = strndup((const char *)(p + sizeof(uint64_t) + sizeof(uint32_t)), name_len);
-            if (!name) {
-                break;
-            }
-            remove_xattr_internal(inode, name);
-            free(name);
-            break;
+    }
+    /* Hold the new name so nothing can fail once records are written. */
+    const struct appendfs_name *held = appendfs_names_intern(&ctx->names, name, name_len);
+    if (!held) {
+        return -1;
+    }
+    int rc = -1;
+    int commit_errno = 0;
+    if (dest) {
+        /* Replacing the destination must not replay without the move. */
+        if (txn_begin(ctx) == -1) {
+            goto out;
         }
-        case APPENDFS_RECORD_TIMES: {
-            if (length < sizeof(uint64_t) + sizeof(int64_t) * 2) {
-                break;
-            }
-            uint64_t inode_id = 0;
-            int64_t atime_raw = 0;
-            int64_t mtime_raw = 0;
-            memcpy(&inode_id, p, sizeof(uint64_t));
-            memcpy(&atime_raw, p + sizeof(uint64_t), sizeof(int64_t));
-            memcpy(&mtime_raw, p + sizeof(uint64_t) + sizeof(int64_t), sizeof(int64_t));
-            struct appendfs_inode *inode = find_inode_by_id(ctx, inode_id);
-            if (!inode) {
-                break;
-            }
-            inode->atime = (time_t)atime_raw;
-            inode->mtime = (time_t)mtime_raw;
-            break;
+        if (append_unlink_record(ctx, dest) == -1 || append_rename_record(ctx, inode, parent, name, name_len) == -1) {
+            txn_abort(ctx);
+            goto out;
         }
-        default:
-            break;
+        /* A failed write leaves the records queued, so the rename stands. */
+        if (txn_commit(ctx) == -1) {
+            commit_errno = errno;
         }
-        free(payload);
+        detach_inode(ctx, dest);
+        delete_inode(ctx, dest);
+        dest->mtime_ns = clock_now_ns();
+    } else if (append_rename_record(ctx, inode, parent, name, name_len) == -1) {
+        goto out;
     }
-    lseek(ctx->meta_fd, 0, SEEK_END);
-    return 0;
+    relocate_inode(ctx, inode, parent, name, name_len);
+    inode->mtime_ns = clock_now_ns();
+    rc = 0;
+    if (commit_errno) {
+        errno = commit_errno;
+        rc = -1;
+    }
+out:
+    appendfs_names_release(&ctx->names, held);
+    return rc;
 }
 
-static int append_create_record(struct appendfs_context *ctx, struct appendfs_inode *inode) {
-    size_t path_len = strlen(inode->path);
-    size_t payload_len = sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint64_t) + sizeof(uint32_t) + path_len;
-    uint32_t target_len32 = 0;
-    if (S_ISLNK(inode->mode) && inode->symlink_target) {
-        target_len32 = (uint32_t)strlen(inode->symlink_target);
-        payload_len += sizeof(uint32_t) + target_len32;
-    }
-    unsigned char *payload = malloc(payload_len);
-    if (!payload) {
+int appendfs_rename(struct appendfs_context *ctx, const char *from_path, const char *to_path) {
+    if (!ctx) {
+        errno = EINVAL;
         return -1;
     }
-    unsigned char *p = payload;
-    memcpy(p, &inode->inode_id, sizeof(uint64_t));
-    p += sizeof(uint64_t);
-    uint32_t mode = (uint32_t)inode->mode;
-    memcpy(p, &mode, sizeof(uint32_t));
-    p += sizeof(uint32_t);
-    uint64_t size = (uint64_t)inode->size;
-    memcpy(p, &size, sizeof(uint64_t));
-    p += sizeof(uint64_t);
-    uint64_t ts = (uint64_t)inode->mtime;
-    memcpy(p, &ts, sizeof(uint64_t));
-    p += sizeof(uint64_t);
-    uint32_t path_len32 = (uint32_t)path_len;
-    memcpy(p, &path_len32, sizeof(uint32_t));
-    p += sizeof(uint32_t);
-    memcpy(p, inode->path, path_len);
-    p += path_len;
-    if (S_ISLNK(inode->mode) && inode->symlink_target) {
-        memcpy(p, &target_len32, sizeof(uint32_t));
-        p += sizeof(uint32_t);
-        memcpy(p, inode->symlink_target, target_len32);
-        p += target_len32;
-    }
-
-    int rc = write_record(ctx, S_ISDIR(inode->mode) ? APPENDFS_RECORD_MKDIR : APPENDFS_RECORD_CREATE, payload, (uint32_t)payload_len);
-    free(payload);
+    uint64_t start = appendfs_opstats_now();
+    lock_context(ctx);
+    int rc = rename_locked(ctx, from_path, to_path);
+    unlock_context(ctx);
+    uint64_t elapsed = appendfs_opstats_record(&ctx->opstats, APPENDFS_OP_RENAME, start, rc == -1, 0);
+    APPENDFS_TRACE(&ctx->trace, rename, APPENDFS_TRACE_RENAME, 0, 0, 0, elapsed);
     return rc;
 }
 
-static int append_extent_record(struct appendfs_context *ctx, struct appendfs_inode *inode, off_t logical, off_t data_offset, uint32_t length) {
-    size_t payload_len = sizeof(uint64_t) * 3 + sizeof(uint32_t) + sizeof(uint64_t);
-    unsigned char payload[sizeof(uint64_t) * 3 + sizeof(uint32_t) + sizeof(uint64_t)];
-    memcpy(payload, &inode->inode_id, sizeof(uint64_t));
-    memcpy(payload + sizeof(uint64_t), &logical, sizeof(uint64_t));
-    memcpy(payload + sizeof(uint64_t) * 2, &data_offset, sizeof(uint64_t));
-    memcpy(payload + sizeof(uint64_t) * 3, &length, sizeof(uint32_t));
-    off_t size = inode->size;
-    memcpy(payload + sizeof(uint64_t) * 3 + sizeof(uint32_t), &size, sizeof(uint64_t));
-    return write_record(ctx, APPENDFS_RECORD_EXTENT, payload, (uint32_t)payload_len);
-}
-
-static int append_truncate_record(struct appendfs_context *ctx, struct appendfs_inode *inode) {
-    unsigned char payload[sizeof(uint64_t) * 2];
-    memcpy(payload, &inode->inode_id, sizeof(uint64_t));
-    memcpy(payload + sizeof(uint64_t), &inode->size, sizeof(uint64_t));
-    return write_record(ctx, APPENDFS_RECORD_TRUNCATE, payload, sizeof(payload));
+static int is_directory_empty_locked(struct appendfs_context *ctx, const char *path) {
+    if (!ctx || !path) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct appendfs_inode *inode = find_inode_by_path(ctx, path);
+    return !inode || !inode->first_child;
 }
 
-static void clear_inode_xattrs(struct appendfs_inode *inode) {
-    for (size_t i = 0; i < inode->xattr_count; ++i) {
-        free(inode->xattrs[i].name);
-        free(inode->xattrs[i].value);
+int appendfs_is_directory_empty(struct appendfs_context *ctx, const char *path) {
+    if (!ctx) {
+        errno = EINVAL;
+        return -1;
     }
-    inode->xattr_count = 0;
+    uint64_t start = appendfs_opstats_now();
+    lock_context(ctx);
+    int rc = is_directory_empty_locked(ctx, path);
+    unlock_context(ctx);
+    appendfs_opstats_record(&ctx->opstats, APPENDFS_OP_IS_DIRECTORY_EMPTY, start, rc == -1, 0);
+    return rc;
 }
 
-static int path_is_prefix(const char *path, const char *prefix) {
-    size_t prefix_len = strlen(prefix);
-    if (strncmp(path, prefix, prefix_len) != 0) {
+static int iterate_children_locked(struct appendfs_context *ctx, const char *dir_path, appendfs_dir_iter_cb cb, void *user_data) {
+    if (!ctx || !dir_path || !cb) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct appendfs_inode *dir = find_inode_by_path(ctx, dir_path);
+    if (!dir) {
         return 0;
     }
-    if (prefix_len == 0) {
-        return 1;
+    for (struct appendfs_inode *inode = dir->first_child; inode; inode = inode->next_sibling) {
+        struct appendfs_inode_info info;
+        info.inode_id = inode->inode_id;
+        info.mode = inode->mode;
+        info.size = visible_size(inode);
+        info.blocks = (blkcnt_t)((inode->allocated + 511) / 512);
+        info.ctim = ns_to_timespec(inode->ctime_ns);
+        info.mtim = ns_to_timespec(inode->mtime_ns);
+        info.atim = ns_to_timespec(inode->atime_ns);
+        if (cb(inode->name->str, &info, user_data) != 0) {
+            break;
+        }
     }
-    if (prefix[prefix_len - 1] == '/') {
-        return 1;
+    return 0;
+}
+
+int appendfs_iterate_children(struct appendfs_context *ctx, const char *dir_path, appendfs_dir_iter_cb cb, void *user_data) {
+    if (!ctx) {
+        errno = EINVAL;
+        return -1;
     }
-    return path[prefix_len] == '\0' || path[prefix_len] == '/';
+    uint64_t start = appendfs_opstats_now();
+    lock_context(ctx);
+    int rc = iterate_children_locked(ctx, dir_path, cb, user_data);
+    unlock_context(ctx);
+    appendfs_opstats_record(&ctx->opstats, APPENDFS_OP_ITERATE_CHILDREN, start, rc == -1, 0);
+    return rc;
 }
 
-static int is_immediate_child(const char *parent, const char *candidate, const char **name_out) {
-    if (!parent || !candidate) {
-        return 0;
+static struct appendfs_file *open_file_locked(struct appendfs_context *ctx, const char *path, int flags, mode_t mode) {
+    if (!ctx || !path) {
+        errno = EINVAL;
+        return NULL;
     }
-    if (strcmp(parent, "/") == 0) {
-        if (candidate[0] != '/' || candidate[1] == '\0') {
-            return 0;
-        }
-        const char *rest = candidate + 1;
-        const char *slash = strchr(rest, '/');
-        if (slash) {
-            return 0;
+    struct appendfs_inode *inode = find_inode_by_path(ctx, path);
+    if (!inode) {
+        if (!(flags & O_CREAT)) {
+            errno = ENOENT;
+            return NULL;
         }
-        if (name_out) {
-            *name_out = rest;
+        if (create_file_locked(ctx, path, mode) == -1) {
+            return NULL;
         }
-        return 1;
-    }
-    size_t parent_len = strlen(parent);
-    if (strncmp(candidate, parent, parent_len) != 0) {
-        return 0;
+        inode = find_inode_by_path(ctx, path);
     }
-    if (candidate[parent_len] != '/') {
-        return 0;
+    if (inode && S_ISDIR(inode->mode)) {
+        errno = EISDIR;
+        return NULL;
     }
-    const char *rest = candidate + parent_len + 1;
-    if (*rest == '\0') {
-        return 0;
+    struct appendfs_file *file = calloc(1, sizeof(*file));
+    if (!file) {
+        return NULL;
     }
-    const char *slash = strchr(rest, '/');
-    if (slash) {
-        return 0;
+    file->ctx = ctx;
+    file->inode = inode;
+    file->buffer = NULL;
+    file->buffer_size = 0;
+    file->buffer_used = 0;
+    file->buffer_offset = 0;
+    file->flags = flags;
+    file->position = 0;
+    if (flags & O_TRUNC) {
+        if (truncate_locked(ctx, path, 0) == -1) {
+            free(file);
+            return NULL;
+        }
     }
-    if (name_out) {
-        *name_out = rest;
+    if (flags & O_APPEND) {
+        file->position = inode->size;
     }
-    return 1;
+    return file;
 }
 
-static int split_path(const char *path, char **parent_out, char **name_out) {
-    if (!path || path[0] != '/' || (path[1] == '\0' && parent_out)) {
+struct appendfs_file *appendfs_open_file(struct appendfs_context *ctx, const char *path, int flags, mode_t mode) {
+    if (!ctx) {
         errno = EINVAL;
+        return NULL;
+    }
+    uint64_t start = appendfs_opstats_now();
+    lock_context(ctx);
+    struct appendfs_file *file = open_file_locked(ctx, path, flags, mode);
+    unlock_context(ctx);
+    appendfs_opstats_record(&ctx->opstats, APPENDFS_OP_OPEN_FILE, start, !file, 0);
+    return file;
+}
+
+/* Stage stored_length bytes backing logical [logical, logical + length) and log the extent. */
+static int write_extent(struct appendfs_context *ctx, struct appendfs_inode *inode, off_t logical, uint32_t length, const void *stored, uint32_t stored_length, uint32_t flags) {
+    off_t data_offset = 0;
+    if (stage_data(ctx, stored, stored_length, &data_offset) == -1) {
         return -1;
     }
-    const char *slash = strrchr(path, '/');
-    if (!slash) {
-        errno = EINVAL;
+    uint32_t checksum = appendfs_crc32c(stored, stored_length);
+    if (add_extent(inode, logical, data_offset, length, stored_length, checksum, EXTENT_CHECKSUMMED | flags) == -1) {
         return -1;
     }
-    const char *name = slash + 1;
-    if (*name == '\0') {
-        errno = EINVAL;
+    uint64_t charge = extent_charge(&inode->cold->extents[inode->cold->extent_count - 1]);
+    charge_inode(ctx, inode, charge);
+    off_t old_size = inode->size;
+    off_t new_size = logical + (off_t)length;
+    if (new_size > inode->size) {
+        inode->size = new_size;
+    }
+    if (append_extent_record(ctx, inode, logical, data_offset, length, stored_length, checksum) == -1) {
+        /* Keep memory in step with the log, which extent deltas rely on. */
+        inode->cold->extent_count--;
+        uncharge_inode(ctx, inode, charge);
+        inode->size = old_size;
         return -1;
     }
-    size_t parent_len = (slash == path) ? 1 : (size_t)(slash - path);
-    if (parent_out) {
-        char *parent = malloc(parent_len + 1);
-        if (!parent) {
+    if (logical < old_size) {
+        mark_overlap(ctx, inode);
+        if (inode->cold->extent_count >= 4 * inode->cold->shaded_extents + 64) {
+            settle_inode(ctx, inode);
+        }
+    }
+    inode->mtime_ns = clock_now_ns();
+    return 0;
+}
+
+static int write_data_extent(struct appendfs_context *ctx, struct appendfs_inode *inode, off_t logical, const void *data, size_t length) {
+    return write_extent(ctx, inode, logical, (uint32_t)length, data, (uint32_t)length, 0);
+}
+
+/*
+ * With APPENDFS_OPT_COMPRESS, data is cut into COMPRESS_CHUNK pieces that
+ * each become an extent of their own, so a read decompresses at most one
+ * chunk per extent it touches.  A chunk that LZ4 cannot shrink by an eighth
+ * is stored as it is: the compressor gives up as soon as its output passes
+ * that budget.  Several chunks are logged as one record.
+ */
+static int write_compressed_extents(struct appendfs_context *ctx, struct appendfs_inode *inode, off_t logical, const void *data, size_t length) {
+    if (!ctx->compress_buf) {
+        ctx->compress_buf = malloc(appendfs_lz4_bound(COMPRESS_CHUNK));
+        if (!ctx->compress_buf) {
             return -1;
         }
-        if (slash == path) {
-            parent[0] = '/';
-            parent[1] = '\0';
+    }
+    int batch = !ctx->extent_batching && length > COMPRESS_CHUNK;
+    if (batch) {
+        begin_extent_batch(ctx);
+    }
+    const unsigned char *p = data;
+    size_t done = 0;
+    int rc = 0;
+    while (done < length && rc == 0) {
+        size_t chunk = length - done < COMPRESS_CHUNK ? length - done : COMPRESS_CHUNK;
+        size_t packed = appendfs_lz4_compress(p + done, chunk, ctx->compress_buf, chunk - chunk / 8);
+        if (packed == 0 || packed >= chunk) {
+            rc = write_data_extent(ctx, inode, logical + (off_t)done, p + done, chunk);
+            ctx->compress_skipped_bytes += rc == 0 ? chunk : 0;
         } else {
-            memcpy(parent, path, parent_len);
-            parent[parent_len] = '\0';
+            rc = write_extent(ctx, inode, logical + (off_t)done, (uint32_t)chunk, ctx->compress_buf, (uint32_t)packed, EXTENT_COMPRESSED);
+            if (rc == 0) {
+                ctx->compress_in_bytes += chunk;
+                ctx->compress_out_bytes += packed;
+            }
         }
-        *parent_out = parent;
+        done += chunk;
     }
-    if (name_out) {
-        *name_out = strdup(name);
-        if (!*name_out) {
-            if (parent_out && *parent_out) {
-                free(*parent_out);
-                *parent_out = NULL;
-            }
+    if (batch && end_extent_batch(ctx) == -1) {
+        rc = -1;
+    }
+    return rc;
+}
+
+static int append_inline_data(struct appendfs_context *ctx, struct appendfs_inode *inode, off_t logical, const void *data, size_t length) {
+    struct appendfs_inode_cold *cold = inode->cold;
+    size_t old_size = cold->inline_size;
+    size_t end = (size_t)logical + length;
+    unsigned char saved[INLINE_DATA_MAX];
+    if (old_size > 0) {
+        memcpy(saved, cold->inline_data, old_size);
+    }
+    if (end > old_size) {
+        unsigned char *bytes = realloc(cold->inline_data, end);
+        if (!bytes) {
             return -1;
         }
+        memset(bytes + old_size, 0, end - old_size);
+        cold->inline_data = bytes;
+        cold->inline_size = end;
+    }
+    memcpy(cold->inline_data + logical, data, length);
+    off_t old_file_size = inode->size;
+    if ((off_t)end > inode->size) {
+        inode->size = (off_t)end;
+    }
+    if (append_inline_record(ctx, inode) == -1) {
+        if (old_size > 0) {
+            memcpy(cold->inline_data, saved, old_size);
+        }
+        cold->inline_size = old_size;
+        inode->size = old_file_size;
+        return -1;
     }
+    inode->mtime_ns = clock_now_ns();
     return 0;
 }
 
-static int append_unlink_record(struct appendfs_context *ctx, struct appendfs_inode *inode) {
-    unsigned char payload[sizeof(uint64_t)];
-    memcpy(payload, &inode->inode_id, sizeof(uint64_t));
-    return write_record(ctx, APPENDFS_RECORD_UNLINK, payload, sizeof(payload));
-}
-
-static int append_rename_record(struct appendfs_context *ctx, struct appendfs_inode *inode, const char *new_path) {
-    size_t path_len = strlen(new_path);
-    size_t payload_len = sizeof(uint64_t) + sizeof(uint32_t) + path_len;
-    unsigned char *payload = malloc(payload_len);
-    if (!payload) {
+/* Move the inline bytes to $dir/data ahead of the file's first extent. */
+static int spill_inline_data(struct appendfs_context *ctx, struct appendfs_inode *inode) {
+    struct appendfs_inode_cold *cold = inode->cold;
+    unsigned char *bytes = cold->inline_data;
+    size_t size = cold->inline_size;
+    cold->inline_data = NULL;
+    cold->inline_size = 0;
+    if (size > 0 && write_data_extent(ctx, inode, 0, bytes, size) == -1) {
+        cold->inline_data = bytes;
+        cold->inline_size = size;
         return -1;
     }
-    memcpy(payload, &inode->inode_id, sizeof(uint64_t));
-    uint32_t path_len32 = (uint32_t)path_len;
-    memcpy(payload + sizeof(uint64_t), &path_len32, sizeof(uint32_t));
-    memcpy(payload + sizeof(uint64_t) + sizeof(uint32_t), new_path, path_len);
-    int rc = write_record(ctx, APPENDFS_RECORD_RENAME, payload, (uint32_t)payload_len);
-    free(payload);
-    return rc;
+    free(bytes);
+    return 0;
 }
 
-static int append_setxattr_record(struct appendfs_context *ctx, struct appendfs_inode *inode, const char *name, const void *value, size_t size) {
-    size_t name_len = strlen(name);
-    size_t payload_len = sizeof(uint64_t) + sizeof(uint32_t) * 2 + name_len + size;
-    unsigned char *payload = malloc(payload_len);
-    if (!payload) {
+/*
+ * A file with no extents whose bytes all lie within INLINE_DATA_MAX keeps
+ * them in memory and logs them in an INLINE_DATA record, so it never touches
+ * $dir/data.  A write that does not fit spills the inline bytes to an extent
+ * first and the file carries on as an ordinary one.
+ */
+static int append_data_extent(struct appendfs_context *ctx, struct appendfs_inode *inode, off_t logical, const void *data, size_t length) {
+    if (length > 0 && !(ctx->flags & APPENDFS_OPT_NO_INLINE) && inode->cold->extent_count == 0 &&
+        logical <= INLINE_DATA_MAX && length <= INLINE_DATA_MAX - (size_t)logical) {
+        return append_inline_data(ctx, inode, logical, data, length);
+    }
+    if (inode->cold->inline_data && spill_inline_data(ctx, inode) == -1) {
         return -1;
     }
-    unsigned char *p = payload;
-    memcpy(p, &inode->inode_id, sizeof(uint64_t));
-    p += sizeof(uint64_t);
-    uint32_t name_len32 = (uint32_t)name_len;
-    uint32_t value_len32 = (uint32_t)size;
-    memcpy(p, &name_len32, sizeof(uint32_t));
-    p += sizeof(uint32_t);
-    memcpy(p, &value_len32, sizeof(uint32_t));
-    p += sizeof(uint32_t);
-    memcpy(p, name, name_len);
-    p += name_len;
-    if (size > 0) {
-        memcpy(p, value, size);
+    if (ctx->flags & APPENDFS_OPT_COMPRESS) {
+        return write_compressed_extents(ctx, inode, logical, data, length);
     }
-    int rc = write_record(ctx, APPENDFS_RECORD_SETXATTR, payload, (uint32_t)payload_len);
-    free(payload);
-    return rc;
+    return write_data_extent(ctx, inode, logical, data, length);
 }
 
-static int append_removexattr_record(struct appendfs_context *ctx, struct appendfs_inode *inode, const char *name) {
-    size_t name_len = strlen(name);
-    size_t payload_len = sizeof(uint64_t) + sizeof(uint32_t) + name_len;
-    unsigned char *payload = malloc(payload_len);
-    if (!payload) {
-        return -1;
-    }
-    memcpy(payload, &inode->inode_id, sizeof(uint64_t));
-    uint32_t name_len32 = (uint32_t)name_len;
-    memcpy(payload + sizeof(uint64_t), &name_len32, sizeof(uint32_t));
-    memcpy(payload + sizeof(uint64_t) + sizeof(uint32_t), name, name_len);
-    int rc = write_record(ctx, APPENDFS_RECORD_REMOVEXATTR, payload, (uint32_t)payload_len);
-    free(payload);
-    return rc;
+static void dirty_unlink(struct appendfs_file *file) {
+    struct appendfs_inode *inode = file->inode;
+    if (file->dirty_prev) {
+        file->dirty_prev->dirty_next = file->dirty_next;
+    } else if (inode->dirty_head == file) {
+        inode->dirty_head = file->dirty_next;
+    }
+    if (file->dirty_next) {
+        file->dirty_next->dirty_prev = file->dirty_prev;
+    } else if (inode->dirty_tail == file) {
+        inode->dirty_tail = file->dirty_prev;
+    }
+    file->dirty_prev = NULL;
+    file->dirty_next = NULL;
 }
 
-static int append_times_record(struct appendfs_context *ctx, struct appendfs_inode *inode) {
-    unsigned char payload[sizeof(uint64_t) + sizeof(int64_t) * 2];
-    int64_t atime_raw = (int64_t)inode->atime;
-    int64_t mtime_raw = (int64_t)inode->mtime;
-    memcpy(payload, &inode->inode_id, sizeof(uint64_t));
-    memcpy(payload + sizeof(uint64_t), &atime_raw, sizeof(int64_t));
-    memcpy(payload + sizeof(uint64_t) + sizeof(int64_t), &mtime_raw, sizeof(int64_t));
-    return write_record(ctx, APPENDFS_RECORD_TIMES, payload, sizeof(payload));
+/*
+ * Move a handle that just wrote to the end of its inode's dirty list, so the
+ * list runs from the oldest write to the newest like the LRU list.
+ */
+static void dirty_touch(struct appendfs_file *file) {
+    struct appendfs_inode *inode = file->inode;
+    if (inode->dirty_tail == file) {
+        return;
+    }
+    dirty_unlink(file);
+    file->dirty_prev = inode->dirty_tail;
+    if (inode->dirty_tail) {
+        inode->dirty_tail->dirty_next = file;
+    } else {
+        inode->dirty_head = file;
+    }
+    inode->dirty_tail = file;
 }
 
-int appendfs_open(const char *root_path, struct appendfs_context **out_ctx) {
-    if (!root_path || !out_ctx) {
-        errno = EINVAL;
-        return -1;
+static int flush_buffer(struct appendfs_file *file) {
+    if (!file || file->buffer_used == 0) {
+        return 0;
     }
-    struct appendfs_context *ctx = calloc(1, sizeof(*ctx));
-    if (!ctx) {
-        return -1;
+    uint64_t start = appendfs_opstats_now();
+    size_t length = file->buffer_used;
+    int rc = append_data_extent(file->ctx, file->inode, file->buffer_offset, file->buffer, length);
+    if (rc == 0) {
+        file->ctx->dirty_bytes -= length;
+        file->buffer_used = 0;
+        dirty_unlink(file);
     }
-    ctx->data_fd = -1;
-    ctx->meta_fd = -1;
-    ctx->write_buffer_size = APPENDFS_DEFAULT_BUFFER;
-    ctx->next_inode_id = 1;
-    ctx->root_path = realpath(root_path, NULL);
-    if (!ctx->root_path) {
-        if (errno == ENOENT) {
-            if (ensure_directory(root_path) == -1) {
-                free(ctx);
-                return -1;
-            }
-            ctx->root_path = realpath(root_path, NULL);
-            if (!ctx->root_path) {
-                free(ctx);
-                return -1;
-            }
-        } else {
-            free(ctx);
-            return -1;
-        }
+    uint64_t elapsed = appendfs_opstats_record(&file->ctx->opstats, APPENDFS_OP_FLUSH_BUFFER, start, rc == -1, rc == 0 ? length : 0);
+    if (rc == 0) {
+        APPENDFS_TRACE(&file->ctx->trace, flush, APPENDFS_TRACE_FLUSH, 0, file->inode->inode_id, length, elapsed);
     }
+    return rc;
+}
 
-    char data_path[PATH_MAX];
-    char meta_path[PATH_MAX];
-    snprintf(data_path, sizeof(data_path), "%s/%s", ctx->root_path, DATA_FILENAME);
-    snprintf(meta_path, sizeof(meta_path), "%s/%s", ctx->root_path, META_FILENAME);
+static void lru_unlink(struct appendfs_file *file) {
+    struct appendfs_context *ctx = file->ctx;
+    if (file->lru_prev) {
+        file->lru_prev->lru_next = file->lru_next;
+    } else if (ctx->lru_head == file) {
+        ctx->lru_head = file->lru_next;
+    }
+    if (file->lru_next) {
+        file->lru_next->lru_prev = file->lru_prev;
+    } else if (ctx->lru_tail == file) {
+        ctx->lru_tail = file->lru_prev;
+    }
+    file->lru_prev = NULL;
+    file->lru_next = NULL;
+}
 
-    ctx->data_fd = open(data_path, O_RDWR | O_CREAT | O_BINARY, 0644);
-    if (ctx->data_fd == -1) {
-        appendfs_close(ctx);
-        return -1;
-    }
-    ctx->meta_fd = open(meta_path, O_RDWR | O_CREAT | O_BINARY, 0644);
-    if (ctx->meta_fd == -1) {
-        appendfs_close(ctx);
-        return -1;
+static void lru_touch(struct appendfs_file *file) {
+    struct appendfs_context *ctx = file->ctx;
+    if (ctx->lru_tail == file) {
+        return;
     }
-    if (replay_metadata(ctx) == -1) {
-        appendfs_close(ctx);
-        return -1;
+    lru_unlink(file);
+    file->lru_prev = ctx->lru_tail;
+    if (ctx->lru_tail) {
+        ctx->lru_tail->lru_next = file;
+    } else {
+        ctx->lru_head = file;
     }
-
-    *out_ctx = ctx;
-    return 0;
+    ctx->lru_tail = file;
 }
 
-void appendfs_close(struct appendfs_context *ctx) {
-    if (!ctx) {
+static void release_buffer(struct appendfs_file *file) {
+    if (!file->buffer) {
         return;
     }
-    if (ctx->data_fd != -1) {
-        close(ctx->data_fd);
+    if (file->buffer_used > 0) {
+        /* Only a close whose flush failed gives up buffered bytes. */
+        file->ctx->dirty_bytes -= file->buffer_used;
+        file->buffer_used = 0;
+        dirty_unlink(file);
+    }
+    lru_unlink(file);
+    appendfs_bufpool_put(&file->ctx->buffer_pool, file->buffer, file->buffer_size);
+    file->buffer = NULL;
+    file->buffer_size = 0;
+    file->ctx->buffer_count--;
+}
+
+static size_t buffer_floor(const struct appendfs_context *ctx) {
+    return ctx->min_write_buffer_size < ctx->write_buffer_size ? ctx->min_write_buffer_size : ctx->write_buffer_size;
+}
+
+/*
+ * Largest buffer a handle may grow to.  Handles stop at write_buffer_size
+ * until they have streamed twice the next size sequentially, after which they
+ * may keep doubling up to max_write_buffer_size.
+ */
+static size_t buffer_ceiling(const struct appendfs_file *file, size_t next_size) {
+    const struct appendfs_context *ctx = file->ctx;
+    size_t ceiling = ctx->max_write_buffer_size > ctx->write_buffer_size ? ctx->max_write_buffer_size : ctx->write_buffer_size;
+    if (next_size > ctx->write_buffer_size && file->seq_bytes < (uint64_t)next_size * 2) {
+        ceiling = ctx->write_buffer_size;
+    }
+    return ceiling;
+}
+
+/*
+ * Size of a fresh buffer: enough for the pending write and, for a handle
+ * resuming a sequential run after a spill, for the run so far, clamped to
+ * [min_write_buffer_size, write_buffer_size].
+ */
+static size_t initial_buffer_size(const struct appendfs_file *file, size_t write_size) {
+    const struct appendfs_context *ctx = file->ctx;
+    size_t want = write_size;
+    if (file->seq_bytes > want) {
+        want = file->seq_bytes > ctx->write_buffer_size ? ctx->write_buffer_size : (size_t)file->seq_bytes;
+    }
+    if (want < buffer_floor(ctx)) {
+        want = buffer_floor(ctx);
+    }
+    size_t size = appendfs_bufpool_class_size(want);
+    if (size > ctx->write_buffer_size) {
+        size = ctx->write_buffer_size;
+    }
+    return size;
+}
+
+static void reclaim_idle_buffers(struct appendfs_context *ctx, uint64_t now_ms) {
+    while (ctx->lru_head && now_ms - ctx->lru_head->last_write_ms >= ctx->buffer_idle_ms) {
+        struct appendfs_file *victim = ctx->lru_head;
+        if (flush_buffer(victim) == -1) {
+            return;
+        }
+        release_buffer(victim);
+        ctx->buffer_shrinks++;
     }
-    if (ctx->meta_fd != -1) {
-        close(ctx->meta_fd);
+}
+
+/*
+ * Attach a pool buffer to the handle.  When the pool is at its limit the least
+ * recently written handles are flushed and their buffers returned until the
+ * request fits; ENOBUFS means nothing is left to spill.
+ */
+static int acquire_buffer(struct appendfs_file *file, size_t write_size) {
+    struct appendfs_context *ctx = file->ctx;
+    if (file->buffer) {
+        lru_touch(file);
+        return 0;
     }
-    for (size_t i = 0; i < ctx->inode_count; ++i) {
-        free_inode(&ctx->inodes[i]);
+    reclaim_idle_buffers(ctx, file->last_write_ms);
+    size_t size = initial_buffer_size(file, write_size);
+    while (1) {
+        unsigned char *buffer = appendfs_bufpool_get(&ctx->buffer_pool, size);
+        if (buffer) {
+            file->buffer = buffer;
+            file->buffer_size = size;
+            file->buffer_used = 0;
+            ctx->buffer_count++;
+            lru_touch(file);
+            return 0;
+        }
+        if (errno != ENOBUFS || !ctx->lru_head) {
+            return -1;
+        }
+        struct appendfs_file *victim = ctx->lru_head;
+        if (flush_buffer(victim) == -1) {
+            return -1;
+        }
+        release_buffer(victim);
+        ctx->buffer_spills++;
     }
-    free(ctx->inodes);
-    free(ctx->root_path);
-    free(ctx);
 }
 
-int appendfs_set_options(struct appendfs_context *ctx, const struct appendfs_options *opts) {
-    if (!ctx || !opts) {
-        errno = EINVAL;
+/*
+ * Double a full buffer in place, keeping its contents.  Growth never spills
+ * other handles: if the pool has no headroom the caller flushes instead.
+ */
+static int grow_buffer(struct appendfs_file *file) {
+    struct appendfs_context *ctx = file->ctx;
+    size_t next = appendfs_bufpool_class_size(file->buffer_size + 1);
+    size_t ceiling = buffer_ceiling(file, next);
+    if (next > ceiling) {
+        next = ceiling;
+    }
+    if (next <= file->buffer_size) {
         return -1;
     }
-    if (opts->write_buffer_size < APPENDFS_MIN_FLUSH) {
-        errno = EINVAL;
+    unsigned char *buffer = appendfs_bufpool_get(&ctx->buffer_pool, next);
+    if (!buffer) {
         return -1;
     }
-    ctx->write_buffer_size = opts->write_buffer_size;
+    memcpy(buffer, file->buffer, file->buffer_used);
+    appendfs_bufpool_put(&ctx->buffer_pool, file->buffer, file->buffer_size);
+    file->buffer = buffer;
+    file->buffer_size = next;
+    ctx->buffer_grows++;
     return 0;
 }
 
-static struct appendfs_inode *create_inode(struct appendfs_context *ctx, const char *path, mode_t mode) {
-    if (ensure_inode_capacity(ctx) == -1) {
-        return NULL;
-    }
-    struct appendfs_inode *inode = &ctx->inodes[ctx->inode_count++];
-    memset(inode, 0, sizeof(*inode));
-    inode->inode_id = ctx->next_inode_id++;
-    inode->path = normalize_path_copy(path);
-    if (!inode->path) {
-        ctx->inode_count--;
-        return NULL;
-    }
-    inode->mode = mode;
-    inode->ctime = inode->mtime = inode->atime = time(NULL);
-    inode->size = 0;
-    inode->deleted = 0;
-    return inode;
+static size_t dirty_high_watermark(const struct appendfs_context *ctx) {
+    return ctx->dirty_high_watermark ? ctx->dirty_high_watermark : ctx->buffer_pool.limit / 2;
 }
 
-int appendfs_create_file(struct appendfs_context *ctx, const char *path, mode_t mode) {
-    if (!ctx || !path) {
-        errno = EINVAL;
-        return -1;
+/*
+ * One writeback pass: flush every buffer dirty for longer than dirty_age_ms
+ * and, while dirty bytes are above the high watermark, the least recently
+ * written handles until half the watermark remains.  The selected buffers are
+ * packed into the stage and committed together, as is a stage that has been
+ * waiting for dirty_age_ms.
+ */
+static void run_writeback(struct appendfs_context *ctx, uint64_t now_ms) {
+    if (ctx->buffer_count > 0 && ctx->dirty_bytes > 0) {
+        struct appendfs_file **files = malloc(ctx->buffer_count * sizeof(*files));
+        if (!files) {
+            return;
+        }
+        size_t high = dirty_high_watermark(ctx);
+        size_t target = ctx->dirty_bytes > high ? high / 2 : ctx->dirty_bytes;
+        size_t remaining = ctx->dirty_bytes;
+        size_t count = 0;
+        for (struct appendfs_file *file = ctx->lru_head; file; file = file->lru_next) {
+            if (file->buffer_used == 0) {
+                continue;
+            }
+            if (remaining > target || now_ms - file->dirty_since_ms >= ctx->dirty_age_ms) {
+                files[count++] = file;
+                remaining -= file->buffer_used;
+            }
+        }
+        size_t flushed = 0;
+        begin_extent_batch(ctx);
+        while (flushed < count && flush_buffer(files[flushed]) == 0) {
+            flushed++;
+        }
+        end_extent_batch(ctx);
+        if (flushed > 0) {
+            ctx->writeback_batches++;
+            ctx->writeback_files += flushed;
+        }
+        free(files);
+        if (flushed > 0) {
+            commit_stage(ctx);
+        }
     }
-    char *norm_path = normalize_path_copy(path);
-    if (!norm_path) {
-        return -1;
+    if (ctx->stage_used > 0 && now_ms - ctx->stage_since_ms >= ctx->dirty_age_ms) {
+        commit_stage(ctx);
     }
-    struct appendfs_inode *existing = find_inode_by_path(ctx, norm_path);
-    if (existing && !existing->deleted) {
-        free(norm_path);
-        errno = EEXIST;
-        return -1;
+    reclaim_idle_buffers(ctx, now_ms);
+}
+
+static void *flusher_main(void *arg) {
+    struct appendfs_context *ctx = arg;
+    lock_context(ctx);
+    while (!ctx->flusher_stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += ctx->flush_interval_ms / 1000;
+        deadline.tv_nsec += (long)(ctx->flush_interval_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&ctx->flusher_cond, &ctx->lock, &deadline);
+        if (ctx->flusher_stop) {
+            break;
+        }
+        run_writeback(ctx, monotonic_ms());
     }
-    char *parent = NULL;
-    if (split_path(norm_path, &parent, NULL) == -1) {
-        free(norm_path);
-        return -1;
+    unlock_context(ctx);
+    return NULL;
+}
+
+/*
+ * The flusher starts with the first dirty buffer rather than in
+ * appendfs_open() so that it survives a daemon forking after opening the
+ * store.  A failed pthread_create() is not retried; buffers are then flushed
+ * by the usual triggers only, and writes commit the stage themselves.
+ */
+static void start_flusher(struct appendfs_context *ctx) {
+    if (ctx->flusher_started || (ctx->flags & APPENDFS_OPT_NO_FLUSHER)) {
+        return;
     }
-    if (parent && strcmp(parent, "/") != 0) {
-        struct appendfs_inode *parent_inode = find_inode_by_path(ctx, parent);
-        if (!parent_inode || parent_inode->deleted || !S_ISDIR(parent_inode->mode)) {
-            free(parent);
-            free(norm_path);
-            errno = ENOENT;
-            return -1;
-        }
+    ctx->flusher_started = pthread_create(&ctx->flusher, NULL, flusher_main, ctx) == 0 ? 1 : -1;
+}
+
+static void stop_flusher(struct appendfs_context *ctx) {
+    if (ctx->flusher_started != 1) {
+        return;
     }
-    free(parent);
-    struct appendfs_inode *inode = existing;
-    if (existing && existing->deleted) {
-        free(existing->path);
-        existing->path = strdup(norm_path);
-        if (!existing->path) {
-            free(norm_path);
-            return -1;
+    lock_context(ctx);
+    ctx->flusher_stop = 1;
+    pthread_cond_signal(&ctx->flusher_cond);
+    unlock_context(ctx);
+    pthread_join(ctx->flusher, NULL);
+    /* Not restarted by the final flushes at unmount. */
+    ctx->flusher_started = -1;
+    ctx->flusher_stop = 0;
+}
+
+static ssize_t write_through(struct appendfs_file *file, const void *buf, size_t size, off_t offset) {
+    const unsigned char *p = buf;
+    size_t done = 0;
+    begin_extent_batch(file->ctx);
+    while (done < size) {
+        size_t chunk = size - done;
+        if (chunk > file->ctx->write_buffer_size) {
+            chunk = file->ctx->write_buffer_size;
         }
-        existing->extent_count = 0;
-        existing->size = 0;
-        existing->deleted = 0;
-        clear_inode_xattrs(existing);
-        inode = existing;
-    } else if (!inode) {
-        inode = create_inode(ctx, norm_path, S_IFREG | mode);
-        if (!inode) {
-            free(norm_path);
+        if (append_data_extent(file->ctx, file->inode, offset + (off_t)done, p + done, chunk) == -1) {
+            end_extent_batch(file->ctx);
             return -1;
         }
+        done += chunk;
     }
-    inode->mode = S_IFREG | mode;
-    inode->ctime = inode->mtime = inode->atime = time(NULL);
-    if (append_create_record(ctx, inode) == -1) {
-        if (!existing) {
-            free_inode(inode);
-            memset(inode, 0, sizeof(*inode));
-            ctx->inode_count--;
-        }
-        free(norm_path);
+    if (end_extent_batch(file->ctx) == -1) {
         return -1;
     }
-    free(norm_path);
-    return 0;
+    file->position = offset + (off_t)size;
+    return (ssize_t)size;
 }
 
-int appendfs_symlink(struct appendfs_context *ctx, const char *target, const char *linkpath, mode_t mode) {
-    (void)mode;
-    if (!ctx || !target || !linkpath) {
+static ssize_t buffer_write(struct appendfs_file *file, const void *buf, size_t size, off_t offset) {
+    if (!file || !buf) {
         errno = EINVAL;
         return -1;
     }
-    char *norm_path = normalize_path_copy(linkpath);
-    if (!norm_path) {
-        return -1;
-    }
-    struct appendfs_inode *existing = find_inode_by_path(ctx, norm_path);
-    if (existing && !existing->deleted) {
-        free(norm_path);
-        errno = EEXIST;
+    if (file->ctx->log_failed) {
+        errno = EIO;
         return -1;
     }
-    char *parent = NULL;
-    if (split_path(norm_path, &parent, NULL) == -1) {
-        free(norm_path);
-        return -1;
+    if (size == 0) {
+        return 0;
     }
-    if (parent && strcmp(parent, "/") != 0) {
-        struct appendfs_inode *parent_inode = find_inode_by_path(ctx, parent);
-        if (!parent_inode || parent_inode->deleted || !S_ISDIR(parent_inode->mode)) {
-            free(parent);
-            free(norm_path);
-            errno = ENOENT;
-            return -1;
-        }
+    uint64_t now_ms = monotonic_ms();
+    if (offset == file->next_write_offset) {
+        file->seq_bytes += size;
+    } else {
+        file->seq_bytes = size;
     }
-    free(parent);
-    struct appendfs_inode *inode = existing;
-    time_t now = time(NULL);
-    if (existing && existing->deleted) {
-        char *new_path = strdup(norm_path);
-        if (!new_path) {
-            free(norm_path);
+    file->next_write_offset = offset + (off_t)size;
+    file->bytes_written += size;
+    file->last_write_ms = now_ms;
+    if (file->buffer_used > 0 && offset != file->buffer_offset + (off_t)file->buffer_used) {
+        size_t flushed = file->buffer_used;
+        if (flush_buffer(file) == -1) {
             return -1;
         }
-        free(existing->path);
-        existing->path = new_path;
-        free(existing->symlink_target);
-        existing->symlink_target = NULL;
-        existing->extent_count = 0;
-        clear_inode_xattrs(existing);
-        inode = existing;
-    } else if (!inode) {
-        inode = create_inode(ctx, norm_path, S_IFLNK | 0777);
-        if (!inode) {
-            free(norm_path);
-            return -1;
+        /* Random writes flush mostly empty buffers; hand the memory back. */
+        if (file->buffer_size > buffer_floor(file->ctx) && flushed * 4 <= file->buffer_size) {
+            release_buffer(file);
+            file->ctx->buffer_shrinks++;
         }
     }
-    free(inode->symlink_target);
-    inode->symlink_target = strdup(target);
-    if (!inode->symlink_target) {
-        if (inode != existing) {
-            free_inode(inode);
-            memset(inode, 0, sizeof(*inode));
-            ctx->inode_count--;
+    if (acquire_buffer(file, size) == -1) {
+        if (errno == ENOBUFS) {
+            return write_through(file, buf, size, offset);
         }
-        free(norm_path);
         return -1;
     }
-    inode->mode = S_IFLNK | 0777;
-    inode->size = (off_t)strlen(target);
-    inode->ctime = inode->mtime = inode->atime = now;
-    inode->deleted = 0;
-    if (append_create_record(ctx, inode) == -1) {
-        if (inode->symlink_target) {
-            free(inode->symlink_target);
-            inode->symlink_target = NULL;
+    if (file->buffer_used == 0) {
+        file->buffer_offset = offset;
+    }
+    const unsigned char *p = buf;
+    size_t remaining = size;
+    while (remaining > 0) {
+        size_t space = file->buffer_size - file->buffer_used;
+        if (space == 0) {
+            if (flush_buffer(file) == -1) {
+                return -1;
+            }
+            file->buffer_offset = offset + (size - remaining);
+            space = file->buffer_size;
         }
-        if (!existing) {
-            free_inode(inode);
-            memset(inode, 0, sizeof(*inode));
-            ctx->inode_count--;
+        size_t to_copy = remaining;
+        if (to_copy > space) {
+            to_copy = space;
+        }
+        memcpy(file->buffer + file->buffer_used, p + (size - remaining), to_copy);
+        if (file->buffer_used == 0) {
+            file->dirty_since_ms = now_ms;
+        }
+        dirty_touch(file);
+        file->buffer_used += to_copy;
+        file->ctx->dirty_bytes += to_copy;
+        remaining -= to_copy;
+        if (file->buffer_used >= file->buffer_size && grow_buffer(file) == 0) {
+            continue;
+        }
+        if (file->buffer_used >= APPENDFS_MIN_FLUSH && file->buffer_used >= file->buffer_size) {
+            if (flush_buffer(file) == -1) {
+                return -1;
+            }
+            file->buffer_offset = offset + (size - remaining);
         }
-        free(norm_path);
-        return -1;
     }
-    free(norm_path);
-    return 0;
+    file->position = offset + (off_t)size;
+    if (file->buffer_used > 0) {
+        struct appendfs_context *ctx = file->ctx;
+        start_flusher(ctx);
+        if (ctx->flusher_started == 1 && ctx->dirty_bytes > dirty_high_watermark(ctx)) {
+            pthread_cond_signal(&ctx->flusher_cond);
+        }
+    }
+    return (ssize_t)size;
 }
 
-ssize_t appendfs_readlink(struct appendfs_context *ctx, const char *path, char *buf, size_t size) {
-    if (!ctx || !path || !buf) {
-        errno = EINVAL;
-        return -1;
-    }
-    struct appendfs_inode *inode = find_inode_by_path(ctx, path);
-    if (!inode || inode->deleted) {
-        errno = ENOENT;
+static ssize_t write_locked(struct appendfs_file *file, const void *buf, size_t size, off_t offset) {
+    ssize_t rc = buffer_write(file, buf, size, offset);
+    if (rc > 0 && settle_stage(file->ctx) == -1) {
         return -1;
     }
-    if (!S_ISLNK(inode->mode)) {
+    return rc;
+}
+
+ssize_t appendfs_write(struct appendfs_file *file, const void *buf, size_t size, off_t offset) {
+    if (!file) {
         errno = EINVAL;
         return -1;
     }
-    size_t target_len = inode->symlink_target ? strlen(inode->symlink_target) : 0;
-    if (size == 0) {
-        return (ssize_t)target_len;
-    }
-    size_t copy_len = target_len < size - 1 ? target_len : size - 1;
-    if (size == 1) {
-        buf[0] = '\0';
-        return (ssize_t)target_len;
-    }
-    if (inode->symlink_target) {
-        memcpy(buf, inode->symlink_target, copy_len);
-    }
-    buf[copy_len] = '\0';
-    inode->atime = time(NULL);
-    return (ssize_t)target_len;
+    uint64_t start = appendfs_opstats_now();
+    lock_context(file->ctx);
+    ssize_t rc = write_locked(file, buf, size, offset);
+    unlock_context(file->ctx);
+    appendfs_opstats_record(&file->ctx->opstats, APPENDFS_OP_WRITE, start, rc < 0, rc > 0 ? (uint64_t)rc : 0);
+    return rc;
 }
 
-int appendfs_mkdirs(struct appendfs_context *ctx, const char *path, mode_t mode) {
-    if (!ctx || !path) {
+static int flush_locked(struct appendfs_file *file) {
+    if (!file) {
         errno = EINVAL;
         return -1;
     }
-    if (find_inode_by_path(ctx, path)) {
-        return 0;
-    }
-    struct appendfs_inode *inode = create_inode(ctx, path, S_IFDIR | mode);
-    if (!inode) {
-        return -1;
-    }
-    if (append_create_record(ctx, inode) == -1) {
-        free_inode(inode);
-        memset(inode, 0, sizeof(*inode));
-        ctx->inode_count--;
+    if (flush_buffer(file) == -1 || settle_stage(file->ctx) == -1) {
         return -1;
     }
     return 0;
 }
 
-int appendfs_mkdir(struct appendfs_context *ctx, const char *path, mode_t mode) {
-    if (!ctx || !path || path[0] == '\0') {
+int appendfs_flush(struct appendfs_file *file) {
+    if (!file) {
         errno = EINVAL;
         return -1;
     }
-    if (strcmp(path, "/") == 0) {
+    uint64_t start = appendfs_opstats_now();
+    lock_context(file->ctx);
+    int rc = flush_locked(file);
+    unlock_context(file->ctx);
+    appendfs_opstats_record(&file->ctx->opstats, APPENDFS_OP_FLUSH, start, rc == -1, 0);
+    return rc;
+}
+
+static int close_file_locked(struct appendfs_file *file) {
+    if (!file) {
         errno = EINVAL;
         return -1;
     }
-    char *norm_path = normalize_path_copy(path);
-    if (!norm_path) {
+    int rc = flush_locked(file);
+    release_buffer(file);
+    free(file);
+    return rc;
+}
+
+int appendfs_close_file(struct appendfs_file *file) {
+    if (!file) {
+        errno = EINVAL;
         return -1;
     }
-    struct appendfs_inode *existing = find_inode_by_path(ctx, norm_path);
-    if (existing && !existing->deleted) {
-        free(norm_path);
-        errno = EEXIST;
+    struct appendfs_context *ctx = file->ctx;
+    uint64_t start = appendfs_opstats_now();
+    lock_context(ctx);
+    int rc = close_file_locked(file);
+    unlock_context(ctx);
+    appendfs_opstats_record(&ctx->opstats, APPENDFS_OP_CLOSE_FILE, start, rc == -1, 0);
+    return rc;
+}
+
+static int setxattr_locked(struct appendfs_context *ctx, const char *path, const char *name, const void *value, size_t size, int flags) {
+    if (!ctx || !path || !name || (size > 0 && !value)) {
+        errno = EINVAL;
         return -1;
     }
-    char *parent = NULL;
-    if (split_path(norm_path, &parent, NULL) == -1) {
-        free(norm_path);
+    struct appendfs_inode *inode = find_inode_by_path(ctx, path);
+    if (!inode || inode->deleted) {
+        errno = ENOENT;
         return -1;
     }
-    int rc = 0;
-    if (parent && strcmp(parent, "/") != 0) {
-        struct appendfs_inode *parent_inode = find_inode_by_path(ctx, parent);
-        if (!parent_inode || parent_inode->deleted || !S_ISDIR(parent_inode->mode)) {
-            errno = ENOENT;
-            rc = -1;
-            goto out;
+    struct appendfs_xattr *existing = find_xattr(inode, name);
+    unsigned char *old_value = NULL;
+    size_t old_size = 0;
+    int had_existing = existing != NULL;
+    if (had_existing && existing->size > 0) {
+        old_value = malloc(existing->size);
+        if (!old_value) {
+            return -1;
         }
+        memcpy(old_value, existing->value, existing->size);
+        old_size = existing->size;
     }
-    if (existing && existing->deleted) {
-        existing->deleted = 0;
-        existing->mode = S_IFDIR | (mode & 0777);
-        existing->ctime = existing->mtime = existing->atime = time(NULL);
-        clear_inode_xattrs(existing);
-        rc = append_create_record(ctx, existing);
-        goto out;
+    if (set_xattr_internal(ctx, inode, name, value, size, flags) == -1) {
+        free(old_value);
+        return -1;
     }
-    struct appendfs_inode *inode = create_inode(ctx, norm_path, S_IFDIR | (mode & 0777));
-    if (!inode) {
-        rc = -1;
-        goto out;
+    if (append_setxattr_record(ctx, inode, name, value, size) == -1) {
+        if (had_existing) {
+            set_xattr_internal(ctx, inode, name, old_value, old_size, XATTR_REPLACE);
+        } else {
+            remove_xattr_internal(ctx, inode, name);
+        }
+        free(old_value);
+        return -1;
     }
-    if (append_create_record(ctx, inode) == -1) {
-        free_inode(inode);
-        memset(inode, 0, sizeof(*inode));
-        ctx->inode_count--;
-        rc = -1;
-        goto out;
+    free(old_value);
+    return 0;
+}
+
+int appendfs_setxattr(struct appendfs_context *ctx, const char *path, const char *name, const void *value, size_t size, int flags) {
+    if (!ctx) {
+        errno = EINVAL;
+        return -1;
     }
-    rc = 0;
-out:
-    free(parent);
-    free(norm_path);
+    uint64_t start = appendfs_opstats_now();
+    lock_context(ctx);
+    int rc = setxattr_locked(ctx, path, name, value, size, flags);
+    unlock_context(ctx);
+    appendfs_opstats_record(&ctx->opstats, APPENDFS_OP_SETXATTR, start, rc == -1, 0);
     return rc;
 }
 
-int appendfs_unlink(struct appendfs_context *ctx, const char *path) {
-    if (!ctx || !path) {
+static ssize_t getxattr_locked(struct appendfs_context *ctx, const char *path, const char *name, void *value, size_t size) {
+    if (!ctx || !path || !name) {
         errno = EINVAL;
         return -1;
     }
     struct appendfs_inode *inode = find_inode_by_path(ctx, path);
-    if (!inode) {
+    if (!inode || inode->deleted) {
         errno = ENOENT;
         return -1;
     }
-    if (S_ISDIR(inode->mode)) {
-        errno = EISDIR;
+    struct appendfs_xattr *attr = find_xattr(inode, name);
+    if (!attr) {
+        errno = ENODATA;
         return -1;
     }
-    inode->deleted = 1;
-    if (append_unlink_record(ctx, inode) == -1) {
+    if (!value) {
+        return (ssize_t)attr->size;
+    }
+    if (size < attr->size) {
+        errno = ERANGE;
+        return -1;
+    }
+    if (attr->size > 0) {
+        memcpy(value, attr->value, attr->size);
+    }
+    return (ssize_t)attr->size;
+}
+
+ssize_t appendfs_getxattr(struct appendfs_context *ctx, const char *path, const char *name, void *value, size_t size) {
+    if (!ctx) {
+        errno = EINVAL;
         return -1;
     }
-    return 0;
+    uint64_t start = appendfs_opstats_now();
+    lock_context(ctx);
+    ssize_t rc = getxattr_locked(ctx, path, name, value, size);
+    unlock_context(ctx);
+    appendfs_opstats_record(&ctx->opstats, APPENDFS_OP_GETXATTR, start, rc < 0, rc > 0 ? (uint64_t)rc : 0);
+    return rc;
 }
 
-int appendfs_rmdir(struct appendfs_context *ctx, const char *path) {
-    if (!ctx || !path || strcmp(path, "/") == 0) {
+static ssize_t listxattr_locked(struct appendfs_context *ctx, const char *path, char *list, size_t size) {
+    if (!ctx || !path) {
         errno = EINVAL;
         return -1;
     }
@@ -1330,495 +4503,327 @@ int appendfs_rmdir(struct appendfs_context *ctx, const char *path) {
         errno = ENOENT;
         return -1;
     }
-    if (!S_ISDIR(inode->mode)) {
-        errno = ENOTDIR;
-        return -1;
+    size_t total = 0;
+    for (size_t i = 0; i < inode->cold->xattr_count; ++i) {
+        total += strlen(inode->cold->xattrs[i].name) + 1;
     }
-    int empty = appendfs_is_directory_empty(ctx, path);
-    if (empty < 0) {
-        return -1;
+    if (!list) {
+        return (ssize_t)total;
     }
-    if (!empty) {
-        errno = ENOTEMPTY;
+    if (size < total) {
+        errno = ERANGE;
         return -1;
     }
-    inode->deleted = 1;
-    inode->mtime = time(NULL);
-    if (append_unlink_record(ctx, inode) == -1) {
-        return -1;
+    size_t offset = 0;
+    for (size_t i = 0; i < inode->cold->xattr_count; ++i) {
+        size_t len = strlen(inode->cold->xattrs[i].name);
+        memcpy(list + offset, inode->cold->xattrs[i].name, len);
+        offset += len;
+        list[offset++] = '\0';
     }
-    return 0;
+    return (ssize_t)total;
 }
 
-int appendfs_rename(struct appendfs_context *ctx, const char *from_path, const char *to_path) {
-    if (!ctx || !from_path || !to_path) {
+ssize_t appendfs_listxattr(struct appendfs_context *ctx, const char *path, char *list, size_t size) {
+    if (!ctx) {
         errno = EINVAL;
         return -1;
     }
-    char *from_norm = normalize_path_copy(from_path);
-    if (!from_norm) {
-        return -1;
-    }
-    char *to_norm = normalize_path_copy(to_path);
-    if (!to_norm) {
-        free(from_norm);
+    uint64_t start = appendfs_opstats_now();
+    lock_context(ctx);
+    ssize_t rc = listxattr_locked(ctx, path, list, size);
+    unlock_context(ctx);
+    appendfs_opstats_record(&ctx->opstats, APPENDFS_OP_LISTXATTR, start, rc < 0, rc > 0 ? (uint64_t)rc : 0);
+    return rc;
+}
+
+static int removexattr_locked(struct appendfs_context *ctx, const char *path, const char *name) {
+    if (!ctx || !path || !name) {
+        errno = EINVAL;
         return -1;
     }
-    struct appendfs_inode *inode = find_inode_by_path(ctx, from_norm);
-    if (!inode) {
-        free(from_norm);
-        free(to_norm);
+    struct appendfs_inode *inode = find_inode_by_path(ctx, path);
+    if (!inode || inode->deleted) {
         errno = ENOENT;
         return -1;
     }
-    if (strcmp(from_norm, to_norm) == 0) {
-        free(from_norm);
-        free(to_norm);
-        return 0;
-    }
-    char *to_parent = NULL;
-    if (split_path(to_norm, &to_parent, NULL) == -1) {
-        free(from_norm);
-        free(to_norm);
+    struct appendfs_xattr *attr = find_xattr(inode, name);
+    if (!attr) {
+        errno = ENODATA;
         return -1;
     }
-    if (to_parent && strcmp(to_parent, "/") != 0) {
-        struct appendfs_inode *parent = find_inode_by_path(ctx, to_parent);
-        if (!parent || parent->deleted || !S_ISDIR(parent->mode)) {
-            free(to_parent);
-            free(from_norm);
-            free(to_norm);
-            errno = ENOENT;
-            return -1;
-        }
-    }
-    struct appendfs_inode *dest = find_inode_by_path(ctx, to_norm);
-    if (dest && !dest->deleted) {
-        if (S_ISDIR(inode->mode)) {
-            if (!S_ISDIR(dest->mode)) {
-                free(to_parent);
-                free(from_norm);
-                free(to_norm);
-                errno = ENOTDIR;
-                return -1;
-            }
-            int empty = appendfs_is_directory_empty(ctx, to_norm);
-            if (empty < 0) {
-                free(to_parent);
-                free(from_norm);
-                free(to_norm);
-                return -1;
-            }
-            if (!empty) {
-                free(to_parent);
-                free(from_norm);
-                free(to_norm);
-                errno = ENOTEMPTY;
-                return -1;
-            }
-        } else {
-            if (S_ISDIR(dest->mode)) {
-                free(to_parent);
-                free(from_norm);
-                free(to_norm);
-                errno = EISDIR;
-                return -1;
-            }
-        }
-        dest->deleted = 1;
-        dest->mtime = time(NULL);
-        if (append_unlink_record(ctx, dest) == -1) {
-            free(to_parent);
-            free(from_norm);
-            free(to_norm);
+    unsigned char *backup = NULL;
+    size_t backup_size = attr->size;
+    if (backup_size > 0) {
+        backup = malloc(backup_size);
+        if (!backup) {
             return -1;
         }
+        memcpy(backup, attr->value, backup_size);
     }
-
-    struct rename_child {
-        struct appendfs_inode *inode;
-        char *new_path;
-    };
-    struct rename_child *children = NULL;
-    size_t child_count = 0;
-    size_t child_capacity = 0;
-    size_t from_len = strlen(from_norm);
-    size_t to_len = strlen(to_norm);
-
-    if (S_ISDIR(inode->mode)) {
-        for (size_t i = 0; i < ctx->inode_count; ++i) {
-            struct appendfs_inode *child = &ctx->inodes[i];
-            if (child == inode || child->deleted) {
-                continue;
-            }
-            if (!path_is_prefix(child->path, from_norm)) {
-                continue;
-            }
-            if (strlen(child->path) <= from_len || child->path[from_len] != '/') {
-                continue;
-            }
-            const char *suffix = child->path + from_len;
-            size_t new_len = to_len + strlen(suffix);
-            char *child_new_path = malloc(new_len + 1);
-            if (!child_new_path) {
-                free(to_parent);
-                for (size_t j = 0; j < child_count; ++j) {
-                    free(children[j].new_path);
-                }
-                free(children);
-                return -1;
-            }
-            memcpy(child_new_path, to_norm, to_len);
-            memcpy(child_new_path + to_len, suffix, strlen(suffix) + 1);
-            if (child_count >= child_capacity) {
-                size_t new_cap = child_capacity ? child_capacity * 2 : 4;
-                struct rename_child *tmp = realloc(children, new_cap * sizeof(*tmp));
-                if (!tmp) {
-                    free(child_new_path);
-                    free(to_parent);
-                    for (size_t j = 0; j < child_count; ++j) {
-                        free(children[j].new_path);
-                    }
-                    free(children);
-                    free(from_norm);
-                    free(to_norm);
-                    return -1;
-                }
-                children = tmp;
-                child_capacity = new_cap;
-            }
-            children[child_count].inode = child;
-            children[child_count].new_path = child_new_path;
-            child_count++;
-        }
-    }
-
-    if (append_rename_record(ctx, inode, to_norm) == -1) {
-        for (size_t j = 0; j < child_count; ++j) {
-            free(children[j].new_path);
-        }
-        free(children);
-        free(to_parent);
-        free(from_norm);
-        free(to_norm);
+    if (remove_xattr_internal(ctx, inode, name) == -1) {
+        free(backup);
         return -1;
     }
-    char *new_path = strdup(to_norm);
-    if (!new_path) {
-        for (size_t j = 0; j < child_count; ++j) {
-            free(children[j].new_path);
-        }
-        free(children);
-        free(to_parent);
-        free(from_norm);
-        free(to_norm);
+    if (append_removexattr_record(ctx, inode, name) == -1) {
+        set_xattr_internal(ctx, inode, name, backup, backup_size, XATTR_CREATE);
+        free(backup);
         return -1;
     }
-    char *old_path = inode->path;
-    inode->path = new_path;
-    inode->deleted = 0;
-    inode->mtime = time(NULL);
-    for (size_t i = 0; i < child_count; ++i) {
-        struct appendfs_inode *child = children[i].inode;
-        char *child_new_path = children[i].new_path;
-        if (append_rename_record(ctx, child, child_new_path) == -1) {
-            free(child_new_path);
-            for (size_t j = i + 1; j < child_count; ++j) {
-                free(children[j].new_path);
-            }
-            free(children);
-            free(old_path);
-            free(to_parent);
-            free(from_norm);
-            free(to_norm);
-            return -1;
-        }
-        free(child->path);
-        child->path = child_new_path;
-        child->deleted = 0;
-    }
-    free(children);
-    free(old_path);
-    free(to_parent);
-    free(from_norm);
-    free(to_norm);
+    free(backup);
     return 0;
 }
 
-int appendfs_is_directory_empty(struct appendfs_context *ctx, const char *path) {
-    if (!ctx || !path) {
+int appendfs_removexattr(struct appendfs_context *ctx, const char *path, const char *name) {
+    if (!ctx) {
         errno = EINVAL;
         return -1;
     }
-    char *normalized = NULL;
-    const char *dir_path = normalize_path_view(path, &normalized);
-    if (!dir_path) {
-        return -1;
-    }
-    for (size_t i = 0; i < ctx->inode_count; ++i) {
-        struct appendfs_inode *inode = &ctx->inodes[i];
-        if (inode->deleted) {
-            continue;
-        }
-        if (strcmp(inode->path, dir_path) == 0) {
-            continue;
-        }
-        if (is_immediate_child(dir_path, inode->path, NULL)) {
-            free(normalized);
-            return 0;
-        }
-    }
-    free(normalized);
-    return 1;
+    uint64_t start = appendfs_opstats_now();
+    lock_context(ctx);
+    int rc = removexattr_locked(ctx, path, name);
+    unlock_context(ctx);
+    appendfs_opstats_record(&ctx->opstats, APPENDFS_OP_REMOVEXATTR, start, rc == -1, 0);
+    return rc;
 }
 
-int appendfs_iterate_children(struct appendfs_context *ctx, const char *dir_path, appendfs_dir_iter_cb cb, void *user_data) {
-    if (!ctx || !dir_path || !cb) {
+static int fsync_locked(struct appendfs_file *file, int datasync) {
+    if (!file) {
         errno = EINVAL;
         return -1;
     }
-    char *normalized = NULL;
-    const char *parent = normalize_path_view(dir_path, &normalized);
-    if (!parent) {
+    if (flush_locked(file) == -1) {
         return -1;
     }
-    for (size_t i = 0; i < ctx->inode_count; ++i) {
-        struct appendfs_inode *inode = &ctx->inodes[i];
-        if (inode->deleted) {
-            continue;
-        }
-        const char *name = NULL;
-        if (!is_immediate_child(parent, inode->path, &name)) {
-            continue;
-        }
-        struct appendfs_inode_info info;
-        info.inode_id = inode->inode_id;
-        info.mode = inode->mode;
-        info.size = inode->size;
-        info.ctime = inode->ctime;
-        info.mtime = inode->mtime;
-        info.atime = inode->atime;
-        if (cb(name, &info, user_data) != 0) {
-            break;
+    if (commit_stage(file->ctx) == -1) {
+        return -1;
+    }
+    int data_fd = file->ctx->data_fd;
+    if (fsync(data_fd) == -1) {
+        return -1;
+    }
+    if (!datasync) {
+        if (fsync(file->ctx->meta_fd) == -1) {
+            return -1;
         }
     }
-    free(normalized);
     return 0;
 }
 
-struct appendfs_file *appendfs_open_file(struct appendfs_context *ctx, const char *path, int flags, mode_t mode) {
-    if (!ctx || !path) {
-        errno = EINVAL;
-        return NULL;
-    }
-    struct appendfs_inode *inode = find_inode_by_path(ctx, path);
-    if (!inode) {
-        if (!(flags & O_CREAT)) {
-            errno = ENOENT;
-            return NULL;
-        }
-        if (appendfs_create_file(ctx, path, mode) == -1) {
-            return NULL;
-        }
-        inode = find_inode_by_path(ctx, path);
-    }
-    if (inode && S_ISDIR(inode->mode)) {
-        errno = EISDIR;
-        return NULL;
-    }
-    struct appendfs_file *file = calloc(1, sizeof(*file));
+int appendfs_fsync(struct appendfs_file *file, int datasync) {
     if (!file) {
-        return NULL;
-    }
-    file->ctx = ctx;
-    file->inode = inode;
-    file->buffer_size = ctx->write_buffer_size;
-    file->buffer = malloc(file->buffer_size);
-    if (!file->buffer) {
-        free(file);
-        return NULL;
-    }
-    file->buffer_used = 0;
-    file->buffer_offset = 0;
-    file->flags = flags;
-    file->position = 0;
-    if (flags & O_TRUNC) {
-        if (appendfs_truncate(ctx, path, 0) == -1) {
-            free(file->buffer);
-            free(file);
-            return NULL;
-        }
-    }
-    if (flags & O_APPEND) {
-        file->position = inode->size;
+        errno = EINVAL;
+        return -1;
     }
-    return file;
+    uint64_t start = appendfs_opstats_now();
+    lock_context(file->ctx);
+    int rc = fsync_locked(file, datasync);
+    unlock_context(file->ctx);
+    uint64_t elapsed = appendfs_opstats_record(&file->ctx->opstats, APPENDFS_OP_FSYNC, start, rc == -1, 0);
+    APPENDFS_TRACE(&file->ctx->trace, fsync, APPENDFS_TRACE_FSYNC, 0, file->inode->inode_id, 0, elapsed);
+    return rc;
 }
 
-static int flush_buffer(struct appendfs_file *file) {
-    if (!file || file->buffer_used == 0) {
-        return 0;
-    }
-    struct appendfs_context *ctx = file->ctx;
-    struct appendfs_inode *inode = file->inode;
-    off_t data_offset = lseek(ctx->data_fd, 0, SEEK_END);
-    if (data_offset == (off_t)-1) {
-        return -1;
-    }
-    if (write_all(ctx->data_fd, file->buffer, file->buffer_used) == -1) {
+static int fsyncdir_locked(struct appendfs_context *ctx) {
+    if (!ctx) {
+        errno = EINVAL;
         return -1;
     }
-    if (add_extent(inode, file->buffer_offset, data_offset, (uint32_t)file->buffer_used) == -1) {
+    if (commit_stage(ctx) == -1) {
         return -1;
     }
-    off_t new_size = file->buffer_offset + (off_t)file->buffer_used;
-    if (new_size > inode->size) {
-        inode->size = new_size;
-    }
-    inode->mtime = time(NULL);
-    if (append_extent_record(ctx, inode, file->buffer_offset, data_offset, (uint32_t)file->buffer_used) == -1) {
+    if (fsync(ctx->meta_fd) == -1) {
         return -1;
     }
-    file->buffer_used = 0;
     return 0;
 }
 
-ssize_t appendfs_write(struct appendfs_file *file, const void *buf, size_t size, off_t offset) {
-    if (!file || !buf) {
+int appendfs_fsyncdir(struct appendfs_context *ctx) {
+    if (!ctx) {
         errno = EINVAL;
         return -1;
     }
-    if (size == 0) {
-        return 0;
+    uint64_t start = appendfs_opstats_now();
+    lock_context(ctx);
+    int rc = fsyncdir_locked(ctx);
+    unlock_context(ctx);
+    uint64_t elapsed = appendfs_opstats_record(&ctx->opstats, APPENDFS_OP_FSYNCDIR, start, rc == -1, 0);
+    APPENDFS_TRACE(&ctx->trace, fsyncdir, APPENDFS_TRACE_FSYNCDIR, 0, 0, 0, elapsed);
+    return rc;
+}
+
+static off_t seek_locked(struct appendfs_file *file, off_t offset, int whence) {
+    if (!file) {
+        errno = EINVAL;
+        return (off_t)-1;
     }
-    if (file->buffer_used > 0 && offset != file->buffer_offset + (off_t)file->buffer_used) {
-        if (flush_buffer(file) == -1) {
-            return -1;
+    if (file->buffer_used > 0) {
+        if (flush_locked(file) == -1) {
+            return (off_t)-1;
+        }
+    }
+    struct appendfs_inode *inode = file->inode;
+    switch (whence) {
+    case SEEK_SET:
+    case SEEK_CUR:
+    case SEEK_END: {
+        off_t base = 0;
+        if (whence == SEEK_CUR) {
+            base = file->position;
+        } else if (whence == SEEK_END) {
+            base = inode->size;
+        }
+        off_t new_pos = base + offset;
+        if (new_pos < 0) {
+            errno = EINVAL;
+            return (off_t)-1;
+        }
+        file->position = new_pos;
+        return new_pos;
+    }
+#ifdef SEEK_DATA
+    case SEEK_DATA: {
+        if (offset < 0) {
+            errno = EINVAL;
+            return (off_t)-1;
+        }
+        if (offset >= inode->size) {
+            errno = ENXIO;
+            return (off_t)-1;
+        }
+        off_t result = -1;
+        for (size_t i = 0; i < inode->cold->extent_count; ++i) {
+            struct appendfs_extent *ext = &inode->cold->extents[i];
+            off_t start = ext->logical_offset;
+            off_t end = ext->logical_offset + ext->length;
+            if (end <= offset) {
+                continue;
+            }
+            if (offset < start) {
+                result = start;
+            } else {
+                result = offset;
+            }
+            break;
+        }
+        if (result < 0) {
+            errno = ENXIO;
+            return (off_t)-1;
         }
+        file->position = result;
+        return result;
     }
-    if (file->buffer_used == 0) {
-        file->buffer_offset = offset;
-    }
-    const unsigned char *p = buf;
-    size_t remaining = size;
-    while (remaining > 0) {
-        size_t space = file->buffer_size - file->buffer_used;
-        if (space == 0) {
-            if (flush_buffer(file) == -1) {
-                return -1;
-            }
-            file->buffer_offset = offset + (size - remaining);
-            space = file->buffer_size;
+#endif
+#ifdef SEEK_HOLE
+    case SEEK_HOLE: {
+        if (offset < 0) {
+            errno = EINVAL;
+            return (off_t)-1;
         }
-        size_t to_copy = remaining;
-        if (to_copy > space) {
-            to_copy = space;
+        if (offset >= inode->size) {
+            file->position = inode->size;
+            return inode->size;
         }
-        memcpy(file->buffer + file->buffer_used, p + (size - remaining), to_copy);
-        file->buffer_used += to_copy;
-        remaining -= to_copy;
-        if (file->buffer_used >= APPENDFS_MIN_FLUSH && file->buffer_used >= file->buffer_size) {
-            if (flush_buffer(file) == -1) {
-                return -1;
+        off_t pos = offset;
+        for (size_t i = 0; i < inode->cold->extent_count; ++i) {
+            struct appendfs_extent *ext = &inode->cold->extents[i];
+            off_t start = ext->logical_offset;
+            off_t end = ext->logical_offset + ext->length;
+            if (pos < start) {
+                file->position = pos;
+                return pos;
             }
-            file->buffer_offset = offset + (size - remaining);
+            if (pos >= start && pos < end) {
+                pos = end;
+            }
+        }
+        if (pos > inode->size) {
+            pos = inode->size;
         }
+        file->position = pos;
+        return pos;
     }
-    file->position = offset + (off_t)size;
-    return (ssize_t)size;
-}
-
-int appendfs_flush(struct appendfs_file *file) {
-    if (!file) {
+#endif
+    default:
         errno = EINVAL;
-        return -1;
-    }
-    if (flush_buffer(file) == -1) {
-        return -1;
+        return (off_t)-1;
     }
-    return 0;
 }
 
-int appendfs_close_file(struct appendfs_file *file) {
+off_t appendfs_seek(struct appendfs_file *file, off_t offset, int whence) {
     if (!file) {
         errno = EINVAL;
-        return -1;
+        return (off_t)-1;
     }
-    int rc = appendfs_flush(file);
-    free(file->buffer);
-    free(file);
+    uint64_t start = appendfs_opstats_now();
+    lock_context(file->ctx);
+    off_t rc = seek_locked(file, offset, whence);
+    unlock_context(file->ctx);
+    appendfs_opstats_record(&file->ctx->opstats, APPENDFS_OP_SEEK, start, rc == -1, 0);
     return rc;
 }
 
-int appendfs_setxattr(struct appendfs_context *ctx, const char *path, const char *name, const void *value, size_t size, int flags) {
-    if (!ctx || !path || !name || (size > 0 && !value)) {
+/*
+ * Cut buffered bytes at or past size off every handle of the inode, so they
+ * neither show through reads nor land on top of the truncation when flushed.
+ */
+static void clip_buffers(struct appendfs_context *ctx, struct appendfs_inode *inode, off_t size) {
+    struct appendfs_file *file = inode->dirty_head;
+    while (file) {
+        struct appendfs_file *next = file->dirty_next;
+        if (file->buffer_offset + (off_t)file->buffer_used > size) {
+            size_t keep = file->buffer_offset < size ? (size_t)(size - file->buffer_offset) : 0;
+            ctx->dirty_bytes -= file->buffer_used - keep;
+            file->buffer_used = keep;
+            if (keep == 0) {
+                dirty_unlink(file);
+            }
+        }
+        file = next;
+    }
+}
+
+static int truncate_locked(struct appendfs_context *ctx, const char *path, off_t size) {
+    if (!ctx || !path) {
         errno = EINVAL;
         return -1;
     }
     struct appendfs_inode *inode = find_inode_by_path(ctx, path);
-    if (!inode || inode->deleted) {
+    if (!inode) {
         errno = ENOENT;
         return -1;
     }
-    struct appendfs_xattr *existing = find_xattr(inode, name);
-    unsigned char *old_value = NULL;
-    size_t old_size = 0;
-    int had_existing = existing != NULL;
-    if (had_existing && existing->size > 0) {
-        old_value = malloc(existing->size);
-        if (!old_value) {
-            return -1;
-        }
-        memcpy(old_value, existing->value, existing->size);
-        old_size = existing->size;
-    }
-    if (set_xattr_internal(inode, name, value, size, flags) == -1) {
-        free(old_value);
+    if (!S_ISREG(inode->mode) && !S_ISLNK(inode->mode)) {
+        errno = EINVAL;
         return -1;
     }
-    if (append_setxattr_record(ctx, inode, name, value, size) == -1) {
-        if (had_existing) {
-            set_xattr_internal(inode, name, old_value, old_size, XATTR_REPLACE);
-        } else {
-            remove_xattr_internal(inode, name);
-        }
-        free(old_value);
+    inode->size = size;
+    if (append_truncate_record(ctx, inode) == -1) {
         return -1;
     }
-    free(old_value);
+    clip_buffers(ctx, inode, size);
+    truncate_extents(ctx, inode, size);
+    settle_inode(ctx, inode);
+    trim_inline_data(inode, size);
+    inode->mtime_ns = clock_now_ns();
     return 0;
 }
 
-ssize_t appendfs_getxattr(struct appendfs_context *ctx, const char *path, const char *name, void *value, size_t size) {
-    if (!ctx || !path || !name) {
+int appendfs_truncate(struct appendfs_context *ctx, const char *path, off_t size) {
+    if (!ctx) {
         errno = EINVAL;
         return -1;
     }
-    struct appendfs_inode *inode = find_inode_by_path(ctx, path);
-    if (!inode || inode->deleted) {
-        errno = ENOENT;
-        return -1;
-    }
-    struct appendfs_xattr *attr = find_xattr(inode, name);
-    if (!attr) {
-        errno = ENODATA;
-        return -1;
-    }
-    if (!value) {
-        return (ssize_t)attr->size;
-    }
-    if (size < attr->size) {
-        errno = ERANGE;
-        return -1;
-    }
-    if (attr->size > 0) {
-        memcpy(value, attr->value, attr->size);
-    }
-    return (ssize_t)attr->size;
+    uint64_t start = appendfs_opstats_now();
+    lock_context(ctx);
+    int rc = truncate_locked(ctx, path, size);
+    unlock_context(ctx);
+    appendfs_opstats_record(&ctx->opstats, APPENDFS_OP_TRUNCATE, start, rc == -1, 0);
+    return rc;
 }
 
-ssize_t appendfs_listxattr(struct appendfs_context *ctx, const char *path, char *list, size_t size) {
-    if (!ctx || !path) {
+static int set_times_locked(struct appendfs_context *ctx, const char *path, const struct timespec times[2]) {
+    if (!ctx || !path || !times) {
         errno = EINVAL;
         return -1;
     }
@@ -1827,301 +4832,733 @@ ssize_t appendfs_listxattr(struct appendfs_context *ctx, const char *path, char
         errno = ENOENT;
         return -1;
     }
-    size_t total = 0;
-    for (size_t i = 0; i < inode->xattr_count; ++i) {
-        total += strlen(inode->xattrs[i].name) + 1;
+    int64_t now = clock_now_ns();
+    if (times[0].tv_nsec == UTIME_NOW) {
+        inode->atime_ns = now;
+    } else if (times[0].tv_nsec != UTIME_OMIT) {
+        inode->atime_ns = timespec_to_ns(&times[0]);
     }
-    if (!list) {
-        return (ssize_t)total;
+    if (times[1].tv_nsec == UTIME_NOW) {
+        inode->mtime_ns = now;
+    } else if (times[1].tv_nsec != UTIME_OMIT) {
+        inode->mtime_ns = timespec_to_ns(&times[1]);
     }
-    if (size < total) {
-        errno = ERANGE;
+    inode->ctime_ns = now;
+    if (append_times_record(ctx, inode) == -1) {
         return -1;
     }
-    size_t offset = 0;
-    for (size_t i = 0; i < inode->xattr_count; ++i) {
-        size_t len = strlen(inode->xattrs[i].name);
-        memcpy(list + offset, inode->xattrs[i].name, len);
-        offset += len;
-        list[offset++] = '\0';
+    return 0;
+}
+
+int appendfs_set_times(struct appendfs_context *ctx, const char *path, const struct timespec times[2]) {
+    if (!ctx) {
+        errno = EINVAL;
+        return -1;
     }
-    return (ssize_t)total;
+    uint64_t start = appendfs_opstats_now();
+    lock_context(ctx);
+    int rc = set_times_locked(ctx, path, times);
+    unlock_context(ctx);
+    appendfs_opstats_record(&ctx->opstats, APPENDFS_OP_SET_TIMES, start, rc == -1, 0);
+    return rc;
 }
 
-int appendfs_removexattr(struct appendfs_context *ctx, const char *path, const char *name) {
-    if (!ctx || !path || !name) {
+/*
+ * Phase one of a batch: create the new inodes and check every other
+ * operation against the tree as it will look, without logging anything.
+ */
+/* Whether an earlier operation of the batch sets xattr name on inode. */
+static int batch_sets_xattr(struct appendfs_context *ctx, const struct appendfs_batch_op *ops, size_t count, struct appendfs_inode *inode, const char *name) {
+    for (size_t i = 0; i < count; ++i) {
+        if (ops[i].type == APPENDFS_BATCH_SETXATTR && strcmp(ops[i].name, name) == 0 && find_inode_by_path(ctx, ops[i].path) == inode) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int batch_prepare(struct appendfs_context *ctx, const struct appendfs_batch_op *ops, size_t index, struct appendfs_inode **created) {
+    const struct appendfs_batch_op *op = &ops[index];
+    *created = NULL;
+    if (!op->path) {
         errno = EINVAL;
         return -1;
     }
-    struct appendfs_inode *inode = find_inode_by_path(ctx, path);
-    if (!inode || inode->deleted) {
+    if (op->type == APPENDFS_BATCH_CREATE || op->type == APPENDFS_BATCH_MKDIR || op->type == APPENDFS_BATCH_SYMLINK) {
+        if (op->type == APPENDFS_BATCH_SYMLINK && !op->target) {
+            errno = EINVAL;
+            return -1;
+        }
+        const char *name = NULL;
+        size_t name_len = 0;
+        struct appendfs_inode *parent = find_parent(ctx, op->path, &name, &name_len);
+        if (!parent) {
+            return -1;
+        }
+        if (lookup_child(ctx, parent, name, name_len)) {
+            errno = EEXIST;
+            return -1;
+        }
+        mode_t mode = S_IFREG | op->mode;
+        if (op->type == APPENDFS_BATCH_MKDIR) {
+            mode = S_IFDIR | (op->mode & 0777);
+        } else if (op->type == APPENDFS_BATCH_SYMLINK) {
+            mode = S_IFLNK | 0777;
+        }
+        struct appendfs_inode *inode = create_inode(ctx, parent, name, name_len, mode);
+        if (!inode) {
+            return -1;
+        }
+        if (op->type == APPENDFS_BATCH_SYMLINK) {
+            inode->cold->symlink_target = strdup(op->target);
+            if (!inode->cold->symlink_target) {
+                discard_inode(ctx, inode);
+                return -1;
+            }
+            inode->size = (off_t)strlen(op->target);
+        }
+        publish_inode(ctx, inode);
+        *created = inode;
+        return 0;
+    }
+    struct appendfs_inode *inode = find_inode_by_path(ctx, op->path);
+    if (!inode) {
         errno = ENOENT;
         return -1;
     }
-    struct appendfs_xattr *attr = find_xattr(inode, name);
-    if (!attr) {
-        errno = ENODATA;
+    switch (op->type) {
+    case APPENDFS_BATCH_WRITE:
+        if (S_ISDIR(inode->mode)) {
+            errno = EISDIR;
+            return -1;
+        }
+        if (!S_ISREG(inode->mode) || op->offset < 0 || (op->size > 0 && !op->data)) {
+            errno = EINVAL;
+            return -1;
+        }
+        return 0;
+    case APPENDFS_BATCH_TRUNCATE:
+        if ((!S_ISREG(inode->mode) && !S_ISLNK(inode->mode)) || op->offset < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        return 0;
+    case APPENDFS_BATCH_SET_TIMES:
+        return 0;
+    case APPENDFS_BATCH_SETXATTR: {
+        if (!op->name || (op->size > 0 && !op->data)) {
+            errno = EINVAL;
+            return -1;
+        }
+        int existing = find_xattr(inode, op->name) || batch_sets_xattr(ctx, ops, index, inode, op->name);
+        if ((op->flags & XATTR_CREATE) && existing) {
+            errno = EEXIST;
+            return -1;
+        }
+        if ((op->flags & XATTR_REPLACE) && !existing) {
+            errno = ENODATA;
+            return -1;
+        }
+        return 0;
+    }
+    default:
+        errno = EINVAL;
         return -1;
     }
-    unsigned char *backup = NULL;
-    size_t backup_size = attr->size;
-    if (backup_size > 0) {
-        backup = malloc(backup_size);
-        if (!backup) {
+}
+
+static int batch_write(struct appendfs_context *ctx, const struct appendfs_batch_op *op) {
+    struct appendfs_inode *inode = find_inode_by_path(ctx, op->path);
+    /* Older bytes still buffered in a handle must not land on top of these. */
+    for (struct appendfs_file *file = ctx->lru_head; file; file = file->lru_next) {
+        if (file->inode == inode && flush_buffer(file) == -1) {
             return -1;
         }
-        memcpy(backup, attr->value, backup_size);
     }
-    if (remove_xattr_internal(inode, name) == -1) {
-        free(backup);
-        return -1;
+    const unsigned char *data = op->data;
+    size_t done = 0;
+    while (done < op->size) {
+        size_t chunk = op->size - done;
+        if (chunk > APPENDFS_MAX_BUFFER) {
+            chunk = APPENDFS_MAX_BUFFER;
+        }
+        if (append_data_extent(ctx, inode, op->offset + (off_t)done, data + done, chunk) == -1) {
+            return -1;
+        }
+        done += chunk;
     }
-    if (append_removexattr_record(ctx, inode, name) == -1) {
-        set_xattr_internal(inode, name, backup, backup_size, XATTR_CREATE);
-        free(backup);
+    return 0;
+}
+
+static int batch_apply(struct appendfs_context *ctx, const struct appendfs_batch_op *op, struct appendfs_inode *created) {
+    if (created) {
+        return append_create_record(ctx, created);
+    }
+    switch (op->type) {
+    case APPENDFS_BATCH_WRITE:
+        return batch_write(ctx, op);
+    case APPENDFS_BATCH_TRUNCATE:
+        return truncate_locked(ctx, op->path, op->offset);
+    case APPENDFS_BATCH_SET_TIMES:
+        return set_times_locked(ctx, op->path, op->times);
+    case APPENDFS_BATCH_SETXATTR:
+        return setxattr_locked(ctx, op->path, op->name, op->data, op->size, op->flags);
+    default:
+        errno = EINVAL;
         return -1;
     }
-    free(backup);
-    return 0;
 }
 
-int appendfs_fsync(struct appendfs_file *file, int datasync) {
-    if (!file) {
+/* Slots are handed out LIFO, so creations are undone newest first. */
+static void unpublish_created(struct appendfs_context *ctx, struct appendfs_inode **created, size_t from, size_t to) {
+    while (to-- > from) {
+        if (created[to]) {
+            detach_inode(ctx, created[to]);
+            unindex_inode_id(ctx, created[to]);
+            discard_inode(ctx, created[to]);
+        }
+    }
+}
+
+/*
+ * Validate every operation, then apply them with their records captured into
+ * ctx->group and log the group.  A failure while applying leaves operations
+ * applied in memory that must not reach the log half done, so the group is
+ * dropped and the context marked failed (see log_failed).
+ */
+static int batch_locked(struct appendfs_context *ctx, const struct appendfs_batch_op *ops, size_t count, size_t *failed_op) {
+    if (!ctx || (count > 0 && !ops)) {
         errno = EINVAL;
         return -1;
     }
-    if (appendfs_flush(file) == -1) {
+    if (count == 0) {
+        return 0;
+    }
+    struct appendfs_inode **created = calloc(count, sizeof(*created));
+    if (!created) {
         return -1;
     }
-    int data_fd = file->ctx->data_fd;
-    if (fsync(data_fd) == -1) {
+    uint64_t saved_next_id = ctx->next_inode_id;
+    size_t i = 0;
+    for (; i < count; ++i) {
+        if (batch_prepare(ctx, ops, i, &created[i]) == -1) {
+            break;
+        }
+    }
+    if (i < count) {
+        int saved_errno = errno;
+        if (failed_op) {
+            *failed_op = i;
+        }
+        unpublish_created(ctx, created, 0, i);
+        ctx->next_inode_id = saved_next_id;
+        free(created);
+        errno = saved_errno;
         return -1;
     }
-    if (!datasync) {
-        if (fsync(file->ctx->meta_fd) == -1) {
-            return -1;
+
+    ctx->group_capture = 1;
+    ctx->group_used = 0;
+    int rc = 0;
+    for (i = 0; i < count; ++i) {
+        if (batch_apply(ctx, &ops[i], created[i]) == -1) {
+            rc = -1;
+            if (failed_op) {
+                *failed_op = i;
+            }
+            break;
         }
     }
-    return 0;
+    int saved_errno = errno;
+    ctx->group_capture = 0;
+    if (rc == -1) {
+        /* Creations from the failed operation on were never applied. */
+        unpublish_created(ctx, created, i, count);
+        ctx->log_failed = 1;
+    } else if (ctx->group_used > 0 && write_record(ctx, APPENDFS_RECORD_GROUP, ctx->group, (uint32_t)ctx->group_used) == -1) {
+        saved_errno = errno;
+        ctx->log_failed = 1;
+        rc = -1;
+        if (failed_op) {
+            *failed_op = count;
+        }
+    } else if (settle_stage(ctx) == -1) {
+        /* The group stays queued for the next commit; report the error. */
+        saved_errno = errno;
+        rc = -1;
+        if (failed_op) {
+            *failed_op = count;
+        }
+    }
+    ctx->group_used = 0;
+    free(created);
+    errno = saved_errno;
+    return rc;
 }
 
-int appendfs_fsyncdir(struct appendfs_context *ctx) {
+int appendfs_batch(struct appendfs_context *ctx, const struct appendfs_batch_op *ops, size_t count, size_t *failed_op) {
     if (!ctx) {
         errno = EINVAL;
         return -1;
     }
-    if (fsync(ctx->meta_fd) == -1) {
+    uint64_t start = appendfs_opstats_now();
+    lock_context(ctx);
+    int rc = batch_locked(ctx, ops, count, failed_op);
+    unlock_context(ctx);
+    appendfs_opstats_record(&ctx->opstats, APPENDFS_OP_BATCH, start, rc == -1, 0);
+    return rc;
+}
+
+/* Check the whole stored range of an extent against its CRC32C. */
+static int verify_extent(struct appendfs_context *ctx, struct appendfs_extent *ext) {
+    size_t chunk = ext->stored_length < VERIFY_CHUNK ? ext->stored_length : VERIFY_CHUNK;
+    unsigned char *buf = malloc(chunk ? chunk : 1);
+    if (!buf) {
+        return -1;
+    }
+    uint32_t crc = 0;
+    size_t done = 0;
+    while (done < ext->stored_length) {
+        size_t len = ext->stored_length - done < chunk ? ext->stored_length - done : chunk;
+        if (read_data(ctx, buf, len, ext->data_offset + (off_t)done) == -1) {
+            free(buf);
+            return -1;
+        }
+        crc = appendfs_crc32c_update(crc, buf, len);
+        done += len;
+    }
+    free(buf);
+    if (crc != ext->checksum) {
+        errno = EIO;
         return -1;
     }
+    ext->flags |= EXTENT_VERIFIED;
     return 0;
 }
 
-off_t appendfs_seek(struct appendfs_file *file, off_t offset, int whence) {
-    if (!file) {
-        errno = EINVAL;
-        return (off_t)-1;
+/*
+ * Decompress a compressed extent into ctx->inflate_buf.  The last chunk
+ * decompressed stays there, keyed by its data offset, which never gets
+ * reused, so reads walking through a chunk decompress it once.
+ */
+static const unsigned char *inflate_extent(struct appendfs_context *ctx, const struct appendfs_extent *ext) {
+    if (ctx->inflate_offset == ext->data_offset) {
+        return ctx->inflate_buf;
+    }
+    if (!ctx->inflate_buf) {
+        ctx->inflate_buf = malloc(COMPRESS_CHUNK);
+    }
+    if (!ctx->compress_buf) {
+        ctx->compress_buf = malloc(appendfs_lz4_bound(COMPRESS_CHUNK));
+    }
+    if (!ctx->inflate_buf || !ctx->compress_buf) {
+        return NULL;
     }
-    if (file->buffer_used > 0) {
-        if (appendfs_flush(file) == -1) {
-            return (off_t)-1;
-        }
+    if (ext->stored_length > appendfs_lz4_bound(COMPRESS_CHUNK)) {
+        errno = EIO;
+        return NULL;
     }
-    struct appendfs_inode *inode = file->inode;
-    switch (whence) {
-    case SEEK_SET:
-    case SEEK_CUR:
-    case SEEK_END: {
-        off_t base = 0;
-        if (whence == SEEK_CUR) {
-            base = file->position;
-        } else if (whence == SEEK_END) {
-            base = inode->size;
-        }
-        off_t new_pos = base + offset;
-        if (new_pos < 0) {
-            errno = EINVAL;
-            return (off_t)-1;
-        }
-        file->position = new_pos;
-        return new_pos;
+    ctx->inflate_offset = -1;
+    if (read_data(ctx, ctx->compress_buf, ext->stored_length, ext->data_offset) == -1) {
+        return NULL;
     }
-#ifdef SEEK_DATA
-    case SEEK_DATA: {
-        if (offset < 0) {
-            errno = EINVAL;
-            return (off_t)-1;
-        }
-        if (offset >= inode->size) {
-            errno = ENXIO;
-            return (off_t)-1;
-        }
-        off_t result = -1;
-        for (size_t i = 0; i < inode->extent_count; ++i) {
-            struct appendfs_extent *ext = &inode->extents[i];
-            off_t start = ext->logical_offset;
-            off_t end = ext->logical_offset + ext->length;
-            if (end <= offset) {
-                continue;
-            }
-            if (offset < start) {
-                result = start;
-            } else {
-                result = offset;
-            }
-            break;
-        }
-        if (result < 0) {
-            errno = ENXIO;
-            return (off_t)-1;
-        }
-        file->position = result;
-        return result;
+    size_t decoded = 0;
+    if (appendfs_lz4_decompress(ctx->compress_buf, ext->stored_length, ctx->inflate_buf, COMPRESS_CHUNK, &decoded) == -1 || decoded < ext->length) {
+        errno = EIO;
+        return NULL;
     }
-#endif
-#ifdef SEEK_HOLE
-    case SEEK_HOLE: {
-        if (offset < 0) {
-            errno = EINVAL;
-            return (off_t)-1;
+    ctx->inflate_offset = ext->data_offset;
+    return ctx->inflate_buf;
+}
+
+static ssize_t read_inode(struct appendfs_context *ctx, struct appendfs_inode *inode, void *buf, size_t size, off_t offset) {
+    off_t file_size = visible_size(inode);
+    if (offset >= file_size) {
+        return 0;
+    }
+    unsigned char *out = buf;
+    off_t limit = offset + (off_t)size;
+    if (limit > file_size) {
+        limit = file_size;
+    }
+    size_t total = (size_t)(limit - offset);
+    /* Holes read as zeros; extents are in write order so later ones win. */
+    memset(out, 0, total);
+    off_t inline_end = (off_t)inode->cold->inline_size < limit ? (off_t)inode->cold->inline_size : limit;
+    if (inline_end > offset) {
+        memcpy(out, inode->cold->inline_data + offset, (size_t)(inline_end - offset));
+    }
+    for (size_t i = 0; i < inode->cold->extent_count; ++i) {
+        struct appendfs_extent *ext = &inode->cold->extents[i];
+        off_t ext_end = ext->logical_offset + ext->length;
+        off_t start = offset > ext->logical_offset ? offset : ext->logical_offset;
+        off_t end = ext_end < limit ? ext_end : limit;
+        if (start >= end) {
+            continue;
         }
-        if (offset >= inode->size) {
-            file->position = inode->size;
-            return inode->size;
+        if ((ctx->flags & APPENDFS_OPT_VERIFY_READS) &&
+            (ext->flags & (EXTENT_CHECKSUMMED | EXTENT_VERIFIED)) == EXTENT_CHECKSUMMED &&
+            verify_extent(ctx, ext) == -1) {
+            return -1;
         }
-        off_t pos = offset;
-        for (size_t i = 0; i < inode->extent_count; ++i) {
-            struct appendfs_extent *ext = &inode->extents[i];
-            off_t start = ext->logical_offset;
-            off_t end = ext->logical_offset + ext->length;
-            if (pos < start) {
-                file->position = pos;
-                return pos;
-            }
-            if (pos >= start && pos < end) {
-                pos = end;
+        size_t read_len = (size_t)(end - start);
+        if (ext->flags & EXTENT_COMPRESSED) {
+            const unsigned char *plain = inflate_extent(ctx, ext);
+            if (!plain) {
+                return -1;
             }
+            memcpy(out + (start - offset), plain + (start - ext->logical_offset), read_len);
+            continue;
         }
-        if (pos > inode->size) {
-            pos = inode->size;
+        off_t data_pos = ext->data_offset + (start - ext->logical_offset);
+        if (read_data(ctx, out + (start - offset), read_len, data_pos) == -1) {
+            return -1;
         }
-        file->position = pos;
-        return pos;
     }
-#endif
-    default:
-        errno = EINVAL;
-        return (off_t)-1;
+    overlay_buffers(inode, out, offset, limit);
+    if (total > 0) {
+        touch_atime(ctx, inode);
     }
+    return (ssize_t)total;
 }
 
-int appendfs_truncate(struct appendfs_context *ctx, const char *path, off_t size) {
-    if (!ctx || !path) {
+static ssize_t read_locked(struct appendfs_context *ctx, const char *path, void *buf, size_t size, off_t offset) {
+    if (!ctx || !path || !buf) {
         errno = EINVAL;
         return -1;
     }
     struct appendfs_inode *inode = find_inode_by_path(ctx, path);
-    if (!inode) {
+    if (!inode || inode->deleted) {
         errno = ENOENT;
         return -1;
     }
-    if (!S_ISREG(inode->mode) && !S_ISLNK(inode->mode)) {
+    return read_inode(ctx, inode, buf, size, offset);
+}
+
+ssize_t appendfs_read(struct appendfs_context *ctx, const char *path, void *buf, size_t size, off_t offset) {
+    if (!ctx) {
         errno = EINVAL;
         return -1;
     }
-    inode->size = size;
-    if (append_truncate_record(ctx, inode) == -1) {
-        return -1;
+    uint64_t start = appendfs_opstats_now();
+    lock_context(ctx);
+    ssize_t rc = read_locked(ctx, path, buf, size, offset);
+    unlock_context(ctx);
+    appendfs_opstats_record(&ctx->opstats, APPENDFS_OP_READ, start, rc < 0, rc > 0 ? (uint64_t)rc : 0);
+    return rc;
+}
+
+/* $dir/data ranges to advise once the context lock is dropped. */
+struct readahead_plan {
+    size_t count;
+    off_t offset[READAHEAD_RANGES];
+    off_t length[READAHEAD_RANGES];
+};
+
+static void plan_add(struct appendfs_context *ctx, struct readahead_plan *plan, off_t offset, off_t length) {
+    if (plan->count == READAHEAD_RANGES) {
+        return;
     }
-    for (size_t i = 0; i < inode->extent_count; ++i) {
-        struct appendfs_extent *ext = &inode->extents[i];
-        if (ext->logical_offset >= size) {
-            inode->extent_count = i;
-            break;
+    plan->offset[plan->count] = offset;
+    plan->length[plan->count] = length;
+    plan->count++;
+    ctx->readahead_calls++;
+    ctx->readahead_bytes += (uint64_t)length;
+}
+
+/*
+ * Collect the committed $dir/data ranges behind logical bytes [from, to) of
+ * the inode.  Extents written back to back sit next to each other in
+ * $dir/data and become one range.
+ */
+static void plan_range(struct appendfs_context *ctx, const struct appendfs_inode *inode, off_t from, off_t to, struct readahead_plan *plan) {
+    off_t run_start = 0;
+    off_t run_end = 0;
+    for (size_t i = 0; i < inode->cold->extent_count; ++i) {
+        const struct appendfs_extent *ext = &inode->cold->extents[i];
+        off_t start = from > ext->logical_offset ? from : ext->logical_offset;
+        off_t end = ext->logical_offset + ext->length < to ? ext->logical_offset + ext->length : to;
+        if (start >= end) {
+            continue;
         }
-        off_t end = ext->logical_offset + ext->length;
-        if (end > size) {
-            ext->length = (uint32_t)(size - ext->logical_offset);
-            inode->extent_count = i + 1;
-            break;
+        off_t data_start = ext->data_offset + (start - ext->logical_offset);
+        off_t data_end = ext->data_offset + (end - ext->logical_offset);
+        if (ext->flags & EXTENT_COMPRESSED) {
+            data_start = ext->data_offset;
+            data_end = ext->data_offset + ext->stored_length;
+        }
+        if (data_end > ctx->stage_offset) {
+            data_end = ctx->stage_offset;
+        }
+        if (data_start >= data_end) {
+            continue;
+        }
+        if (run_end > run_start && data_start == run_end) {
+            run_end = data_end;
+            continue;
+        }
+        if (run_end > run_start) {
+            plan_add(ctx, plan, run_start, run_end - run_start);
         }
+        run_start = data_start;
+        run_end = data_end;
+    }
+    if (run_end > run_start) {
+        plan_add(ctx, plan, run_start, run_end - run_start);
     }
-    inode->mtime = time(NULL);
-    return 0;
 }
 
-int appendfs_set_times(struct appendfs_context *ctx, const char *path, const struct timespec times[2]) {
-    if (!ctx || !path || !times) {
-        errno = EINVAL;
-        return -1;
+/*
+ * Per-handle readahead.  A read that starts where the previous one ended
+ * keeps the stream going; anything else resets it.  Once less than half a
+ * window is left ahead of the reader, the next stretch is planned and the
+ * window doubles, from READAHEAD_MIN up to READAHEAD_MAX.
+ */
+static void readahead_file(struct appendfs_file *file, off_t offset, size_t size, struct readahead_plan *plan) {
+    struct appendfs_context *ctx = file->ctx;
+    off_t end = offset + (off_t)size;
+    int sequential = offset == file->ra_next;
+    file->ra_next = end;
+    if (!sequential || !(ctx->flags & APPENDFS_OPT_READAHEAD)) {
+        file->ra_window = 0;
+        file->ra_end = 0;
+        return;
     }
-    struct appendfs_inode *inode = find_inode_by_path(ctx, path);
-    if (!inode || inode->deleted) {
-        errno = ENOENT;
-        return -1;
+    if (file->ra_end - end > (off_t)(file->ra_window / 2)) {
+        return;
     }
-    time_t now = time(NULL);
-    struct timespec atime = times[0];
-    struct timespec mtime = times[1];
-    if (atime.tv_nsec == UTIME_NOW) {
-        inode->atime = now;
-    } else if (atime.tv_nsec != UTIME_OMIT) {
-        inode->atime = atime.tv_sec;
+    if (file->ra_window == 0) {
+        file->ra_window = READAHEAD_MIN;
+    } else if (file->ra_window < READAHEAD_MAX) {
+        file->ra_window *= 2;
     }
-    if (mtime.tv_nsec == UTIME_NOW) {
-        inode->mtime = now;
-    } else if (mtime.tv_nsec != UTIME_OMIT) {
-        inode->mtime = mtime.tv_sec;
+    off_t from = file->ra_end > end ? file->ra_end : end;
+    off_t to = end + (off_t)file->ra_window;
+    if (to > file->inode->size) {
+        to = file->inode->size;
     }
-    inode->ctime = now;
-    if (append_times_record(ctx, inode) == -1) {
+    if (from < to) {
+        plan_range(ctx, file->inode, from, to, plan);
+    }
+    file->ra_end = to > end ? to : end;
+}
+
+/* Reads through a handle still work after the file is unlinked. */
+static ssize_t read_file_locked(struct appendfs_file *file, void *buf, size_t size, off_t offset, struct readahead_plan *plan) {
+    if (!file || !buf) {
+        errno = EINVAL;
         return -1;
     }
-    return 0;
+    ssize_t rc = read_inode(file->ctx, file->inode, buf, size, offset);
+    if (rc > 0) {
+        readahead_file(file, offset, (size_t)rc, plan);
+    }
+    return rc;
 }
 
-ssize_t appendfs_read(struct appendfs_context *ctx, const char *path, void *buf, size_t size, off_t offset) {
-    if (!ctx || !path || !buf) {
+/*
+ * WILLNEED starts the reads and returns, but allocating and submitting a
+ * large window still takes a while, so it runs outside the context lock.
+ * $dir/data never shrinks, so the ranges stay valid.
+ */
+ssize_t appendfs_read_file(struct appendfs_file *file, void *buf, size_t size, off_t offset) {
+    if (!file) {
         errno = EINVAL;
         return -1;
     }
-    struct appendfs_inode *inode = find_inode_by_path(ctx, path);
-    if (!inode || inode->deleted) {
-        errno = ENOENT;
+    struct appendfs_context *ctx = file->ctx;
+    struct readahead_plan plan;
+    plan.count = 0;
+    uint64_t start = appendfs_opstats_now();
+    lock_context(ctx);
+    ssize_t rc = read_file_locked(file, buf, size, offset, &plan);
+    int data_fd = ctx->data_fd;
+    unlock_context(ctx);
+    appendfs_opstats_record(&ctx->opstats, APPENDFS_OP_READ, start, rc < 0, rc > 0 ? (uint64_t)rc : 0);
+#ifdef POSIX_FADV_WILLNEED
+    for (size_t i = 0; i < plan.count; ++i) {
+        posix_fadvise(data_fd, plan.offset[i], plan.length[i], POSIX_FADV_WILLNEED);
+    }
+#else
+    (void)data_fd;
+#endif
+    return rc;
+}
+
+struct scrub_item {
+    uint64_t inode_id;
+    off_t logical_offset;
+    off_t data_offset;
+    uint32_t length;
+    uint32_t checksum;
+    int bad;
+};
+
+struct scrub_job {
+    int data_fd;
+    struct scrub_item *items;
+    size_t count;
+    size_t next;
+    pthread_mutex_t lock;
+};
+
+struct scrub_worker {
+    struct scrub_job *job;
+    uint64_t bytes;
+    uint64_t errors;
+};
+
+static int compare_scrub_items(const void *a, const void *b) {
+    const struct scrub_item *x = a;
+    const struct scrub_item *y = b;
+    return (x->data_offset > y->data_offset) - (x->data_offset < y->data_offset);
+}
+
+static void *scrub_main(void *arg) {
+    struct scrub_worker *worker = arg;
+    struct scrub_job *job = worker->job;
+    unsigned char *buf = malloc(VERIFY_CHUNK);
+    while (1) {
+        pthread_mutex_lock(&job->lock);
+        size_t idx = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (idx >= job->count) {
+            break;
+        }
+        struct scrub_item *item = &job->items[idx];
+        uint32_t crc = 0;
+        size_t done = 0;
+        while (buf && done < item->length) {
+            size_t len = item->length - done < VERIFY_CHUNK ? item->length - done : VERIFY_CHUNK;
+            if (pread_all(job->data_fd, buf, len, item->data_offset + (off_t)done) == -1) {
+                break;
+            }
+            crc = appendfs_crc32c_update(crc, buf, len);
+            done += len;
+        }
+        worker->bytes += done;
+        if (done < item->length || crc != item->checksum) {
+            item->bad = 1;
+            worker->errors++;
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+/*
+ * Verify every checksummed extent of every live inode.  The extent list is
+ * snapshotted under the context lock after committing the stage; the data
+ * file is append-only, so the workers read it without the lock, in data
+ * offset order.  Bad extents are reported through cb with the lock held.
+ */
+static int scrub_extents(struct appendfs_context *ctx, unsigned int threads, struct appendfs_scrub_report *report, appendfs_scrub_error_cb cb, void *user_data) {
+    memset(report, 0, sizeof(*report));
+    struct scrub_job job;
+    memset(&job, 0, sizeof(job));
+    job.data_fd = ctx->data_fd;
+
+    lock_context(ctx);
+    if (commit_stage(ctx) == -1) {
+        unlock_context(ctx);
         return -1;
     }
-    if (offset >= inode->size) {
-        return 0;
+    size_t capacity = 0;
+    for (size_t i = 0; i < ctx->inode_count; ++i) {
+        struct appendfs_inode *inode = ctx->inodes[i];
+        if (!inode->deleted) {
+            capacity += inode->cold->extent_count;
+        }
     }
-    unsigned char *out = buf;
-    size_t total = 0;
-    for (size_t i = 0; i < inode->extent_count && total < size; ++i) {
-        struct appendfs_extent *ext = &inode->extents[i];
-        off_t ext_end = ext->logical_offset + ext->length;
-        if (offset >= ext_end) {
+    job.items = calloc(capacity ? capacity : 1, sizeof(*job.items));
+    if (!job.items) {
+        unlock_context(ctx);
+        return -1;
+    }
+    for (size_t i = 0; i < ctx->inode_count; ++i) {
+        struct appendfs_inode *inode = ctx->inodes[i];
+        if (inode->deleted) {
             continue;
         }
-        off_t start = offset > ext->logical_offset ? offset : ext->logical_offset;
-        off_t end = ext_end;
-        if (end > offset + (off_t)(size - total)) {
-            end = offset + (off_t)(size - total);
+        for (size_t e = 0; e < inode->cold->extent_count; ++e) {
+            struct appendfs_extent *ext = &inode->cold->extents[e];
+            if (!(ext->flags & EXTENT_CHECKSUMMED)) {
+                report->extents_unchecksummed++;
+                continue;
+            }
+            struct scrub_item *item = &job.items[job.count++];
+            item->inode_id = inode->inode_id;
+            item->logical_offset = ext->logical_offset;
+            item->data_offset = ext->data_offset;
+            item->length = ext->stored_length;
+            item->checksum = ext->checksum;
         }
-        if (start >= end) {
-            continue;
+    }
+    unlock_context(ctx);
+
+    qsort(job.items, job.count, sizeof(*job.items), compare_scrub_items);
+    if (threads == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (unsigned int)online : 1;
+    }
+    if (threads > SCRUB_MAX_THREADS) {
+        threads = SCRUB_MAX_THREADS;
+    }
+    if (threads > job.count) {
+        threads = job.count ? (unsigned int)job.count : 1;
+    }
+    pthread_mutex_init(&job.lock, NULL);
+    struct scrub_worker workers[SCRUB_MAX_THREADS];
+    pthread_t tids[SCRUB_MAX_THREADS];
+    unsigned int started = 0;
+    memset(workers, 0, sizeof(workers));
+    for (unsigned int t = 0; t < threads; ++t) {
+        workers[t].job = &job;
+        if (t > 0 && pthread_create(&tids[t], NULL, scrub_main, &workers[t]) != 0) {
+            break;
         }
-        size_t read_len = (size_t)(end - start);
-        off_t data_pos = ext->data_offset + (start - ext->logical_offset);
-        if (pread(ctx->data_fd, out + total, read_len, data_pos) != (ssize_t)read_len) {
-            return -1;
+        started = t + 1;
+    }
+    scrub_main(&workers[0]);
+    for (unsigned int t = 1; t < started; ++t) {
+        pthread_join(tids[t], NULL);
+    }
+    pthread_mutex_destroy(&job.lock);
+
+    report->extents_checked = job.count;
+    for (unsigned int t = 0; t < started; ++t) {
+        report->bytes_checked += workers[t].bytes;
+        report->errors += workers[t].errors;
+    }
+    if (report->errors > 0 && cb) {
+        lock_context(ctx);
+        for (size_t i = 0; i < job.count; ++i) {
+            if (!job.items[i].bad) {
+                continue;
+            }
+            struct appendfs_inode *inode = find_inode_by_id(ctx, job.items[i].inode_id);
+            char *path = inode && !inode->deleted ? build_path(inode) : NULL;
+            cb(path, job.items[i].logical_offset, job.items[i].length, user_data);
+            free(path);
         }
-        total += read_len;
+        unlock_context(ctx);
     }
-    if (total > 0) {
-        inode->atime = time(NULL);
+    free(job.items);
+    return 0;
+}
+
+int appendfs_scrub(struct appendfs_context *ctx, unsigned int threads, struct appendfs_scrub_report *report, appendfs_scrub_error_cb cb, void *user_data) {
+    if (!ctx || !report) {
+        errno = EINVAL;
+        return -1;
     }
-    return (ssize_t)total;
+    uint64_t start = appendfs_opstats_now();
+    int rc = scrub_extents(ctx, threads, report, cb, user_data);
+    appendfs_opstats_record(&ctx->opstats, APPENDFS_OP_SCRUB, start, rc == -1, report->bytes_checked);
+    return rc;
 }
 
-int appendfs_stat(struct appendfs_context *ctx, const char *path, struct stat *st) {
+static int stat_locked(struct appendfs_context *ctx, const char *path, struct stat *st) {
     if (!ctx || !path || !st) {
         errno = EINVAL;
         return -1;
@@ -2133,16 +5570,30 @@ int appendfs_stat(struct appendfs_context *ctx, const char *path, struct stat *s
     }
     memset(st, 0, sizeof(*st));
     st->st_mode = inode->mode;
-    st->st_size = inode->size;
-    st->st_ctime = inode->ctime;
-    st->st_mtime = inode->mtime;
-    st->st_atime = inode->atime;
+    st->st_size = visible_size(inode);
+    st->st_ctim = ns_to_timespec(inode->ctime_ns);
+    st->st_mtim = ns_to_timespec(inode->mtime_ns);
+    st->st_atim = ns_to_timespec(inode->atime_ns);
     st->st_nlink = 1;
     st->st_ino = inode->inode_id;
+    st->st_blocks = (blkcnt_t)((inode->allocated + 511) / 512);
     return 0;
 }
 
-int appendfs_statfs(struct appendfs_context *ctx, struct statvfs *st) {
+int appendfs_stat(struct appendfs_context *ctx, const char *path, struct stat *st) {
+    if (!ctx) {
+        errno = EINVAL;
+        return -1;
+    }
+    uint64_t start = appendfs_opstats_now();
+    lock_context(ctx);
+    int rc = stat_locked(ctx, path, st);
+    unlock_context(ctx);
+    appendfs_opstats_record(&ctx->opstats, APPENDFS_OP_STAT, start, rc == -1, 0);
+    return rc;
+}
+
+static int statfs_locked(struct appendfs_context *ctx, struct statvfs *st) {
     if (!ctx || !st) {
         errno = EINVAL;
         return -1;
@@ -2150,5 +5601,36 @@ int appendfs_statfs(struct appendfs_context *ctx, struct statvfs *st) {
     if (statvfs(ctx->root_path, st) == -1) {
         return -1;
     }
+    /*
+     * Report a filesystem as large as the store's files plus the space still
+     * available below it.  Staged data, queued records and dirty buffers are
+     * charged as used before they reach the disk.
+     */
+    uint64_t unit = st->f_frsize ? st->f_frsize : st->f_bsize;
+    if (unit == 0) {
+        return 0;
+    }
+    uint64_t on_disk = (uint64_t)ctx->stage_offset + (uint64_t)ctx->meta_size;
+    uint64_t pending = ctx->stage_used + ctx->meta_pending_used + ctx->dirty_bytes;
+    uint64_t avail = st->f_bavail;
+    uint64_t pending_blocks = (pending + unit - 1) / unit;
+    avail = avail > pending_blocks ? avail - pending_blocks : 0;
+    uint64_t blocks = avail + (on_disk + pending + unit - 1) / unit;
+    st->f_blocks = (fsblkcnt_t)blocks;
+    st->f_bfree = (fsblkcnt_t)avail;
+    st->f_bavail = (fsblkcnt_t)avail;
     return 0;
 }
+
+int appendfs_statfs(struct appendfs_context *ctx, struct statvfs *st) {
+    if (!ctx) {
+        errno = EINVAL;
+        return -1;
+    }
+    uint64_t start = appendfs_opstats_now();
+    lock_context(ctx);
+    int rc = statfs_locked(ctx, st);
+    unlock_context(ctx);
+    appendfs_opstats_record(&ctx->opstats, APPENDFS_OP_STATFS, start, rc == -1, 0);
+    return rc;
+}
@@ -0,0 +1,89 @@
+#include "arena.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_MAX_BLOCK (16 * 1024 * 1024)
+
+struct appendfs_arena_block {
+    struct appendfs_arena_block *next;
+    size_t size;
+    size_t used;
+    unsigned char data[];
+};
+
+void appendfs_arena_init(struct appendfs_arena *arena, size_t first_block_size) {
+    memset(arena, 0, sizeof(*arena));
+    arena->next_block_size = first_block_size ? first_block_size : 64 * 1024;
+}
+
+void appendfs_arena_destroy(struct appendfs_arena *arena) {
+    struct appendfs_arena_block *block = arena->head;
+    while (block) {
+        struct appendfs_arena_block *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+    arena->blocks = 0;
+    arena->bytes_used = 0;
+}
+
+void *appendfs_arena_alloc(struct appendfs_arena *arena, size_t size) {
+    struct appendfs_arena_block *block = arena->head;
+    if (!block || block->size - block->used < size) {
+        size_t block_size = arena->next_block_size;
+        if (block_size < size) {
+            block_size = size;
+        }
+        block = malloc(sizeof(*block) + block_size);
+        if (!block) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        block->size = block_size;
+        block->used = 0;
+        /* Keep filling the newest block; a partly used older one is abandoned. */
+        block->next = arena->head;
+        arena->head = block;
+        arena->blocks++;
+        if (arena->next_block_size < ARENA_MAX_BLOCK) {
+            arena->next_block_size *= 2;
+        }
+    }
+    void *ptr = block->data + block->used;
+    block->used += size;
+    arena->bytes_used += size;
+    return ptr;
+}
+
+char *appendfs_arena_strndup(struct appendfs_arena *arena, const char *s, size_t len) {
+    char *copy = appendfs_arena_alloc(arena, len + 1);
+    if (!copy) {
+        return NULL;
+    }
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+void *appendfs_arena_memdup(struct appendfs_arena *arena, const void *data, size_t size) {
+    void *copy = appendfs_arena_alloc(arena, size);
+    if (copy && size > 0) {
+        memcpy(copy, data, size);
+    }
+    return copy;
+}
+
+int appendfs_arena_owns(const struct appendfs_arena *arena, const void *ptr) {
+    uintptr_t p = (uintptr_t)ptr;
+    for (const struct appendfs_arena_block *block = arena->head; block; block = block->next) {
+        uintptr_t start = (uintptr_t)block->data;
+        if (p >= start && p < start + block->size) {
+            return 1;
+        }
+    }
+    return 0;
+}
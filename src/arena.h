@@ -0,0 +1,27 @@
+#ifndef APPENDFS_ARENA_H
+#define APPENDFS_ARENA_H
+
+#include <stddef.h>
+
+/*
+ * Bump allocator for byte strings that live until the arena is destroyed.
+ * Individual allocations cannot be freed; appendfs_arena_owns() lets callers
+ * that mix arena and malloc'd pointers decide whether to free().
+ */
+struct appendfs_arena_block;
+
+struct appendfs_arena {
+    struct appendfs_arena_block *head;
+    size_t next_block_size;
+    size_t blocks;
+    size_t bytes_used;
+};
+
+void appendfs_arena_init(struct appendfs_arena *arena, size_t first_block_size);
+void appendfs_arena_destroy(struct appendfs_arena *arena);
+void *appendfs_arena_alloc(struct appendfs_arena *arena, size_t size);
+char *appendfs_arena_strndup(struct appendfs_arena *arena, const char *s, size_t len);
+void *appendfs_arena_memdup(struct appendfs_arena *arena, const void *data, size_t size);
+int appendfs_arena_owns(const struct appendfs_arena *arena, const void *ptr);
+
+#endif
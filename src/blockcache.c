@@ -0,0 +1,131 @@
+#include "blockcache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static size_t bucket_of(const struct appendfs_blockcache *cache, uint64_t block) {
+    block *= UINT64_C(0x9e3779b97f4a7c15);
+    return (size_t)(block ^ (block >> 29)) & (cache->bucket_count - 1);
+}
+
+static int ensure_tables(struct appendfs_blockcache *cache) {
+    if (cache->entries) {
+        return 0;
+    }
+    size_t bucket_count = 1;
+    while (bucket_count < cache->capacity) {
+        bucket_count *= 2;
+    }
+    cache->entries = calloc(cache->capacity, sizeof(*cache->entries));
+    cache->buckets = calloc(bucket_count, sizeof(*cache->buckets));
+    if (!cache->entries || !cache->buckets) {
+        free(cache->entries);
+        free(cache->buckets);
+        cache->entries = NULL;
+        cache->buckets = NULL;
+        return -1;
+    }
+    cache->bucket_count = bucket_count;
+    return 0;
+}
+
+static void unhash(struct appendfs_blockcache *cache, size_t idx) {
+    size_t *link = &cache->buckets[bucket_of(cache, cache->entries[idx].block)];
+    while (*link && *link != idx + 1) {
+        link = &cache->entries[*link - 1].hash_next;
+    }
+    if (*link) {
+        *link = cache->entries[idx].hash_next;
+    }
+}
+
+/* A free slot while the cache is filling, then the CLOCK victim. */
+static size_t take_slot(struct appendfs_blockcache *cache) {
+    if (cache->count < cache->capacity) {
+        struct appendfs_blockcache_entry *entry = &cache->entries[cache->count];
+        entry->data = malloc(APPENDFS_BLOCKCACHE_BLOCK);
+        if (!entry->data) {
+            return SIZE_MAX;
+        }
+        return cache->count++;
+    }
+    for (;;) {
+        size_t idx = cache->hand;
+        cache->hand = (cache->hand + 1) % cache->capacity;
+        if (cache->entries[idx].referenced) {
+            cache->entries[idx].referenced = 0;
+            continue;
+        }
+        unhash(cache, idx);
+        cache->evictions++;
+        return idx;
+    }
+}
+
+void appendfs_blockcache_init(struct appendfs_blockcache *cache, size_t budget) {
+    memset(cache, 0, sizeof(*cache));
+    cache->budget = budget;
+    cache->capacity = budget / APPENDFS_BLOCKCACHE_BLOCK;
+}
+
+void appendfs_blockcache_destroy(struct appendfs_blockcache *cache) {
+    for (size_t i = 0; i < cache->count; ++i) {
+        free(cache->entries[i].data);
+    }
+    free(cache->entries);
+    free(cache->buckets);
+    cache->entries = NULL;
+    cache->buckets = NULL;
+    cache->count = 0;
+    cache->hand = 0;
+    cache->bucket_count = 0;
+}
+
+/* A new budget drops the cached blocks; the counters carry on. */
+void appendfs_blockcache_set_budget(struct appendfs_blockcache *cache, size_t budget) {
+    if (budget == cache->budget) {
+        return;
+    }
+    appendfs_blockcache_destroy(cache);
+    cache->budget = budget;
+    cache->capacity = budget / APPENDFS_BLOCKCACHE_BLOCK;
+}
+
+/*
+ * Return the entry for block.  It is a hit when at least needed bytes are
+ * valid; otherwise the entry comes back with valid 0 and the caller fills
+ * the buffer and sets valid.  NULL means the block cannot be cached, because
+ * the budget is under one block or memory ran out.
+ */
+struct appendfs_blockcache_entry *appendfs_blockcache_get(struct appendfs_blockcache *cache, uint64_t block, size_t needed) {
+    if (cache->capacity == 0 || ensure_tables(cache) == -1) {
+        return NULL;
+    }
+    size_t *head = &cache->buckets[bucket_of(cache, block)];
+    for (size_t i = *head; i; i = cache->entries[i - 1].hash_next) {
+        struct appendfs_blockcache_entry *entry = &cache->entries[i - 1];
+        if (entry->block != block) {
+            continue;
+        }
+        entry->referenced = 1;
+        if (entry->valid >= needed) {
+            cache->hits++;
+        } else {
+            entry->valid = 0;
+            cache->misses++;
+        }
+        return entry;
+    }
+    cache->misses++;
+    size_t idx = take_slot(cache);
+    if (idx == SIZE_MAX) {
+        return NULL;
+    }
+    struct appendfs_blockcache_entry *entry = &cache->entries[idx];
+    entry->block = block;
+    entry->valid = 0;
+    entry->referenced = 0;
+    entry->hash_next = *head;
+    *head = idx + 1;
+    return entry;
+}
@@ -0,0 +1,48 @@
+#ifndef APPENDFS_BLOCKCACHE_H
+#define APPENDFS_BLOCKCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define APPENDFS_BLOCKCACHE_BLOCK (32 * 1024)
+
+/*
+ * A cache of $dir/data blocks keyed by block number.  The data file is
+ * append-only, so cached bytes never go stale; the block at the end of the
+ * file may hold only its first valid bytes and is refilled once a read needs
+ * more of it.  The caller serialises access.
+ */
+struct appendfs_blockcache_entry {
+    uint64_t block;
+    uint32_t valid;
+    uint32_t referenced;
+    size_t hash_next;
+    unsigned char *data;
+};
+
+/*
+ * Eviction is CLOCK: a hit sets the referenced bit and the hand clears bits
+ * until it reaches an unreferenced block.  New blocks start unreferenced, so
+ * blocks read once by a scan go before blocks that were read again.
+ * Entries, buckets and block buffers are allocated on first use.  Chains
+ * hold entry index + 1, with 0 ending a chain.
+ */
+struct appendfs_blockcache {
+    size_t budget;
+    size_t capacity;
+    size_t count;
+    size_t hand;
+    struct appendfs_blockcache_entry *entries;
+    size_t *buckets;
+    size_t bucket_count;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+void appendfs_blockcache_init(struct appendfs_blockcache *cache, size_t budget);
+void appendfs_blockcache_destroy(struct appendfs_blockcache *cache);
+void appendfs_blockcache_set_budget(struct appendfs_blockcache *cache, size_t budget);
+struct appendfs_blockcache_entry *appendfs_blockcache_get(struct appendfs_blockcache *cache, uint64_t block, size_t needed);
+
+#endif
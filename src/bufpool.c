@@ -0,0 +1,102 @@
+#include "bufpool.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+static size_t class_index(size_t size) {
+    size_t idx = 0;
+    while (idx < APPENDFS_BUFPOOL_CLASSES && ((size_t)1 << (APPENDFS_BUFPOOL_MIN_SHIFT + idx)) < size) {
+        idx++;
+    }
+    return idx;
+}
+
+static size_t class_bytes(size_t idx) {
+    return (size_t)1 << (APPENDFS_BUFPOOL_MIN_SHIFT + idx);
+}
+
+static void *pop_free(struct appendfs_bufpool *pool, size_t idx) {
+    void *buf = pool->free_lists[idx];
+    if (buf) {
+        memcpy(&pool->free_lists[idx], buf, sizeof(void *));
+        pool->cached -= class_bytes(idx);
+    }
+    return buf;
+}
+
+static void trim_cached(struct appendfs_bufpool *pool, size_t max_cached) {
+    size_t idx = APPENDFS_BUFPOOL_CLASSES;
+    while (pool->cached > max_cached && idx > 0) {
+        void *buf = pop_free(pool, idx - 1);
+        if (!buf) {
+            idx--;
+            continue;
+        }
+        free(buf);
+    }
+}
+
+void appendfs_bufpool_init(struct appendfs_bufpool *pool, size_t limit) {
+    memset(pool, 0, sizeof(*pool));
+    pool->limit = limit;
+}
+
+void appendfs_bufpool_destroy(struct appendfs_bufpool *pool) {
+    trim_cached(pool, 0);
+}
+
+void appendfs_bufpool_set_limit(struct appendfs_bufpool *pool, size_t limit) {
+    pool->limit = limit;
+    size_t headroom = limit > pool->in_use ? limit - pool->in_use : 0;
+    if (headroom > limit / 4) {
+        headroom = limit / 4;
+    }
+    trim_cached(pool, headroom);
+}
+
+size_t appendfs_bufpool_class_size(size_t size) {
+    size_t idx = class_index(size);
+    return idx < APPENDFS_BUFPOOL_CLASSES ? class_bytes(idx) : size;
+}
+
+void *appendfs_bufpool_get(struct appendfs_bufpool *pool, size_t size) {
+    size_t idx = class_index(size);
+    size_t bytes = idx < APPENDFS_BUFPOOL_CLASSES ? class_bytes(idx) : size;
+    if (idx < APPENDFS_BUFPOOL_CLASSES) {
+        void *buf = pop_free(pool, idx);
+        if (buf) {
+            pool->in_use += bytes;
+            return buf;
+        }
+    }
+    if (bytes > pool->limit || pool->in_use > pool->limit - bytes) {
+        errno = ENOBUFS;
+        return NULL;
+    }
+    trim_cached(pool, pool->limit - pool->in_use - bytes);
+    void *buf = malloc(bytes);
+    if (!buf) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    pool->in_use += bytes;
+    return buf;
+}
+
+void appendfs_bufpool_put(struct appendfs_bufpool *pool, void *buf, size_t size) {
+    if (!buf) {
+        return;
+    }
+    size_t idx = class_index(size);
+    size_t bytes = idx < APPENDFS_BUFPOOL_CLASSES ? class_bytes(idx) : size;
+    pool->in_use -= bytes;
+    if (idx < APPENDFS_BUFPOOL_CLASSES && pool->cached + bytes <= pool->limit / 4 &&
+        pool->in_use + pool->cached + bytes <= pool->limit) {
+        memcpy(buf, &pool->free_lists[idx], sizeof(void *));
+        pool->free_lists[idx] = buf;
+        pool->cached += bytes;
+        return;
+    }
+    free(buf);
+}
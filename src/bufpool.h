@@ -0,0 +1,23 @@
+#ifndef APPENDFS_BUFPOOL_H
+#define APPENDFS_BUFPOOL_H
+
+#include <stddef.h>
+
+#define APPENDFS_BUFPOOL_MIN_SHIFT 16
+#define APPENDFS_BUFPOOL_CLASSES 11
+
+struct appendfs_bufpool {
+    size_t limit;
+    size_t in_use;
+    size_t cached;
+    void *free_lists[APPENDFS_BUFPOOL_CLASSES];
+};
+
+void appendfs_bufpool_init(struct appendfs_bufpool *pool, size_t limit);
+void appendfs_bufpool_destroy(struct appendfs_bufpool *pool);
+void appendfs_bufpool_set_limit(struct appendfs_bufpool *pool, size_t limit);
+size_t appendfs_bufpool_class_size(size_t size);
+void *appendfs_bufpool_get(struct appendfs_bufpool *pool, size_t size);
+void appendfs_bufpool_put(struct appendfs_bufpool *pool, void *buf, size_t size);
+
+#endif
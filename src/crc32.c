@@ -1,27 +1,64 @@
 #include "crc32.h"
 
+#include <pthread.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define APPENDFS_CRC32C_SSE42 1
+#include <nmmintrin.h>
+#endif
+
 static uint32_t crc_table[256];
-static int crc_table_initialized = 0;
+static uint32_t crc32c_table[8][256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+static uint32_t (*crc32c_impl)(uint32_t crc, const unsigned char *buf, size_t length);
+static const char *crc32c_impl_name;
+
+static uint32_t crc32c_slice8(uint32_t crc, const unsigned char *buf, size_t length);
+#ifdef APPENDFS_CRC32C_SSE42
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *buf, size_t length);
+#endif
 
 static void appendfs_crc32_init(void) {
     for (uint32_t i = 0; i < 256; ++i) {
         uint32_t c = i;
+        uint32_t k = i;
         for (int j = 0; j < 8; ++j) {
             if (c & 1) {
                 c = 0xedb88320u ^ (c >> 1);
             } else {
                 c >>= 1;
             }
+            if (k & 1) {
+                k = 0x82f63b78u ^ (k >> 1);
+            } else {
+                k >>= 1;
+            }
         }
         crc_table[i] = c;
+        crc32c_table[0][i] = k;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t k = crc32c_table[0][i];
+        for (int t = 1; t < 8; ++t) {
+            k = crc32c_table[0][k & 0xffu] ^ (k >> 8);
+            crc32c_table[t][i] = k;
+        }
     }
-    crc_table_initialized = 1;
+
+    crc32c_impl = crc32c_slice8;
+    crc32c_impl_name = "slice8";
+#ifdef APPENDFS_CRC32C_SSE42
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc32c_impl = crc32c_sse42;
+        crc32c_impl_name = "sse4.2";
+    }
+#endif
 }
 
 uint32_t appendfs_crc32(const void *data, size_t length) {
-    if (!crc_table_initialized) {
-        appendfs_crc32_init();
-    }
+    pthread_once(&crc_once, appendfs_crc32_init);
 
     const unsigned char *buf = (const unsigned char *)data;
     uint32_t c = 0xffffffffu;
@@ -32,3 +69,88 @@ uint32_t appendfs_crc32(const void *data, size_t length) {
 
     return c ^ 0xffffffffu;
 }
+
+static uint32_t crc32c_slice8(uint32_t crc, const unsigned char *buf, size_t length) {
+    while (length > 0 && ((uintptr_t)buf & 7u) != 0) {
+        crc = crc32c_table[0][(crc ^ *buf++) & 0xffu] ^ (crc >> 8);
+        length--;
+    }
+    while (length >= 8) {
+        uint32_t lo = 0;
+        uint32_t hi = 0;
+        memcpy(&lo, buf, sizeof(lo));
+        memcpy(&hi, buf + 4, sizeof(hi));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        lo = __builtin_bswap32(lo);
+        hi = __builtin_bswap32(hi);
+#endif
+        lo ^= crc;
+        crc = crc32c_table[7][lo & 0xffu] ^
+              crc32c_table[6][(lo >> 8) & 0xffu] ^
+              crc32c_table[5][(lo >> 16) & 0xffu] ^
+              crc32c_table[4][lo >> 24] ^
+              crc32c_table[3][hi & 0xffu] ^
+              crc32c_table[2][(hi >> 8) & 0xffu] ^
+              crc32c_table[1][(hi >> 16) & 0xffu] ^
+              crc32c_table[0][hi >> 24];
+        buf += 8;
+        length -= 8;
+    }
+    while (length > 0) {
+        crc = crc32c_table[0][(crc ^ *buf++) & 0xffu] ^ (crc >> 8);
+        length--;
+    }
+    return crc;
+}
+
+#ifdef APPENDFS_CRC32C_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *buf, size_t length) {
+    while (length > 0 && ((uintptr_t)buf & 7u) != 0) {
+        crc = _mm_crc32_u8(crc, *buf++);
+        length--;
+    }
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    while (length >= 8) {
+        uint64_t word = 0;
+        memcpy(&word, buf, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        buf += 8;
+        length -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+    while (length >= 4) {
+        uint32_t word = 0;
+        memcpy(&word, buf, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+        buf += 4;
+        length -= 4;
+    }
+    while (length > 0) {
+        crc = _mm_crc32_u8(crc, *buf++);
+        length--;
+    }
+    return crc;
+}
+#endif
+
+uint32_t appendfs_crc32c_update(uint32_t crc, const void *data, size_t length) {
+    pthread_once(&crc_once, appendfs_crc32_init);
+    return crc32c_impl(crc ^ 0xffffffffu, (const unsigned char *)data, length) ^ 0xffffffffu;
+}
+
+uint32_t appendfs_crc32c_update_sw(uint32_t crc, const void *data, size_t length) {
+    pthread_once(&crc_once, appendfs_crc32_init);
+    return crc32c_slice8(crc ^ 0xffffffffu, (const unsigned char *)data, length) ^ 0xffffffffu;
+}
+
+uint32_t appendfs_crc32c(const void *data, size_t length) {
+    return appendfs_crc32c_update(0, data, length);
+}
+
+const char *appendfs_crc32c_backend(void) {
+    pthread_once(&crc_once, appendfs_crc32_init);
+    return crc32c_impl_name;
+}
@@ -4,6 +4,18 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/* Legacy CRC32 (polynomial 0xedb88320) used by unversioned records. */
 uint32_t appendfs_crc32(const void *data, size_t length);
 
+/*
+ * CRC32C (Castagnoli, polynomial 0x82f63b78).  The update form takes and
+ * returns a finalized value, so appendfs_crc32c_update(0, ...) starts a new
+ * checksum and ranges can be chained.  The first call selects the SSE4.2
+ * implementation when the CPU supports it and slicing-by-8 otherwise.
+ */
+uint32_t appendfs_crc32c(const void *data, size_t length);
+uint32_t appendfs_crc32c_update(uint32_t crc, const void *data, size_t length);
+uint32_t appendfs_crc32c_update_sw(uint32_t crc, const void *data, size_t length);
+const char *appendfs_crc32c_backend(void);
+
 #endif
@@ -8,6 +8,8 @@
 #include <fuse3/fuse_opt.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -20,11 +22,28 @@
 struct afs_config {
     char *store_path;
     size_t write_buffer;
+    size_t buffer_pool;
+    size_t min_buffer;
+    size_t max_buffer;
+    size_t read_cache;
+    unsigned int flush_interval;
+    unsigned int flush_age;
+    int no_flusher;
+    int verify_reads;
+    int strict_atime;
+    int no_atime;
+    int no_read_cache;
+    int readahead;
+    int no_inline;
+    int compress;
+    char *trace_file;
 };
 
 struct afs_state {
     struct appendfs_context *ctx;
     struct afs_config config;
+    pthread_t dumper;
+    int dumper_started;
 };
 
 #define AFS_OPT_KEY(t, p, v) { t, offsetof(struct afs_config, p), v }
@@ -34,6 +53,36 @@ static struct fuse_opt afs_opts[] = {
     AFS_OPT_KEY("store=%s", store_path, 0),
     AFS_OPT_KEY("--buffer=%zu", write_buffer, 0),
     AFS_OPT_KEY("buffer=%zu", write_buffer, 0),
+    AFS_OPT_KEY("--buffer-pool=%zu", buffer_pool, 0),
+    AFS_OPT_KEY("buffer_pool=%zu", buffer_pool, 0),
+    AFS_OPT_KEY("--min-buffer=%zu", min_buffer, 0),
+    AFS_OPT_KEY("min_buffer=%zu", min_buffer, 0),
+    AFS_OPT_KEY("--max-buffer=%zu", max_buffer, 0),
+    AFS_OPT_KEY("max_buffer=%zu", max_buffer, 0),
+    AFS_OPT_KEY("--read-cache=%zu", read_cache, 0),
+    AFS_OPT_KEY("read_cache=%zu", read_cache, 0),
+    AFS_OPT_KEY("--no-read-cache", no_read_cache, 1),
+    AFS_OPT_KEY("no_read_cache", no_read_cache, 1),
+    AFS_OPT_KEY("--readahead", readahead, 1),
+    AFS_OPT_KEY("readahead", readahead, 1),
+    AFS_OPT_KEY("--no-inline", no_inline, 1),
+    AFS_OPT_KEY("no_inline", no_inline, 1),
+    AFS_OPT_KEY("--compress", compress, 1),
+    AFS_OPT_KEY("compress", compress, 1),
+    AFS_OPT_KEY("--flush-interval=%u", flush_interval, 0),
+    AFS_OPT_KEY("flush_interval=%u", flush_interval, 0),
+    AFS_OPT_KEY("--flush-age=%u", flush_age, 0),
+    AFS_OPT_KEY("flush_age=%u", flush_age, 0),
+    AFS_OPT_KEY("--no-flusher", no_flusher, 1),
+    AFS_OPT_KEY("no_flusher", no_flusher, 1),
+    AFS_OPT_KEY("--verify-reads", verify_reads, 1),
+    AFS_OPT_KEY("verify_reads", verify_reads, 1),
+    AFS_OPT_KEY("--strict-atime", strict_atime, 1),
+    AFS_OPT_KEY("strict_atime", strict_atime, 1),
+    AFS_OPT_KEY("--no-atime", no_atime, 1),
+    AFS_OPT_KEY("no_atime", no_atime, 1),
+    AFS_OPT_KEY("--trace-file=%s", trace_file, 0),
+    AFS_OPT_KEY("trace_file=%s", trace_file, 0),
     FUSE_OPT_END
 };
 
@@ -43,6 +92,210 @@ static struct appendfs_context *afs_context(void) {
     return state->ctx;
 }
 
+/*
+ * /.appendfs is a read-only control directory served by the daemon rather
+ * than the store (it hides a stored entry of the same name and is left out
+ * of root listings).  Each file in it returns the text of one formatter as
+ * of open(); the snapshot is kept in fi->fh.
+ */
+#define AFS_CONTROL_DIR "/.appendfs"
+
+struct afs_control_file {
+    const char *name;
+    ssize_t (*format)(struct appendfs_context *ctx, char *buf, size_t size);
+};
+
+static const struct afs_control_file afs_control_files[] = {
+    {"stats", appendfs_format_op_stats},
+    {"trace", appendfs_format_trace},
+};
+
+#define AFS_CONTROL_FILE_COUNT (sizeof(afs_control_files) / sizeof(afs_control_files[0]))
+
+struct afs_snapshot {
+    size_t size;
+    char data[];
+};
+
+static int afs_is_control(const char *path) {
+    size_t len = strlen(AFS_CONTROL_DIR);
+    return path && strncmp(path, AFS_CONTROL_DIR, len) == 0 && (path[len] == '\0' || path[len] == '/');
+}
+
+static int afs_is_control_dir(const char *path) {
+    return strcmp(path, AFS_CONTROL_DIR) == 0;
+}
+
+static const struct afs_control_file *afs_control_file(const char *path) {
+    size_t len = strlen(AFS_CONTROL_DIR);
+    if (!afs_is_control(path) || path[len] != '/') {
+        return NULL;
+    }
+    for (size_t i = 0; i < AFS_CONTROL_FILE_COUNT; ++i) {
+        if (strcmp(path + len + 1, afs_control_files[i].name) == 0) {
+            return &afs_control_files[i];
+        }
+    }
+    return NULL;
+}
+
+static int afs_control_stat(const char *path, struct stat *stbuf) {
+    struct fuse_context *fc = fuse_get_context();
+    memset(stbuf, 0, sizeof(*stbuf));
+    if (afs_is_control_dir(path)) {
+        stbuf->st_mode = S_IFDIR | 0555;
+        stbuf->st_nlink = 2;
+    } else if (afs_control_file(path)) {
+        stbuf->st_mode = S_IFREG | 0444;
+        stbuf->st_nlink = 1;
+    } else {
+        return -ENOENT;
+    }
+    stbuf->st_uid = fc->uid;
+    stbuf->st_gid = fc->gid;
+    return 0;
+}
+
+static struct afs_snapshot *afs_snapshot(struct appendfs_context *ctx, const struct afs_control_file *control) {
+    for (;;) {
+        ssize_t need = control->format(ctx, NULL, 0);
+        if (need < 0) {
+            return NULL;
+        }
+        /* Leave room for what is added between the two calls. */
+        size_t capacity = (size_t)need + 4096;
+        struct afs_snapshot *snap = malloc(sizeof(*snap) + capacity);
+        if (!snap) {
+            return NULL;
+        }
+        ssize_t len = control->format(ctx, snap->data, capacity);
+        if (len >= 0) {
+            snap->size = (size_t)len;
+            return snap;
+        }
+        free(snap);
+        if (errno != ERANGE) {
+            return NULL;
+        }
+    }
+}
+
+/*
+ * SIGUSR1 appends a snapshot of every control file (stats, then the trace
+ * ring) to --trace-file, or to stderr.  The handler only writes a byte to a
+ * pipe; a thread started from init, after FUSE has daemonized, does the
+ * formatting and I/O.
+ */
+static int afs_dump_pipe[2] = {-1, -1};
+
+static void afs_dump_signal(int sig) {
+    (void)sig;
+    int saved = errno;
+    char c = 'd';
+    ssize_t rc = write(afs_dump_pipe[1], &c, 1);
+    (void)rc;
+    errno = saved;
+}
+
+static int afs_write_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t rc = write(fd, data, size);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += rc;
+        size -= (size_t)rc;
+    }
+    return 0;
+}
+
+static void afs_write_dump(struct afs_state *state) {
+    int fd = STDERR_FILENO;
+    if (state->config.trace_file) {
+        fd = open(state->config.trace_file, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd == -1) {
+            fprintf(stderr, "appendfs: cannot open %s: %s\n", state->config.trace_file, strerror(errno));
+            return;
+        }
+    }
+    for (size_t i = 0; i < AFS_CONTROL_FILE_COUNT; ++i) {
+        struct afs_snapshot *snap = afs_snapshot(state->ctx, &afs_control_files[i]);
+        if (!snap) {
+            continue;
+        }
+        char header[128];
+        int len = snprintf(header, sizeof(header), "# appendfs %s pid=%ld time=%ld\n", afs_control_files[i].name, (long)getpid(), (long)time(NULL));
+        if (afs_write_all(fd, header, (size_t)len) == -1 || afs_write_all(fd, snap->data, snap->size) == -1) {
+            free(snap);
+            break;
+        }
+        free(snap);
+    }
+    if (fd != STDERR_FILENO) {
+        close(fd);
+    }
+}
+
+static void *afs_dumper(void *arg) {
+    struct afs_state *state = (struct afs_state *)arg;
+    for (;;) {
+        char c;
+        ssize_t rc = read(afs_dump_pipe[0], &c, 1);
+        if (rc == -1 && errno == EINTR) {
+            continue;
+        }
+        if (rc != 1 || c != 'd') {
+            break;
+        }
+        afs_write_dump(state);
+    }
+    return NULL;
+}
+
+static void *afs_init(struct fuse_conn_info *conn, struct fuse_config *cfg) {
+    (void)conn;
+    (void)cfg;
+    struct afs_state *state = (struct afs_state *)fuse_get_context()->private_data;
+    if (pipe(afs_dump_pipe) == -1) {
+        return state;
+    }
+    fcntl(afs_dump_pipe[1], F_SETFL, O_NONBLOCK);
+    if (pthread_create(&state->dumper, NULL, afs_dumper, state) != 0) {
+        close(afs_dump_pipe[0]);
+        close(afs_dump_pipe[1]);
+        afs_dump_pipe[0] = afs_dump_pipe[1] = -1;
+        return state;
+    }
+    state->dumper_started = 1;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = afs_dump_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+    return state;
+}
+
+static void afs_destroy(void *private_data) {
+    struct afs_state *state = (struct afs_state *)private_data;
+    if (!state->dumper_started) {
+        return;
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_DFL;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+    /* Closing the write end ends the dumper's read loop. */
+    close(afs_dump_pipe[1]);
+    pthread_join(state->dumper, NULL);
+    close(afs_dump_pipe[0]);
+    afs_dump_pipe[0] = afs_dump_pipe[1] = -1;
+    state->dumper_started = 0;
+}
+
 static int afs_fill_stat(const char *path, struct stat *stbuf) {
     struct fuse_context *fc = fuse_get_context();
     memset(stbuf, 0, sizeof(*stbuf));
@@ -69,6 +322,9 @@ static int afs_fill_stat(const char *path, struct stat *stbuf) {
 
 static int afs_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi) {
     (void)fi;
+    if (afs_is_control(path)) {
+        return afs_control_stat(path, stbuf);
+    }
     if (afs_fill_stat(path, stbuf) == -1) {
         return -errno;
     }
@@ -77,6 +333,13 @@ static int afs_getattr(const char *path, struct stat *stbuf, struct fuse_file_in
 
 static int afs_access(const char *path, int mask) {
     struct stat st;
+    if (afs_is_control(path)) {
+        int rc = afs_control_stat(path, &st);
+        if (rc != 0) {
+            return rc;
+        }
+        return (mask & W_OK) ? -EACCES : 0;
+    }
     if (strcmp(path, "/") == 0) {
         memset(&st, 0, sizeof(st));
         st.st_mode = S_IFDIR | 0755;
@@ -109,6 +372,11 @@ static int afs_opendir(const char *path, struct fuse_file_info *fi) {
     if (strcmp(path, "/") == 0) {
         return 0;
     }
+    if (afs_is_control(path)) {
+        struct stat st;
+        int rc = afs_control_stat(path, &st);
+        return rc != 0 ? rc : (S_ISDIR(st.st_mode) ? 0 : -ENOTDIR);
+    }
     struct stat st;
     if (appendfs_stat(afs_context(), path, &st) == -1) {
         return -errno;
@@ -134,9 +402,10 @@ static int afs_readdir_cb(const char *name, const struct appendfs_inode_info *in
     st.st_mode = info->mode;
     st.st_nlink = S_ISDIR(info->mode) ? 2 : 1;
     st.st_size = info->size;
-    st.st_ctime = info->ctime;
-    st.st_mtime = info->mtime;
-    st.st_atime = info->atime;
+    st.st_blocks = info->blocks;
+    st.st_ctim = info->ctim;
+    st.st_mtim = info->mtim;
+    st.st_atim = info->atim;
     st.st_uid = ctx->uid;
     st.st_gid = ctx->gid;
     st.st_ino = info->inode_id;
@@ -167,6 +436,22 @@ static int afs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_
         .gid = fc->gid,
     };
     struct stat current;
+    if (afs_is_control(path)) {
+        if (!afs_is_control_dir(path)) {
+            return -ENOTDIR;
+        }
+        afs_control_stat(path, &current);
+        filler(buf, ".", &current, 0, fill_flags);
+        filler(buf, "..", NULL, 0, fill_flags);
+        for (size_t i = 0; i < AFS_CONTROL_FILE_COUNT; ++i) {
+            char entry_path[64];
+            struct stat entry;
+            snprintf(entry_path, sizeof(entry_path), AFS_CONTROL_DIR "/%s", afs_control_files[i].name);
+            afs_control_stat(entry_path, &entry);
+            filler(buf, afs_control_files[i].name, &entry, 0, fill_flags);
+        }
+        return 0;
+    }
     if (afs_fill_stat(path, &current) == -1) {
         return -errno;
     }
@@ -204,6 +489,9 @@ static int afs_releasedir(const char *path, struct fuse_file_info *fi) {
 }
 
 static int afs_mkdir(const char *path, mode_t mode) {
+    if (afs_is_control(path)) {
+        return -EPERM;
+    }
     if (appendfs_mkdir(afs_context(), path, mode) == -1) {
         return -errno;
     }
@@ -211,6 +499,9 @@ static int afs_mkdir(const char *path, mode_t mode) {
 }
 
 static int afs_unlink(const char *path) {
+    if (afs_is_control(path)) {
+        return -EPERM;
+    }
     if (appendfs_unlink(afs_context(), path) == -1) {
         return -errno;
     }
@@ -218,6 +509,9 @@ static int afs_unlink(const char *path) {
 }
 
 static int afs_rmdir(const char *path) {
+    if (afs_is_control(path)) {
+        return -EPERM;
+    }
     if (appendfs_rmdir(afs_context(), path) == -1) {
         return -errno;
     }
@@ -228,6 +522,9 @@ static int afs_rename(const char *from, const char *to, unsigned int flags) {
     if (flags != 0) {
         return -EOPNOTSUPP;
     }
+    if (afs_is_control(from) || afs_is_control(to)) {
+        return -EPERM;
+    }
     if (appendfs_rename(afs_context(), from, to) == -1) {
         return -errno;
     }
@@ -241,6 +538,9 @@ static int afs_link(const char *from, const char *to) {
 }
 
 static int afs_symlink(const char *from, const char *to) {
+    if (afs_is_control(to)) {
+        return -EPERM;
+    }
     if (appendfs_symlink(afs_context(), from, to, 0777) == -1) {
         return -errno;
     }
@@ -248,6 +548,9 @@ static int afs_symlink(const char *from, const char *to) {
 }
 
 static int afs_readlink(const char *path, char *buf, size_t size) {
+    if (afs_is_control(path)) {
+        return -EINVAL;
+    }
     ssize_t rc = appendfs_readlink(afs_context(), path, buf, size);
     if (rc < 0) {
         return -errno;
@@ -260,6 +563,9 @@ static struct appendfs_file *afs_file_from_fi(struct fuse_file_info *fi) {
 }
 
 static int afs_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
+    if (afs_is_control(path)) {
+        return -EPERM;
+    }
     struct appendfs_file *file = appendfs_open_file(afs_context(), path, fi->flags, mode);
     if (!file) {
         return -errno;
@@ -269,6 +575,22 @@ static int afs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
 }
 
 static int afs_open(const char *path, struct fuse_file_info *fi) {
+    if (afs_is_control(path)) {
+        const struct afs_control_file *control = afs_control_file(path);
+        if (!control) {
+            return afs_is_control_dir(path) ? -EISDIR : -ENOENT;
+        }
+        if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+            return -EACCES;
+        }
+        struct afs_snapshot *snap = afs_snapshot(afs_context(), control);
+        if (!snap) {
+            return -errno;
+        }
+        fi->fh = (uint64_t)(uintptr_t)snap;
+        fi->direct_io = 1;
+        return 0;
+    }
     int flags = fi->flags & ~(O_CREAT | O_EXCL);
     struct appendfs_file *file = appendfs_open_file(afs_context(), path, flags, 0);
     if (!file) {
@@ -279,7 +601,9 @@ static int afs_open(const char *path, struct fuse_file_info *fi) {
 }
 
 static int afs_flush(const char *path, struct fuse_file_info *fi) {
-    (void)path;
+    if (afs_is_control(path)) {
+        return 0;
+    }
     struct appendfs_file *file = afs_file_from_fi(fi);
     if (!file) {
         return -EBADF;
@@ -291,7 +615,11 @@ static int afs_flush(const char *path, struct fuse_file_info *fi) {
 }
 
 static int afs_release(const char *path, struct fuse_file_info *fi) {
-    (void)path;
+    if (afs_is_control(path)) {
+        free((struct afs_snapshot *)(uintptr_t)fi->fh);
+        fi->fh = 0;
+        return 0;
+    }
     struct appendfs_file *file = afs_file_from_fi(fi);
     if (!file) {
         return -EBADF;
@@ -304,11 +632,26 @@ static int afs_release(const char *path, struct fuse_file_info *fi) {
 }
 
 static int afs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
-    (void)fi;
     if (strcmp(path, "/") == 0) {
         return 0;
     }
-    ssize_t rc = appendfs_read(afs_context(), path, buf, size, offset);
+    if (afs_is_control(path)) {
+        struct afs_snapshot *snap = (struct afs_snapshot *)(uintptr_t)fi->fh;
+        if (!snap || offset < 0) {
+            return -EBADF;
+        }
+        if ((size_t)offset >= snap->size) {
+            return 0;
+        }
+        size_t len = snap->size - (size_t)offset;
+        if (len > size) {
+            len = size;
+        }
+        memcpy(buf, snap->data + offset, len);
+        return (int)len;
+    }
+    struct appendfs_file *file = afs_file_from_fi(fi);
+    ssize_t rc = file ? appendfs_read_file(file, buf, size, offset) : appendfs_read(afs_context(), path, buf, size, offset);
     if (rc < 0) {
         return -errno;
     }
@@ -352,6 +695,9 @@ static int afs_truncate(const char *path, off_t size, struct fuse_file_info *fi)
     if (strcmp(path, "/") == 0) {
         return -EISDIR;
     }
+    if (afs_is_control(path)) {
+        return -EPERM;
+    }
     if (appendfs_truncate(afs_context(), path, size) == -1) {
         return -errno;
     }
@@ -359,7 +705,9 @@ static int afs_truncate(const char *path, off_t size, struct fuse_file_info *fi)
 }
 
 static int afs_fsync(const char *path, int datasync, struct fuse_file_info *fi) {
-    (void)path;
+    if (afs_is_control(path)) {
+        return 0;
+    }
     struct appendfs_file *file = afs_file_from_fi(fi);
     if (!file) {
         return -EBADF;
@@ -393,6 +741,9 @@ static int afs_utimens(const char *path, const struct timespec tv[2], struct fus
     if (strcmp(path, "/") == 0) {
         return 0;
     }
+    if (afs_is_control(path)) {
+        return -EPERM;
+    }
     if (appendfs_set_times(afs_context(), path, tv) == -1) {
         return -errno;
     }
@@ -400,6 +751,9 @@ static int afs_utimens(const char *path, const struct timespec tv[2], struct fus
 }
 
 static int afs_setxattr(const char *path, const char *name, const char *value, size_t size, int flags) {
+    if (afs_is_control(path)) {
+        return -EPERM;
+    }
     if (appendfs_setxattr(afs_context(), path, name, value, size, flags) == -1) {
         return -errno;
     }
@@ -407,6 +761,9 @@ static int afs_setxattr(const char *path, const char *name, const char *value, s
 }
 
 static int afs_getxattr(const char *path, const char *name, char *value, size_t size) {
+    if (afs_is_control(path)) {
+        return -ENODATA;
+    }
     ssize_t rc = appendfs_getxattr(afs_context(), path, name, value, size);
     if (rc < 0) {
         return -errno;
@@ -415,6 +772,9 @@ static int afs_getxattr(const char *path, const char *name, char *value, size_t
 }
 
 static int afs_listxattr(const char *path, char *list, size_t size) {
+    if (afs_is_control(path)) {
+        return 0;
+    }
     ssize_t rc = appendfs_listxattr(afs_context(), path, list, size);
     if (rc < 0) {
         return -errno;
@@ -423,6 +783,9 @@ static int afs_listxattr(const char *path, char *list, size_t size) {
 }
 
 static int afs_removexattr(const char *path, const char *name) {
+    if (afs_is_control(path)) {
+        return -EPERM;
+    }
     if (appendfs_removexattr(afs_context(), path, name) == -1) {
         return -errno;
     }
@@ -430,7 +793,9 @@ static int afs_removexattr(const char *path, const char *name) {
 }
 
 static off_t afs_lseek(const char *path, off_t off, int whence, struct fuse_file_info *fi) {
-    (void)path;
+    if (afs_is_control(path)) {
+        return whence == SEEK_SET && off >= 0 ? off : -EINVAL;
+    }
     struct appendfs_file *file = afs_file_from_fi(fi);
     if (!file) {
         errno = EBADF;
@@ -440,6 +805,8 @@ static off_t afs_lseek(const char *path, off_t off, int whence, struct fuse_file
 }
 
 static const struct fuse_operations afs_oper = {
+    .init = afs_init,
+    .destroy = afs_destroy,
     .getattr = afs_getattr,
     .access = afs_access,
     .opendir = afs_opendir,
@@ -499,16 +866,28 @@ int main(int argc, char *argv[]) {
     }
     free(store_copy);
 
-    if (state.config.write_buffer && state.config.write_buffer != APPENDFS_DEFAULT_BUFFER) {
-        struct appendfs_options opts = {
-            .write_buffer_size = state.config.write_buffer,
-        };
-        if (appendfs_set_options(state.ctx, &opts) == -1) {
-            fprintf(stderr, "appendfs: invalid buffer size\n");
-            appendfs_close(state.ctx);
-            fuse_opt_free_args(&args);
-            return 1;
-        }
+    struct appendfs_options opts = {
+        .write_buffer_size = state.config.write_buffer,
+        .buffer_pool_limit = state.config.buffer_pool,
+        .min_write_buffer_size = state.config.min_buffer,
+        .max_write_buffer_size = state.config.max_buffer,
+        .flush_interval_ms = state.config.flush_interval,
+        .dirty_age_ms = state.config.flush_age,
+        .read_cache_size = state.config.read_cache,
+        .flags = (state.config.no_flusher ? APPENDFS_OPT_NO_FLUSHER : 0) |
+                 (state.config.verify_reads ? APPENDFS_OPT_VERIFY_READS : 0) |
+                 (state.config.strict_atime ? APPENDFS_OPT_STRICTATIME : 0) |
+                 (state.config.no_atime ? APPENDFS_OPT_NOATIME : 0) |
+                 (state.config.no_read_cache ? APPENDFS_OPT_NO_READ_CACHE : 0) |
+                 (state.config.readahead ? APPENDFS_OPT_READAHEAD : 0) |
+                 (state.config.no_inline ? APPENDFS_OPT_NO_INLINE : 0) |
+                 (state.config.compress ? APPENDFS_OPT_COMPRESS : 0),
+    };
+    if (appendfs_set_options(state.ctx, &opts) == -1) {
+        fprintf(stderr, "appendfs: invalid buffer size\n");
+        appendfs_close(state.ctx);
+        fuse_opt_free_args(&args);
+        return 1;
     }
 
     int ret = fuse_main(args.argc, args.argv, &afs_oper, &state);
@@ -0,0 +1,223 @@
+#include "lz4.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define MIN_MATCH 4
+/* The format requires the last 5 bytes to be literals and the last match to start 12 bytes before the end. */
+#define LAST_LITERALS 5
+#define MATCH_FIND_LIMIT 12
+#define MAX_DISTANCE 65535
+#define HASH_BITS 12
+/* Every 2^SKIP_TRIGGER probes without a match, the search step grows by one. */
+#define SKIP_TRIGGER 6
+
+static uint32_t read32(const unsigned char *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint64_t read64(const unsigned char *p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+/* Bytes that match at p and ref, stopping at limit. */
+static size_t common_length(const unsigned char *p, const unsigned char *ref, const unsigned char *limit) {
+    const unsigned char *start = p;
+    while (limit - p >= 8) {
+        uint64_t diff = read64(p) ^ read64(ref);
+        if (diff) {
+#if (defined(__GNUC__) || defined(__clang__)) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return (size_t)(p - start) + (size_t)__builtin_ctzll(diff) / 8;
+#else
+            break;
+#endif
+        }
+        p += 8;
+        ref += 8;
+    }
+    while (p < limit && *p == *ref) {
+        p++;
+        ref++;
+    }
+    return (size_t)(p - start);
+}
+
+static uint32_t hash4(uint32_t value) {
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static unsigned char *put_length(unsigned char *op, size_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (unsigned char)length;
+    return op;
+}
+
+/* Room for a sequence: token, length bytes, literals and offset. */
+static size_t sequence_size(size_t literals, size_t match) {
+    return 1 + literals / 255 + 1 + literals + 2 + match / 255 + 1;
+}
+
+size_t appendfs_lz4_bound(size_t length) {
+    return length + length / 255 + 16;
+}
+
+size_t appendfs_lz4_compress(const void *src, size_t length, void *dst, size_t capacity) {
+    const unsigned char *in = src;
+    const unsigned char *ip = in;
+    const unsigned char *anchor = in;
+    const unsigned char *iend = in + length;
+    unsigned char *out = dst;
+    unsigned char *op = out;
+    unsigned char *oend = out + capacity;
+    uint32_t table[1u << HASH_BITS];
+    if (length > MATCH_FIND_LIMIT) {
+        const unsigned char *mflimit = iend - MATCH_FIND_LIMIT;
+        const unsigned char *matchlimit = iend - LAST_LITERALS;
+        memset(table, 0, sizeof(table));
+        ip++;
+        for (;;) {
+            const unsigned char *match;
+            unsigned int probes = 1u << SKIP_TRIGGER;
+            unsigned int step = 1;
+            for (;;) {
+                if (ip > mflimit) {
+                    goto last_literals;
+                }
+                uint32_t h = hash4(read32(ip));
+                match = in + table[h];
+                table[h] = (uint32_t)(ip - in);
+                if (ip - match <= MAX_DISTANCE && read32(match) == read32(ip)) {
+                    break;
+                }
+                ip += step;
+                step = probes++ >> SKIP_TRIGGER;
+            }
+            while (ip > anchor && match > in && ip[-1] == match[-1]) {
+                ip--;
+                match--;
+            }
+            const unsigned char *end = ip + MIN_MATCH + common_length(ip + MIN_MATCH, match + MIN_MATCH, matchlimit);
+            size_t literals = (size_t)(ip - anchor);
+            size_t match_len = (size_t)(end - ip) - MIN_MATCH;
+            if (sequence_size(literals, match_len) > (size_t)(oend - op)) {
+                return 0;
+            }
+            unsigned char *token = op++;
+            *token = (unsigned char)((literals >= 15 ? 15 : literals) << 4);
+            if (literals >= 15) {
+                op = put_length(op, literals - 15);
+            }
+            memcpy(op, anchor, literals);
+            op += literals;
+            size_t offset = (size_t)(ip - match);
+            *op++ = (unsigned char)(offset & 0xffu);
+            *op++ = (unsigned char)(offset >> 8);
+            *token |= (unsigned char)(match_len >= 15 ? 15 : match_len);
+            if (match_len >= 15) {
+                op = put_length(op, match_len - 15);
+            }
+            ip = end;
+            anchor = ip;
+            if (ip > mflimit) {
+                break;
+            }
+            table[hash4(read32(ip - 2))] = (uint32_t)(ip - 2 - in);
+        }
+    }
+last_literals:;
+    size_t literals = (size_t)(iend - anchor);
+    if (1 + literals / 255 + 1 + literals > (size_t)(oend - op)) {
+        return 0;
+    }
+    *op++ = (unsigned char)((literals >= 15 ? 15 : literals) << 4);
+    if (literals >= 15) {
+        op = put_length(op, literals - 15);
+    }
+    if (literals > 0) {
+        memcpy(op, anchor, literals);
+        op += literals;
+    }
+    return (size_t)(op - out);
+}
+
+static int get_length(const unsigned char **ip, const unsigned char *iend, size_t *length) {
+    unsigned int byte;
+    do {
+        if (*ip >= iend) {
+            return -1;
+        }
+        byte = *(*ip)++;
+        *length += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+int appendfs_lz4_decompress(const void *src, size_t length, void *dst, size_t capacity, size_t *decoded) {
+    const unsigned char *ip = src;
+    const unsigned char *iend = ip + length;
+    unsigned char *out = dst;
+    unsigned char *op = out;
+    unsigned char *oend = out + capacity;
+    while (ip < iend) {
+        unsigned int token = *ip++;
+        size_t literals = token >> 4;
+        if (literals == 15 && get_length(&ip, iend, &literals) == -1) {
+            return -1;
+        }
+        if (literals > (size_t)(iend - ip) || literals > (size_t)(oend - op)) {
+            return -1;
+        }
+        if (literals <= 16 && iend - ip >= 16 && oend - op >= 16) {
+            /* Short runs copy a fixed 16 bytes; the excess is overwritten later. */
+            memcpy(op, ip, 16);
+            op += literals;
+            ip += literals;
+        } else if (literals > 0) {
+            memcpy(op, ip, literals);
+            op += literals;
+            ip += literals;
+        }
+        if (ip == iend) {
+            break;
+        }
+        if (iend - ip < 2) {
+            return -1;
+        }
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - out)) {
+            return -1;
+        }
+        size_t match_len = token & 15u;
+        if (match_len == 15 && get_length(&ip, iend, &match_len) == -1) {
+            return -1;
+        }
+        match_len += MIN_MATCH;
+        if (match_len > (size_t)(oend - op)) {
+            return -1;
+        }
+        const unsigned char *ref = op - offset;
+        if (offset >= 8 && (size_t)(oend - op) >= match_len + 8) {
+            for (size_t i = 0; i < match_len; i += 8) {
+                memcpy(op + i, ref + i, 8);
+            }
+        } else if (offset >= match_len) {
+            memcpy(op, ref, match_len);
+        } else {
+            /* Overlapping copies repeat the last offset bytes. */
+            for (size_t i = 0; i < match_len; ++i) {
+                op[i] = ref[i];
+            }
+        }
+        op += match_len;
+    }
+    *decoded = (size_t)(op - out);
+    return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef APPENDFS_LZ4_H
+#define APPENDFS_LZ4_H
+
+#include <stddef.h>
+
+/*
+ * LZ4 block format (no frame header): sequences of a token, literals, a
+ * 16-bit match offset and a match length, ending in a literal run.  Output
+ * decodes with any LZ4 block decoder.  The compressor is greedy with one
+ * 4-byte hash probe per position and skips ahead faster the longer it goes
+ * without a match, so incompressible input costs little.
+ */
+size_t appendfs_lz4_bound(size_t length);
+
+/* Returns the compressed size, or 0 when it would not fit in capacity. */
+size_t appendfs_lz4_compress(const void *src, size_t length, void *dst, size_t capacity);
+
+/*
+ * Decode src into dst and store the decoded size in *decoded.  Returns -1
+ * when src is malformed or decodes to more than capacity bytes.
+ */
+int appendfs_lz4_decompress(const void *src, size_t length, void *dst, size_t capacity, size_t *decoded);
+
+#endif
@@ -0,0 +1,130 @@
+#include "names.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NAMES_INITIAL_BUCKETS 1024
+
+void appendfs_names_init(struct appendfs_names *names) {
+    memset(names, 0, sizeof(*names));
+}
+
+void appendfs_names_destroy(struct appendfs_names *names) {
+    for (size_t i = 0; i < names->bucket_count; ++i) {
+        struct appendfs_name *entry = names->buckets[i];
+        while (entry) {
+            struct appendfs_name *next = entry->next;
+            free(entry);
+            entry = next;
+        }
+    }
+    free(names->buckets);
+    memset(names, 0, sizeof(*names));
+}
+
+/* FNV-1a; names are short, so a simple byte loop is enough. */
+uint32_t appendfs_names_hash(const char *str, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static struct appendfs_name *lookup(const struct appendfs_names *names, const char *str, size_t len, uint32_t hash) {
+    if (names->bucket_count == 0) {
+        return NULL;
+    }
+    struct appendfs_name *entry = names->buckets[hash & (names->bucket_count - 1)];
+    while (entry) {
+        if (entry->hash == hash && entry->len == len && memcmp(entry->str, str, len) == 0) {
+            return entry;
+        }
+        entry = entry->next;
+    }
+    return NULL;
+}
+
+static int grow(struct appendfs_names *names) {
+    size_t new_count = names->bucket_count ? names->bucket_count * 2 : NAMES_INITIAL_BUCKETS;
+    struct appendfs_name **buckets = calloc(new_count, sizeof(*buckets));
+    if (!buckets) {
+        return -1;
+    }
+    for (size_t i = 0; i < names->bucket_count; ++i) {
+        struct appendfs_name *entry = names->buckets[i];
+        while (entry) {
+            struct appendfs_name *next = entry->next;
+            size_t slot = entry->hash & (new_count - 1);
+            entry->next = buckets[slot];
+            buckets[slot] = entry;
+            entry = next;
+        }
+    }
+    free(names->buckets);
+    names->buckets = buckets;
+    names->bucket_count = new_count;
+    return 0;
+}
+
+const struct appendfs_name *appendfs_names_find(const struct appendfs_names *names, const char *str, size_t len) {
+    return lookup(names, str, len, appendfs_names_hash(str, len));
+}
+
+const struct appendfs_name *appendfs_names_intern(struct appendfs_names *names, const char *str, size_t len) {
+    uint32_t hash = appendfs_names_hash(str, len);
+    struct appendfs_name *entry = lookup(names, str, len, hash);
+    if (entry) {
+        entry->refs++;
+        return entry;
+    }
+    if (len > UINT32_MAX) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    /* A failed grow only lengthens chains, unless there is no table yet. */
+    if (names->count >= names->bucket_count && grow(names) == -1 && names->bucket_count == 0) {
+        return NULL;
+    }
+    entry = malloc(sizeof(*entry) + len + 1);
+    if (!entry) {
+        return NULL;
+    }
+    entry->hash = hash;
+    entry->refs = 1;
+    entry->len = (uint32_t)len;
+    memcpy(entry->str, str, len);
+    entry->str[len] = '\0';
+    size_t slot = hash & (names->bucket_count - 1);
+    entry->next = names->buckets[slot];
+    names->buckets[slot] = entry;
+    names->count++;
+    names->bytes += len + 1;
+    return entry;
+}
+
+void appendfs_names_ref(const struct appendfs_name *name) {
+    ((struct appendfs_name *)name)->refs++;
+}
+
+void appendfs_names_release(struct appendfs_names *names, const struct appendfs_name *name) {
+    if (!name) {
+        return;
+    }
+    struct appendfs_name *entry = (struct appendfs_name *)name;
+    if (--entry->refs > 0) {
+        return;
+    }
+    struct appendfs_name **link = &names->buckets[entry->hash & (names->bucket_count - 1)];
+    while (*link && *link != entry) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = entry->next;
+    }
+    names->count--;
+    names->bytes -= entry->len + 1;
+    free(entry);
+}
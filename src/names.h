@@ -0,0 +1,35 @@
+#ifndef APPENDFS_NAMES_H
+#define APPENDFS_NAMES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Interned path components.  Every distinct name is stored once and shared
+ * by all inodes that use it, so equal names compare by pointer.  Entries are
+ * reference counted and freed when the last inode lets go.
+ */
+struct appendfs_name {
+    struct appendfs_name *next;
+    uint32_t hash;
+    uint32_t refs;
+    uint32_t len;
+    char str[];
+};
+
+struct appendfs_names {
+    struct appendfs_name **buckets;
+    size_t bucket_count;
+    size_t count;
+    size_t bytes;
+};
+
+void appendfs_names_init(struct appendfs_names *names);
+void appendfs_names_destroy(struct appendfs_names *names);
+uint32_t appendfs_names_hash(const char *str, size_t len);
+const struct appendfs_name *appendfs_names_find(const struct appendfs_names *names, const char *str, size_t len);
+const struct appendfs_name *appendfs_names_intern(struct appendfs_names *names, const char *str, size_t len);
+void appendfs_names_ref(const struct appendfs_name *name);
+void appendfs_names_release(struct appendfs_names *names, const struct appendfs_name *name);
+
+#endif
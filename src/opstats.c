@@ -0,0 +1,164 @@
+#define _POSIX_C_SOURCE 200809L
+#include "opstats.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char *const op_names[APPENDFS_OP_COUNT] = {
+    [APPENDFS_OP_MKDIRS] = "mkdirs",
+    [APPENDFS_OP_MKDIR] = "mkdir",
+    [APPENDFS_OP_CREATE_FILE] = "create_file",
+    [APPENDFS_OP_UNLINK] = "unlink",
+    [APPENDFS_OP_RMDIR] = "rmdir",
+    [APPENDFS_OP_RENAME] = "rename",
+    [APPENDFS_OP_SYMLINK] = "symlink",
+    [APPENDFS_OP_READLINK] = "readlink",
+    [APPENDFS_OP_OPEN_FILE] = "open_file",
+    [APPENDFS_OP_WRITE] = "write",
+    [APPENDFS_OP_READ] = "read",
+    [APPENDFS_OP_TRUNCATE] = "truncate",
+    [APPENDFS_OP_FLUSH] = "flush",
+    [APPENDFS_OP_CLOSE_FILE] = "close_file",
+    [APPENDFS_OP_FSYNC] = "fsync",
+    [APPENDFS_OP_FSYNCDIR] = "fsyncdir",
+    [APPENDFS_OP_SEEK] = "seek",
+    [APPENDFS_OP_SET_TIMES] = "set_times",
+    [APPENDFS_OP_STATFS] = "statfs",
+    [APPENDFS_OP_IS_DIRECTORY_EMPTY] = "is_directory_empty",
+    [APPENDFS_OP_SETXATTR] = "setxattr",
+    [APPENDFS_OP_GETXATTR] = "getxattr",
+    [APPENDFS_OP_LISTXATTR] = "listxattr",
+    [APPENDFS_OP_REMOVEXATTR] = "removexattr",
+    [APPENDFS_OP_ITERATE_CHILDREN] = "iterate_children",
+    [APPENDFS_OP_STAT] = "stat",
+    [APPENDFS_OP_BATCH] = "batch",
+    [APPENDFS_OP_SCRUB] = "scrub",
+    [APPENDFS_OP_FLUSH_BUFFER] = "flush_buffer",
+    [APPENDFS_OP_WRITE_RECORD] = "write_record",
+    [APPENDFS_OP_PREAD] = "pread",
+};
+
+static atomic_uint next_thread_slot;
+static _Thread_local unsigned int thread_slot;
+
+static unsigned int thread_shard(void) {
+    if (thread_slot == 0) {
+        thread_slot = atomic_fetch_add_explicit(&next_thread_slot, 1, memory_order_relaxed) + 1;
+    }
+    return thread_slot % APPENDFS_OPSTATS_SHARDS;
+}
+
+static unsigned int highest_bit(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63u - (unsigned int)__builtin_clzll(value);
+#else
+    unsigned int bit = 0;
+    while (value >>= 1) {
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+static unsigned int bucket_index(uint64_t ns) {
+    if (ns < 4) {
+        return (unsigned int)ns;
+    }
+    unsigned int msb = highest_bit(ns);
+    unsigned int idx = (msb - 1) * 4 + (unsigned int)((ns >> (msb - 2)) & 3u);
+    return idx < APPENDFS_OPSTATS_BUCKETS ? idx : APPENDFS_OPSTATS_BUCKETS - 1;
+}
+
+/* Midpoint of a bucket's range, the value reported for percentiles. */
+static uint64_t bucket_value(unsigned int idx) {
+    if (idx < 4) {
+        return idx;
+    }
+    unsigned int shift = idx / 4 - 1;
+    uint64_t low = (uint64_t)(4 + idx % 4) << shift;
+    return low + (((uint64_t)1 << shift) >> 1);
+}
+
+int appendfs_opstats_init(struct appendfs_opstats *stats) {
+    stats->shards = calloc(APPENDFS_OPSTATS_SHARDS, sizeof(*stats->shards));
+    return stats->shards ? 0 : -1;
+}
+
+void appendfs_opstats_destroy(struct appendfs_opstats *stats) {
+    free(stats->shards);
+    stats->shards = NULL;
+}
+
+uint64_t appendfs_opstats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* Returns the elapsed time so callers can reuse it, e.g. for tracing. */
+uint64_t appendfs_opstats_record(struct appendfs_opstats *stats, enum appendfs_op op, uint64_t start_ns, int failed, uint64_t bytes) {
+    uint64_t elapsed = appendfs_opstats_now() - start_ns;
+    if (!stats->shards) {
+        return elapsed;
+    }
+    struct appendfs_opstats_counters *c = &stats->shards[thread_shard()].ops[op];
+    atomic_fetch_add_explicit(&c->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&c->total_ns, elapsed, memory_order_relaxed);
+    atomic_fetch_add_explicit(&c->buckets[bucket_index(elapsed)], 1, memory_order_relaxed);
+    if (failed) {
+        atomic_fetch_add_explicit(&c->errors, 1, memory_order_relaxed);
+    }
+    if (bytes) {
+        atomic_fetch_add_explicit(&c->bytes, bytes, memory_order_relaxed);
+    }
+    uint64_t max = atomic_load_explicit(&c->max_ns, memory_order_relaxed);
+    while (elapsed > max && !atomic_compare_exchange_weak_explicit(&c->max_ns, &max, elapsed, memory_order_relaxed, memory_order_relaxed)) {
+    }
+    return elapsed;
+}
+
+/*
+ * Sum the shards.  Counters are read without stopping writers, so a snapshot
+ * taken under load may be off by the operations in flight.
+ */
+void appendfs_opstats_collect(const struct appendfs_opstats *stats, enum appendfs_op op, struct appendfs_op_stats *out) {
+    memset(out, 0, sizeof(*out));
+    if (!stats->shards) {
+        return;
+    }
+    uint64_t buckets[APPENDFS_OPSTATS_BUCKETS] = {0};
+    for (size_t s = 0; s < APPENDFS_OPSTATS_SHARDS; ++s) {
+        const struct appendfs_opstats_counters *c = &stats->shards[s].ops[op];
+        out->count += atomic_load_explicit(&c->count, memory_order_relaxed);
+        out->errors += atomic_load_explicit(&c->errors, memory_order_relaxed);
+        out->bytes += atomic_load_explicit(&c->bytes, memory_order_relaxed);
+        out->total_ns += atomic_load_explicit(&c->total_ns, memory_order_relaxed);
+        uint64_t max = atomic_load_explicit(&c->max_ns, memory_order_relaxed);
+        if (max > out->max_ns) {
+            out->max_ns = max;
+        }
+        for (size_t b = 0; b < APPENDFS_OPSTATS_BUCKETS; ++b) {
+            buckets[b] += atomic_load_explicit(&c->buckets[b], memory_order_relaxed);
+        }
+    }
+    uint64_t total = 0;
+    for (size_t b = 0; b < APPENDFS_OPSTATS_BUCKETS; ++b) {
+        total += buckets[b];
+    }
+    static const unsigned int permille[4] = {500, 900, 990, 999};
+    uint64_t *targets[4] = {&out->p50_ns, &out->p90_ns, &out->p99_ns, &out->p999_ns};
+    uint64_t seen = 0;
+    size_t next = 0;
+    for (unsigned int b = 0; b < APPENDFS_OPSTATS_BUCKETS && next < 4; ++b) {
+        seen += buckets[b];
+        while (next < 4 && seen > 0 && seen * 1000 >= total * permille[next]) {
+            uint64_t value = bucket_value(b);
+            *targets[next++] = value < out->max_ns ? value : out->max_ns;
+        }
+    }
+}
+
+const char *appendfs_opstats_name(enum appendfs_op op) {
+    return (unsigned int)op < APPENDFS_OP_COUNT ? op_names[op] : NULL;
+}
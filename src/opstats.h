@@ -0,0 +1,43 @@
+#ifndef APPENDFS_OPSTATS_H
+#define APPENDFS_OPSTATS_H
+
+#include "appendfs.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define APPENDFS_OPSTATS_SHARDS 16
+#define APPENDFS_OPSTATS_BUCKETS 160
+
+/*
+ * Per-operation counters and a log-linear latency histogram: four buckets
+ * per power of two of nanoseconds, exact below 8 ns and topping out at
+ * 2^40 ns.  Each thread updates one shard with relaxed atomic adds, picked
+ * once per thread, so the hot path takes no lock and concurrent threads
+ * rarely share a cache line.  Readers sum the shards.
+ */
+struct appendfs_opstats_counters {
+    _Atomic uint64_t count;
+    _Atomic uint64_t errors;
+    _Atomic uint64_t bytes;
+    _Atomic uint64_t total_ns;
+    _Atomic uint64_t max_ns;
+    _Atomic uint64_t buckets[APPENDFS_OPSTATS_BUCKETS];
+};
+
+struct appendfs_opstats_shard {
+    struct appendfs_opstats_counters ops[APPENDFS_OP_COUNT];
+};
+
+struct appendfs_opstats {
+    struct appendfs_opstats_shard *shards;
+};
+
+int appendfs_opstats_init(struct appendfs_opstats *stats);
+void appendfs_opstats_destroy(struct appendfs_opstats *stats);
+uint64_t appendfs_opstats_now(void);
+uint64_t appendfs_opstats_record(struct appendfs_opstats *stats, enum appendfs_op op, uint64_t start_ns, int failed, uint64_t bytes);
+void appendfs_opstats_collect(const struct appendfs_opstats *stats, enum appendfs_op op, struct appendfs_op_stats *out);
+const char *appendfs_opstats_name(enum appendfs_op op);
+
+#endif
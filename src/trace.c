@@ -0,0 +1,120 @@
+#define _POSIX_C_SOURCE 200809L
+#include "trace.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct trace_type_info {
+    const char *name;
+    const char *a_key;
+    const char *b_key;
+};
+
+static const struct trace_type_info trace_types[] = {
+    [APPENDFS_TRACE_RECORD] = {"record", "bytes", NULL},
+    [APPENDFS_TRACE_FLUSH] = {"flush", "inode", "bytes"},
+    [APPENDFS_TRACE_COMMIT] = {"commit", "data_bytes", "meta_bytes"},
+    [APPENDFS_TRACE_FSYNC] = {"fsync", "inode", NULL},
+    [APPENDFS_TRACE_FSYNCDIR] = {"fsyncdir", NULL, NULL},
+    [APPENDFS_TRACE_RENAME] = {"rename", NULL, NULL},
+    [APPENDFS_TRACE_REPLAY] = {"replay", "records", "bytes"},
+    [APPENDFS_TRACE_REPLAY_DONE] = {"replay_done", "records", "bytes"},
+};
+
+static uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+int appendfs_trace_init(struct appendfs_trace *trace) {
+    trace->slots = calloc(APPENDFS_TRACE_EVENTS, sizeof(*trace->slots));
+    atomic_init(&trace->head, 0);
+    return trace->slots ? 0 : -1;
+}
+
+void appendfs_trace_destroy(struct appendfs_trace *trace) {
+    free(trace->slots);
+    trace->slots = NULL;
+}
+
+void appendfs_trace_emit(struct appendfs_trace *trace, enum appendfs_trace_type type, uint32_t detail, uint64_t a, uint64_t b, uint64_t duration_ns) {
+    if (!trace->slots) {
+        return;
+    }
+    uint64_t n = atomic_fetch_add_explicit(&trace->head, 1, memory_order_relaxed);
+    struct appendfs_trace_slot *slot = &trace->slots[n % APPENDFS_TRACE_EVENTS];
+    atomic_store_explicit(&slot->seq, 2 * n + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&slot->time_ns, trace_now(), memory_order_relaxed);
+    atomic_store_explicit(&slot->type_detail, (uint64_t)type << 32 | detail, memory_order_relaxed);
+    atomic_store_explicit(&slot->a, a, memory_order_relaxed);
+    atomic_store_explicit(&slot->b, b, memory_order_relaxed);
+    atomic_store_explicit(&slot->duration_ns, duration_ns, memory_order_relaxed);
+    atomic_store_explicit(&slot->seq, 2 * n + 2, memory_order_release);
+}
+
+static int format_event(char *line, size_t size, uint64_t now, uint64_t time_ns, uint64_t type_detail, uint64_t a, uint64_t b, uint64_t duration_ns) {
+    unsigned int type = (unsigned int)(type_detail >> 32);
+    const struct trace_type_info *info = NULL;
+    if (type < sizeof(trace_types) / sizeof(trace_types[0]) && trace_types[type].name) {
+        info = &trace_types[type];
+    }
+    int len = snprintf(line, size, "t_us=%llu age_ms=%.3f event=%s", (unsigned long long)(time_ns / 1000),
+                       now > time_ns ? (double)(now - time_ns) / 1e6 : 0.0, info ? info->name : "unknown");
+    if (type == APPENDFS_TRACE_RECORD) {
+        len += snprintf(line + len, size - (size_t)len, " record=%u", (unsigned int)(type_detail & 0xffffffffu));
+    }
+    if (info && info->a_key) {
+        len += snprintf(line + len, size - (size_t)len, " %s=%llu", info->a_key, (unsigned long long)a);
+    }
+    if (info && info->b_key) {
+        len += snprintf(line + len, size - (size_t)len, " %s=%llu", info->b_key, (unsigned long long)b);
+    }
+    len += snprintf(line + len, size - (size_t)len, " duration_us=%.1f\n", (double)duration_ns / 1e3);
+    return len;
+}
+
+/*
+ * Oldest event first.  Slots overwritten while being read are skipped.
+ * Size 0 returns the length needed; a short buffer fails with ERANGE.
+ */
+ssize_t appendfs_trace_format(const struct appendfs_trace *trace, char *buf, size_t size) {
+    if (!trace->slots) {
+        return 0;
+    }
+    uint64_t now = trace_now();
+    uint64_t head = atomic_load_explicit(&trace->head, memory_order_acquire);
+    uint64_t first = head > APPENDFS_TRACE_EVENTS ? head - APPENDFS_TRACE_EVENTS : 0;
+    size_t used = 0;
+    for (uint64_t n = first; n < head; ++n) {
+        const struct appendfs_trace_slot *slot = &trace->slots[n % APPENDFS_TRACE_EVENTS];
+        uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq != 2 * n + 2) {
+            continue;
+        }
+        uint64_t time_ns = atomic_load_explicit(&slot->time_ns, memory_order_relaxed);
+        uint64_t type_detail = atomic_load_explicit(&slot->type_detail, memory_order_relaxed);
+        uint64_t a = atomic_load_explicit(&slot->a, memory_order_relaxed);
+        uint64_t b = atomic_load_explicit(&slot->b, memory_order_relaxed);
+        uint64_t duration_ns = atomic_load_explicit(&slot->duration_ns, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq) {
+            continue;
+        }
+        char line[256];
+        int len = format_event(line, sizeof(line), now, time_ns, type_detail, a, b, duration_ns);
+        if (size > 0) {
+            if (used + (size_t)len > size) {
+                errno = ERANGE;
+                return -1;
+            }
+            memcpy(buf + used, line, (size_t)len);
+        }
+        used += (size_t)len;
+    }
+    return (ssize_t)used;
+}
@@ -0,0 +1,85 @@
+#ifndef APPENDFS_TRACE_H
+#define APPENDFS_TRACE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * USDT probes for perf and bpftrace, compiled in when <sys/sdt.h> is
+ * available unless APPENDFS_NO_USDT is defined.  A disabled probe is a nop.
+ */
+#if defined(__has_include) && !defined(APPENDFS_NO_USDT)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define APPENDFS_HAVE_USDT 1
+#endif
+#endif
+
+#ifdef APPENDFS_HAVE_USDT
+#define APPENDFS_PROBE4(name, a, b, c, d) DTRACE_PROBE4(appendfs, name, a, b, c, d)
+#else
+#define APPENDFS_PROBE4(name, a, b, c, d) ((void)0)
+#endif
+
+#define APPENDFS_TRACE_EVENTS 4096
+
+/*
+ * Event fields by type (a, b, duration_ns; detail is the record type for
+ * RECORD and 0 otherwise):
+ *   RECORD       record bytes incl. header, -
+ *   FLUSH        inode id, bytes flushed
+ *   COMMIT       staged data bytes, queued metadata bytes
+ *   FSYNC        inode id, -
+ *   FSYNCDIR     -, -
+ *   RENAME       -, -
+ *   REPLAY       records applied so far, log bytes scanned so far
+ *   REPLAY_DONE  records applied, log bytes
+ */
+enum appendfs_trace_type {
+    APPENDFS_TRACE_RECORD = 1,
+    APPENDFS_TRACE_FLUSH,
+    APPENDFS_TRACE_COMMIT,
+    APPENDFS_TRACE_FSYNC,
+    APPENDFS_TRACE_FSYNCDIR,
+    APPENDFS_TRACE_RENAME,
+    APPENDFS_TRACE_REPLAY,
+    APPENDFS_TRACE_REPLAY_DONE,
+};
+
+/*
+ * One ring slot.  seq is 2 * (event number + 1) once the event is complete
+ * and odd while a writer fills it, so a reader can skip slots that are being
+ * overwritten.  Fields are atomics only to keep those races well defined.
+ */
+struct appendfs_trace_slot {
+    _Atomic uint64_t seq;
+    _Atomic uint64_t time_ns;
+    _Atomic uint64_t type_detail;
+    _Atomic uint64_t a;
+    _Atomic uint64_t b;
+    _Atomic uint64_t duration_ns;
+};
+
+/*
+ * Fixed-size ring of the most recent events.  Writers claim a slot with one
+ * atomic increment and never block; old events are overwritten.
+ */
+struct appendfs_trace {
+    struct appendfs_trace_slot *slots;
+    _Atomic uint64_t head;
+};
+
+#define APPENDFS_TRACE(trace, name, type, detail, a, b, duration_ns)                                          \
+    do {                                                                                                    \
+        appendfs_trace_emit((trace), (type), (detail), (uint64_t)(a), (uint64_t)(b), (uint64_t)(duration_ns)); \
+        APPENDFS_PROBE4(name, (detail), (uint64_t)(a), (uint64_t)(b), (uint64_t)(duration_ns));              \
+    } while (0)
+
+int appendfs_trace_init(struct appendfs_trace *trace);
+void appendfs_trace_destroy(struct appendfs_trace *trace);
+void appendfs_trace_emit(struct appendfs_trace *trace, enum appendfs_trace_type type, uint32_t detail, uint64_t a, uint64_t b, uint64_t duration_ns);
+ssize_t appendfs_trace_format(const struct appendfs_trace *trace, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,302 @@
+#define _GNU_SOURCE
+#include "appendfs.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+/*
+ * Regression checks for bugs found in review.  Each case runs against a fresh
+ * store under the directory given on the command line and reopens it where
+ * the bug only shows after replay.
+ */
+
+static const char *base_dir;
+static int case_index;
+
+static int fail(const char *what, int line) {
+    fprintf(stderr, "line %d: %s\n", line, what);
+    return -1;
+}
+
+#define CHECK(cond)                     \
+    do {                                \
+        if (!(cond)) {                  \
+            return fail(#cond, __LINE__); \
+        }                               \
+    } while (0)
+
+/* A fresh store directory for the next case. */
+static const char *fresh_store(char *out, size_t size) {
+    snprintf(out, size, "%s/case%d", base_dir, case_index++);
+    if (mkdir(out, 0755) == -1 && errno != EEXIST) {
+        return NULL;
+    }
+    return out;
+}
+
+/* Truncating a file must drop bytes still buffered in its open handles. */
+static int truncate_buffered(void) {
+    char dir[512];
+    struct appendfs_context *ctx = NULL;
+    CHECK(fresh_store(dir, sizeof(dir)) && appendfs_open(dir, &ctx) == 0);
+    char data[10000];
+    memset(data, 'a', sizeof(data));
+    struct appendfs_file *file = appendfs_open_file(ctx, "a", O_CREAT | O_RDWR, 0644);
+    CHECK(file);
+    CHECK(appendfs_write(file, data, sizeof(data), 0) == (ssize_t)sizeof(data));
+    CHECK(appendfs_truncate(ctx, "a", 100) == 0);
+    struct stat st;
+    char buf[sizeof(data)];
+    CHECK(appendfs_stat(ctx, "a", &st) == 0 && st.st_size == 100);
+    CHECK(appendfs_read(ctx, "a", buf, sizeof(buf), 0) == 100);
+    CHECK(appendfs_truncate(ctx, "a", 0) == 0);
+    CHECK(appendfs_stat(ctx, "a", &st) == 0 && st.st_size == 0);
+    CHECK(appendfs_read(ctx, "a", buf, sizeof(buf), 0) == 0);
+    CHECK(appendfs_close_file(file) == 0);
+    appendfs_close(ctx);
+    CHECK(appendfs_open(dir, &ctx) == 0);
+    CHECK(appendfs_stat(ctx, "a", &st) == 0 && st.st_size == 0);
+    appendfs_close(ctx);
+    return 0;
+}
+
+/*
+ * A batch whose write fails part way must log nothing: neither the creations
+ * before the write nor the one after it may appear, now or after a remount.
+ */
+static int batch_apply_failure(void) {
+    char dir[512];
+    struct appendfs_context *ctx = NULL;
+    CHECK(fresh_store(dir, sizeof(dir)) && appendfs_open(dir, &ctx) == 0);
+    size_t size = 1024 * 1024;
+    char *data = calloc(1, size);
+    CHECK(data);
+    struct appendfs_batch_op ops[4];
+    memset(ops, 0, sizeof(ops));
+    ops[0].type = APPENDFS_BATCH_CREATE;
+    ops[0].path = "x";
+    ops[0].mode = 0644;
+    ops[1].type = APPENDFS_BATCH_CREATE;
+    ops[1].path = "y";
+    ops[1].mode = 0644;
+    ops[2].type = APPENDFS_BATCH_WRITE;
+    ops[2].path = "x";
+    ops[2].data = data;
+    ops[2].size = size;
+    ops[3].type = APPENDFS_BATCH_CREATE;
+    ops[3].path = "z";
+    ops[3].mode = 0644;
+    /* Files may not grow past 64 KiB, so the 1 MiB write fails with EFBIG. */
+    struct rlimit saved;
+    struct rlimit limit;
+    CHECK(getrlimit(RLIMIT_FSIZE, &saved) == 0);
+    limit = saved;
+    limit.rlim_cur = 64 * 1024;
+    signal(SIGXFSZ, SIG_IGN);
+    CHECK(setrlimit(RLIMIT_FSIZE, &limit) == 0);
+    size_t failed_op = 0;
+    int rc = appendfs_batch(ctx, ops, 4, &failed_op);
+    setrlimit(RLIMIT_FSIZE, &saved);
+    free(data);
+    CHECK(rc == -1 && failed_op == 2);
+    struct stat st;
+    CHECK(appendfs_stat(ctx, "z", &st) == -1 && errno == ENOENT);
+    CHECK(appendfs_mkdir(ctx, "d", 0755) == -1 && errno == EIO);
+    appendfs_close(ctx);
+    CHECK(appendfs_open(dir, &ctx) == 0);
+    CHECK(appendfs_stat(ctx, "x", &st) == -1);
+    CHECK(appendfs_stat(ctx, "y", &st) == -1);
+    CHECK(appendfs_stat(ctx, "z", &st) == -1);
+    CHECK(appendfs_mkdir(ctx, "d", 0755) == 0);
+    appendfs_close(ctx);
+    return 0;
+}
+
+/* Two XATTR_CREATE operations on one name are rejected before anything applies. */
+static int batch_xattr_create_twice(void) {
+    char dir[512];
+    struct appendfs_context *ctx = NULL;
+    CHECK(fresh_store(dir, sizeof(dir)) && appendfs_open(dir, &ctx) == 0);
+    CHECK(appendfs_create_file(ctx, "f", 0644) == 0);
+    struct appendfs_batch_op ops[3];
+    memset(ops, 0, sizeof(ops));
+    ops[0].type = APPENDFS_BATCH_SETXATTR;
+    ops[0].path = "f";
+    ops[0].name = "user.k";
+    ops[0].data = "one";
+    ops[0].size = 3;
+    ops[0].flags = XATTR_CREATE;
+    ops[1].type = APPENDFS_BATCH_CREATE;
+    ops[1].path = "g";
+    ops[1].mode = 0644;
+    ops[2] = ops[0];
+    ops[2].data = "two";
+    size_t failed_op = 0;
+    CHECK(appendfs_batch(ctx, ops, 3, &failed_op) == -1 && errno == EEXIST && failed_op == 2);
+    struct stat st;
+    char value[8];
+    CHECK(appendfs_stat(ctx, "g", &st) == -1);
+    CHECK(appendfs_getxattr(ctx, "f", "user.k", value, sizeof(value)) == -1);
+    ops[2].flags = XATTR_REPLACE;
+    CHECK(appendfs_batch(ctx, ops, 3, &failed_op) == 0);
+    CHECK(appendfs_getxattr(ctx, "f", "user.k", value, sizeof(value)) == 3 && memcmp(value, "two", 3) == 0);
+    appendfs_close(ctx);
+    return 0;
+}
+
+/* Limit file size to the current size of $dir/meta so the next log write fails. */
+static int block_meta_writes(const char *dir, struct rlimit *saved) {
+    char path[600];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/meta", dir);
+    if (stat(path, &st) == -1 || getrlimit(RLIMIT_FSIZE, saved) == -1) {
+        return -1;
+    }
+    struct rlimit limit = *saved;
+    limit.rlim_cur = (rlim_t)st.st_size;
+    signal(SIGXFSZ, SIG_IGN);
+    return setrlimit(RLIMIT_FSIZE, &limit);
+}
+
+/*
+ * A transaction whose log write fails stays queued, so mkdirs and a replacing
+ * rename report the error but keep their effect, and the records reach the
+ * log with the next commit.
+ */
+static int txn_commit_write_failure(void) {
+    char dir[512];
+    struct appendfs_context *ctx = NULL;
+    CHECK(fresh_store(dir, sizeof(dir)) && appendfs_open(dir, &ctx) == 0);
+    CHECK(appendfs_create_file(ctx, "f", 0644) == 0);
+    CHECK(appendfs_create_file(ctx, "g", 0644) == 0);
+    struct rlimit saved;
+    CHECK(block_meta_writes(dir, &saved) == 0);
+    int mkdirs_rc = appendfs_mkdirs(ctx, "a/b/c", 0755);
+    int mkdirs_errno = errno;
+    int rename_rc = appendfs_rename(ctx, "f", "g");
+    int rename_errno = errno;
+    setrlimit(RLIMIT_FSIZE, &saved);
+    CHECK(mkdirs_rc == -1 && mkdirs_errno == EFBIG);
+    CHECK(rename_rc == -1 && rename_errno == EFBIG);
+    struct stat st;
+    CHECK(appendfs_stat(ctx, "a/b/c", &st) == 0 && S_ISDIR(st.st_mode));
+    CHECK(appendfs_stat(ctx, "f", &st) == -1 && appendfs_stat(ctx, "g", &st) == 0);
+    CHECK(appendfs_fsyncdir(ctx) == 0);
+    appendfs_close(ctx);
+    CHECK(appendfs_open(dir, &ctx) == 0);
+    CHECK(appendfs_stat(ctx, "a/b/c", &st) == 0 && S_ISDIR(st.st_mode));
+    CHECK(appendfs_stat(ctx, "f", &st) == -1 && appendfs_stat(ctx, "g", &st) == 0);
+    appendfs_close(ctx);
+    return 0;
+}
+
+/* Open a store that keeps even small files in extents. */
+static int open_no_inline(const char *dir, struct appendfs_context **ctx) {
+    struct appendfs_options opts;
+    if (appendfs_open(dir, ctx) == -1 || appendfs_get_options(*ctx, &opts) == -1) {
+        return -1;
+    }
+    opts.flags |= APPENDFS_OPT_NO_INLINE;
+    return appendfs_set_options(*ctx, &opts);
+}
+
+/* Write size bytes of c at offset and flush them into an extent of their own. */
+static int write_extent_of(struct appendfs_file *file, char c, size_t size, off_t offset) {
+    char data[10000];
+    memset(data, c, size);
+    if (appendfs_write(file, data, size, offset) != (ssize_t)size) {
+        return -1;
+    }
+    return appendfs_flush(file);
+}
+
+/* Bytes hidden by a later overwrite are dead, now and after a remount. */
+static int overwrite_dead_bytes(void) {
+    char dir[512];
+    struct appendfs_context *ctx = NULL;
+    CHECK(fresh_store(dir, sizeof(dir)) && open_no_inline(dir, &ctx) == 0);
+    struct appendfs_file *file = appendfs_open_file(ctx, "f", O_CREAT | O_RDWR, 0644);
+    CHECK(file);
+    CHECK(write_extent_of(file, 'a', 10000, 0) == 0);
+    CHECK(write_extent_of(file, 'b', 4000, 2000) == 0);
+    CHECK(write_extent_of(file, 'c', 3000, 5000) == 0);
+    CHECK(write_extent_of(file, 'd', 10000, 0) == 0);
+    CHECK(appendfs_close_file(file) == 0);
+    struct appendfs_space_stats space;
+    CHECK(appendfs_get_space_stats(ctx, &space) == 0);
+    CHECK(space.data_bytes == 27000 && space.live_bytes == 10000 && space.dead_bytes == 17000);
+    appendfs_close(ctx);
+    CHECK(open_no_inline(dir, &ctx) == 0);
+    CHECK(appendfs_get_space_stats(ctx, &space) == 0);
+    CHECK(space.live_bytes == 10000 && space.dead_bytes == 17000);
+    char buf[10000];
+    CHECK(appendfs_read(ctx, "f", buf, sizeof(buf), 0) == 10000 && buf[0] == 'd' && buf[9999] == 'd');
+    appendfs_close(ctx);
+    return 0;
+}
+
+/*
+ * Extents are in write order, so one written later can sit below one past
+ * the new size; truncate must keep it, and charge only the bytes it keeps.
+ */
+static int truncate_unsorted_extents(void) {
+    char dir[512];
+    struct appendfs_context *ctx = NULL;
+    CHECK(fresh_store(dir, sizeof(dir)) && open_no_inline(dir, &ctx) == 0);
+    struct appendfs_file *file = appendfs_open_file(ctx, "f", O_CREAT | O_RDWR, 0644);
+    CHECK(file);
+    CHECK(write_extent_of(file, 'x', 2000, 8000) == 0);
+    CHECK(write_extent_of(file, 'y', 4000, 0) == 0);
+    CHECK(write_extent_of(file, 'z', 2000, 3000) == 0);
+    CHECK(appendfs_close_file(file) == 0);
+    CHECK(appendfs_truncate(ctx, "f", 4000) == 0);
+    char buf[4000];
+    struct appendfs_space_stats space;
+    for (int pass = 0; pass < 2; ++pass) {
+        CHECK(appendfs_read(ctx, "f", buf, sizeof(buf), 0) == 4000);
+        CHECK(buf[0] == 'y' && buf[2999] == 'y' && buf[3000] == 'z' && buf[3999] == 'z');
+        CHECK(appendfs_get_space_stats(ctx, &space) == 0);
+        CHECK(space.live_bytes == 4000 && space.dead_bytes == 4000);
+        appendfs_close(ctx);
+        CHECK(open_no_inline(dir, &ctx) == 0);
+    }
+    appendfs_close(ctx);
+    return 0;
+}
+
+struct regress_case {
+    const char *name;
+    int (*run)(void);
+};
+
+static const struct regress_case cases[] = {
+    {"truncate_buffered", truncate_buffered},
+    {"batch_apply_failure", batch_apply_failure},
+    {"batch_xattr_create_twice", batch_xattr_create_twice},
+    {"txn_commit_write_failure", txn_commit_write_failure},
+    {"overwrite_dead_bytes", overwrite_dead_bytes},
+    {"truncate_unsorted_extents", truncate_unsorted_extents},
+};
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s DIR\n", argv[0]);
+        return 2;
+    }
+    base_dir = argv[1];
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        int rc = cases[i].run();
+        printf("%s %s\n", rc == 0 ? "ok" : "FAIL", cases[i].name);
+        failed |= rc != 0;
+    }
+    return failed;
+}
@@ -0,0 +1,56 @@
+#define _POSIX_C_SOURCE 200809L
+#include "appendfs.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-j threads] <store-dir>\n", prog);
+}
+
+static void report_error(const char *path, off_t offset, uint32_t length, void *user_data) {
+    (void)user_data;
+    printf("checksum mismatch: %s offset %lld length %u\n", path ? path : "(removed)", (long long)offset, length);
+}
+
+int main(int argc, char **argv) {
+    unsigned int threads = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:h")) != -1) {
+        switch (opt) {
+        case 'j':
+            threads = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind + 1 != argc) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    struct appendfs_context *ctx = NULL;
+    if (appendfs_open(argv[optind], &ctx) == -1) {
+        fprintf(stderr, "appendfs_open(%s): %s\n", argv[optind], strerror(errno));
+        return 2;
+    }
+    struct appendfs_scrub_report report;
+    if (appendfs_scrub(ctx, threads, &report, report_error, NULL) == -1) {
+        fprintf(stderr, "appendfs_scrub: %s\n", strerror(errno));
+        appendfs_close(ctx);
+        return 2;
+    }
+    appendfs_close(ctx);
+
+    printf("extents checked: %llu, without checksum: %llu, bytes: %llu, errors: %llu\n",
+           (unsigned long long)report.extents_checked,
+           (unsigned long long)report.extents_unchecksummed,
+           (unsigned long long)report.bytes_checked,
+           (unsigned long long)report.errors);
+    return report.errors ? 1 : 0;
+}